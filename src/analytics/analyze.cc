@@ -281,7 +281,11 @@ void doScale(void) // FIXME change to key? or blob?
         //blob.updateNoCopy(reply->str, reply->len,
                 //Magick::Blob::MallocAllocator);
         unsigned int r, c;
-        {
+        jpeg::JpegInfo info;
+        if (jpeg::probe(reply->str, reply->len, info)) {
+            r = info.height;
+            c = info.width;
+        } else {
             Magick::Image img;
             img.ping(blob); // read header only
             r = img.rows();
@@ -375,6 +379,7 @@ void doSIFT(int scale = -1)
     stringstream cmd;
     struct redisReply *reply = NULL;
     struct redisContext *redis = NULL;
+    jpeg::PooledMat decoded; // pixels reused across images
 
     if (scale >= (int)scales.size())
         throw runtime_error(string(__func__)
@@ -426,7 +431,9 @@ void doSIFT(int scale = -1)
         // Construct image object in opencv by decoding buffer.
         // Find the features.
         c1 = chrono::high_resolution_clock::now();
-        cv::Mat mat = jpeg::JPEGasMat(reply->str, reply->len);
+        if (!jpeg::JPEGasMat(reply->str, reply->len, decoded))
+            decoded.mat.release();
+        cv::Mat &mat = decoded.mat;
         c2 = chrono::high_resolution_clock::now();
         IplImage img(mat);
         freeReplyObject(reply); // release encoded image
@@ -434,6 +441,10 @@ void doSIFT(int scale = -1)
         cout << "  decode time "
             << chrono::duration_cast<std::chrono::microseconds>(c2-c1).count()
             << endl;
+        cout << "  pool hit/miss  "
+            << jpeg::BufferPool::local().stats().hits << "/"
+            << jpeg::BufferPool::local().stats().misses
+            << endl;
 
         cout << "  image size (dec)  "
             << mat.total() * mat.elemSize()
@@ -490,6 +501,7 @@ void doCascade(int scale = -1)
     stringstream cmd;
     struct redisReply *reply = NULL;
     struct redisContext *redis = NULL;
+    jpeg::PooledMat decoded; // pixels reused across images
 
     if (scale >= (int)scales.size())
         throw runtime_error(string(__func__)
@@ -537,7 +549,9 @@ void doCascade(int scale = -1)
         cout << "  image size (enc)  " << reply->len << endl;
 
         // Construct image object in opencv by decoding buffer.
-        cv::Mat mat = jpeg::JPEGasMat(reply->str, reply->len);
+        if (!jpeg::JPEGasMat(reply->str, reply->len, decoded))
+            decoded.mat.release();
+        cv::Mat &mat = decoded.mat;
         freeReplyObject(reply); // release encoded image
 
         cout << "  image size (dec)  "
@@ -606,6 +620,7 @@ void doHOG(int scale = -1)
     stringstream cmd;
     struct redisReply *reply = NULL;
     struct redisContext *redis = NULL;
+    jpeg::PooledMat decoded; // pixels reused across images
 
     if (scale >= (int)scales.size())
         throw runtime_error(string(__func__)
@@ -655,7 +670,9 @@ void doHOG(int scale = -1)
 
         // Construct image object in opencv by decoding buffer.
         // Find the features.
-        cv::Mat mat = jpeg::JPEGasMat(reply->str, reply->len);
+        if (!jpeg::JPEGasMat(reply->str, reply->len, decoded))
+            decoded.mat.release();
+        cv::Mat &mat = decoded.mat;
         freeReplyObject(reply); // release encoded image
 
         cout << "  image size (dec)  "
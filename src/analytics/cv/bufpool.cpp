@@ -0,0 +1,147 @@
+/**
+ * bufpool.cpp
+ */
+
+#include "bufpool.hpp"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <new>
+
+namespace jpeg
+{
+
+static const size_t HUGE_PAGE = 2UL << 20;
+
+static bool use_huge_pages = false;
+static int  max_per_class  = 4;
+
+void BufferPool::setHugePages( bool on )
+{
+    use_huge_pages = on;
+}
+
+void BufferPool::setMaxPerClass( int n )
+{
+    max_per_class = n < 0 ? 0 : n;
+}
+
+BufferPool::BufferPool()
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for( int c = 0; c < CLASSES; c++ )
+        for( size_t i = 0; i < m_free[c].size(); i++ )
+            free( m_free[c][i] );
+}
+
+BufferPool& BufferPool::local()
+{
+    static thread_local BufferPool pool;
+    return pool;
+}
+
+static int size_class( size_t bytes, size_t& cap )
+{
+    int shift = 16;
+    while( shift < 31 && ((size_t)1 << shift) < bytes )
+        shift++;
+    cap = (size_t)1 << shift;
+    return shift - 16;
+}
+
+void* BufferPool::acquire( size_t bytes, size_t& cap )
+{
+    int c = size_class( bytes, cap );
+    if( cap < bytes )
+    {
+        // beyond the largest class: plain allocation, never pooled
+        m_stats.misses++;
+        cap = bytes;
+        void* p = malloc( bytes );
+        if( !p )
+            throw std::bad_alloc();
+        return p;
+    }
+
+    if( !m_free[c].empty() )
+    {
+        void* p = m_free[c].back();
+        m_free[c].pop_back();
+        m_stats.hits++;
+        m_stats.cached -= cap;
+        return p;
+    }
+
+    m_stats.misses++;
+    void* p = 0;
+    if( use_huge_pages && cap >= HUGE_PAGE )
+    {
+        if( posix_memalign( &p, HUGE_PAGE, cap ) != 0 )
+            p = 0;
+#ifdef MADV_HUGEPAGE
+        else
+            madvise( p, cap, MADV_HUGEPAGE );
+#endif
+    }
+    else if( posix_memalign( &p, 64, cap ) != 0 )
+        p = 0;
+    if( !p )
+        throw std::bad_alloc();
+    return p;
+}
+
+void BufferPool::release( void* buf, size_t cap )
+{
+    if( !buf )
+        return;
+    size_t ccap;
+    int c = size_class( cap, ccap );
+    if( ccap != cap || (int)m_free[c].size() >= max_per_class )
+    {
+        m_stats.drops++;
+        free( buf );
+        return;
+    }
+    m_stats.returns++;
+    m_stats.cached += cap;
+    m_free[c].push_back( buf );
+}
+
+PooledMat::PooledMat() : m_buf(0), m_cap(0)
+{
+}
+
+PooledMat::~PooledMat()
+{
+    release();
+}
+
+cv::Mat& PooledMat::create( int rows, int cols, int type )
+{
+    size_t step = (size_t)cols * CV_ELEM_SIZE(type);
+    size_t bytes = step * rows;
+    if( bytes > m_cap )
+    {
+        release();
+        m_buf = BufferPool::local().acquire( bytes, m_cap );
+    }
+    mat = cv::Mat( rows, cols, type, m_buf, step );
+    return mat;
+}
+
+// Buffers are plain memory, so they go back to whichever thread's pool
+// releases them.
+void PooledMat::release()
+{
+    mat.release();
+    if( m_buf )
+        BufferPool::local().release( m_buf, m_cap );
+    m_buf = 0;
+    m_cap = 0;
+}
+
+}
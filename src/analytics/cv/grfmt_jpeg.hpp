@@ -45,6 +45,7 @@
 
 #include "grfmt_base.hpp"
 #include "bitstrm.hpp"
+#include "bufpool.hpp"
 
 // IJG-based Jpeg codec
 
@@ -62,12 +63,22 @@ public:
     bool  readHeader();
     void  close();
 
+    // decode at 1/denom of full size (denom = 1, 2, 4 or 8); the
+    // IDCT produces the smaller image directly. Set before readHeader.
+    void  setScale( int denom ) { m_scale_denom = denom; }
+    // decode only this rectangle, in output (scaled) coordinates; it is
+    // clipped to the image and an empty one means the whole image. Set
+    // before readHeader, which then reports the region's size.
+    void  setROI( const Rect& roi ) { m_roi = roi; }
+
     ImageDecoder newDecoder() const;
 
 protected:
 
     FILE* m_f;
     void* m_state;
+    int   m_scale_denom;
+    Rect  m_roi;
 };
 
 
@@ -79,13 +90,95 @@ public:
 
     bool  write( const Mat& img, const vector<int>& params );
     ImageEncoder newEncoder() const;
+
+    // expected output size when writing to a buffer; 0 estimates one
+    // from the image dimensions
+    void  setSizeHint( size_t bytes ) { m_size_hint = bytes; }
+
+protected:
+    size_t m_size_hint;
 };
 
+// Encodes an image handed over as successive bands of rows, so the
+// caller never needs the whole image in memory. Output is appended to
+// the vector given to open(). Input rows are BGR or grayscale.
+class JpegStreamEncoder
+{
+public:
+    JpegStreamEncoder();
+    ~JpegStreamEncoder();
+
+    // restart_rows > 0 puts a restart marker every that many MCU rows
+    bool  open( int width, int height, int channels,
+                vector<uchar>& buf, int quality = 95, size_t hint = 0,
+                int restart_rows = 0 );
+    bool  write( const Mat& rows );
+    bool  close();
+
+protected:
+    void* m_state;
+};
+
+// Codec behind JPEGasMat and MatToJPEG. TurboJPEG decodes or encodes a
+// whole image in one call; it is only available when built with
+// HAVE_TURBOJPEG, and is the default there unless JPEG_BACKEND=libjpeg
+// is set in the environment. Images TurboJPEG cannot handle fall back to
+// the libjpeg codec above.
+enum JpegBackend
+{
+    JPEG_BACKEND_LIBJPEG = 0,
+    JPEG_BACKEND_TURBO   = 1
+};
+
+void setJpegBackend( JpegBackend b );
+JpegBackend jpegBackend();
+
 // Mainly copied from invocation of imread_
 // data points to an in-memory representation of a compressed image as
 // it would be stored on disk.
 cv::Mat JPEGasMat(void *data, size_t len);
+// As above, but scaled down by 1/scale_denom (1, 2, 4 or 8) in the
+// decoder itself rather than decoded at full size and resized.
+cv::Mat JPEGasMat(void *data, size_t len, int scale_denom);
+// Decode into out, reusing its pixels when the size and type already
+// match (cv::Mat::create rules). Returns false on a bad stream.
+bool JPEGasMat(void *data, size_t len, cv::Mat &out, int scale_denom = 1);
+// Decode into a pooled buffer; repeated decodes into the same PooledMat
+// allocate only when an image needs more room than it has.
+bool JPEGasMat(void *data, size_t len, PooledMat &out, int scale_denom = 1);
+// Decode only roi (in coordinates of the image after scaling). Only the
+// MCUs covering it go through the IDCT and color conversion, and nothing
+// below it is read, so the cost follows the region rather than the
+// image. The entropy data above and beside it must still be parsed.
+cv::Mat JPEGasMat(void *data, size_t len, const cv::Rect &roi,
+        int scale_denom = 1);
+bool JPEGasMat(void *data, size_t len, const cv::Rect &roi, PooledMat &out,
+        int scale_denom = 1);
+// Images of at least min_pixels that carry restart markers are decoded
+// on up to threads threads (see restart.hpp); threads <= 1 turns this
+// off. Off by default, from 4 MP once on. Each strip thread is an extra
+// thread per decode, so the per-thread switch lets code that already
+// decodes in parallel opt its threads out.
+void setParallelDecode(int threads, size_t min_pixels);
+void setThreadParallelDecode(bool on);
+
+// Losslessly rewrite a JPEG as baseline with a restart marker every
+// rows MCU rows, so that later decodes can run in parallel. Markers such
+// as EXIF are carried over.
+bool addRestartMarkers(const void *data, size_t len, std::vector<uchar> &out,
+        int rows = 1);
+
+// The decode behind every JPEGasMat form: into mat, or into pm (mat then
+// refers to pm's pixels) when pm is given; gray yields one channel.
+bool decodeJPEG(void *data, size_t len, cv::Mat &mat, PooledMat *pm,
+        int scale_denom = 1, bool gray = false,
+        const cv::Rect &roi = cv::Rect());
+
 int MatToJPEG(cv::Mat &mat, void **data, size_t &len);
+// Encode straight into buf (replacing its contents) with no staging
+// copy: the encoder writes into buf's own storage, which is then cut to
+// the bytes written. hint is the expected size in bytes; 0 estimates one.
+int MatToJPEG(const cv::Mat &mat, std::vector<uchar> &buf, size_t hint = 0);
 
 }
 
@@ -0,0 +1,130 @@
+/**
+ * probe.cpp
+ */
+
+#include "probe.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace jpeg
+{
+
+enum { PROBE_BAD = -1, PROBE_SHORT = 0, PROBE_OK = 1 };
+
+static inline int be16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// Walk the marker segments up to the first SOS. PROBE_SHORT means the
+// header continues past len.
+static int parse(const unsigned char *p, size_t len, JpegInfo &info)
+{
+    memset(&info, 0, sizeof(info));
+    if (len < 2)
+        return PROBE_SHORT;
+    if (p[0] != 0xFF || p[1] != 0xD8)
+        return PROBE_BAD;
+
+    bool have_sof = false;
+    size_t pos = 2;
+    for (;;) {
+        // markers may be preceded by any number of 0xFF fill bytes
+        while (pos < len && p[pos] != 0xFF)
+            pos++;
+        while (pos < len && p[pos] == 0xFF)
+            pos++;
+        if (pos >= len)
+            return PROBE_SHORT;
+        const size_t mpos = pos - 1;
+        const int marker = p[pos++];
+
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+            continue; // standalone: TEM, RSTn
+        if (marker == 0xD9)
+            return PROBE_BAD; // EOI before any scan
+
+        if (pos + 2 > len)
+            return PROBE_SHORT;
+        const int seglen = be16(p + pos);
+        if (seglen < 2)
+            return PROBE_BAD;
+
+        if (marker == 0xDA) {
+            if (!have_sof)
+                return PROBE_BAD;
+            info.sos_offset = mpos;
+            return PROBE_OK;
+        }
+
+        if (pos + seglen > len)
+            return PROBE_SHORT;
+        const unsigned char *seg = p + pos + 2;
+
+        bool sof = marker >= 0xC0 && marker <= 0xCF
+            && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (sof && !have_sof) {
+            if (seglen < 8)
+                return PROBE_BAD;
+            info.precision  = seg[0];
+            info.height     = be16(seg + 1);
+            info.width      = be16(seg + 3);
+            info.components = seg[5];
+            if (seglen < 8 + 3 * info.components || info.components < 1)
+                return PROBE_BAD;
+            info.progressive = (marker & 0x03) == 0x02; // C2 C6 CA CE
+            info.arithmetic  = marker >= 0xC9;
+            int hmax = 1, vmax = 1;
+            for (int c = 0; c < info.components; c++) {
+                int hv = seg[6 + 3 * c + 1];
+                hmax = std::max(hmax, hv >> 4);
+                vmax = std::max(vmax, hv & 0x0F);
+            }
+            // a single-component scan uses 8x8 MCUs whatever the factors
+            info.mcu_width  = info.components == 1 ? 8 : 8 * hmax;
+            info.mcu_height = info.components == 1 ? 8 : 8 * vmax;
+            info.sof_offset = mpos;
+            have_sof = true;
+        } else if (marker == 0xDD) {
+            if (seglen < 4)
+                return PROBE_BAD;
+            info.restart_interval = be16(seg);
+        }
+        pos += seglen;
+    }
+}
+
+bool probe(const void *data, size_t len, JpegInfo &info)
+{
+    return parse((const unsigned char*)data, len, info) == PROBE_OK;
+}
+
+bool probe(const std::string &path, JpegInfo &info)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    // headers are usually a few KB, but EXIF and ICC segments can push
+    // the first SOS out; read more only while the parse comes up short
+    std::vector<unsigned char> buf;
+    size_t have = 0, want = 1 << 14;
+    int ret = PROBE_SHORT;
+    while (ret == PROBE_SHORT) {
+        buf.resize(want);
+        size_t n = fread(&buf[have], 1, want - have, fp);
+        have += n;
+        ret = parse(buf.data(), have, info);
+        if (n == 0)
+            break;
+        want <<= 1;
+    }
+    fclose(fp);
+    return ret == PROBE_OK;
+}
+
+}
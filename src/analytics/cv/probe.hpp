@@ -0,0 +1,37 @@
+/**
+ * probe.hpp
+ *
+ * Read a JPEG's frame parameters from its markers without decoding it.
+ * Parsing stops at the first SOS, so only the header bytes are touched.
+ */
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#include <stddef.h>
+#include <string>
+
+namespace jpeg
+{
+
+struct JpegInfo
+{
+    int width, height;
+    int components;      // 1 gray, 3 YCbCr/RGB, 4 CMYK/YCCK
+    int precision;       // bits per sample
+    bool progressive;
+    bool arithmetic;
+    int restart_interval; // MCUs between RST markers; 0 when there are none
+    int mcu_width, mcu_height; // in pixels, from the sampling factors
+    size_t sof_offset;   // of the SOF marker
+    size_t sos_offset;   // of the first SOS marker
+};
+
+// Returns true when data holds a JPEG header through the first SOS.
+bool probe(const void *data, size_t len, JpegInfo &info);
+// As above, reading only as much of the file as the header needs.
+bool probe(const std::string &path, JpegInfo &info);
+
+}
+
+#endif/*_PROBE_H_*/
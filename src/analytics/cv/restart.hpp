@@ -0,0 +1,66 @@
+/**
+ * restart.hpp
+ *
+ * Intra-image parallel decode. A baseline JPEG with restart markers can
+ * be cut at any restart boundary that falls at the start of an MCU row;
+ * each piece, given the original headers with the frame height patched
+ * and its RST markers renumbered from 0, is a JPEG of its own and
+ * decodes independently of the others.
+ *
+ * Encoding runs the same trick backwards: strips are encoded on their
+ * own with identical tables and their entropy data joined with RST
+ * markers under one set of headers.
+ */
+
+#ifndef _RESTART_H_
+#define _RESTART_H_
+
+#include <stddef.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "bufpool.hpp"
+#include "probe.hpp"
+
+namespace jpeg
+{
+
+struct RestartStrip
+{
+    int y, rows;              // pixel rows of the full-size image
+    std::vector<uchar> jpeg;  // standalone JPEG for those rows
+};
+
+// Cut data into at most parts strips of whole MCU rows. Returns false
+// when the image has no usable restart markers (none, progressive,
+// arithmetic, multi-scan, or intervals never meeting a row start).
+bool splitRestart(const void *data, size_t len, const JpegInfo &info,
+        int parts, std::vector<RestartStrip> &strips);
+
+// Decode each strip on its own thread straight into its rows of mat (or
+// of pm's buffer). Returns false when the image cannot be split or a
+// strip fails; the caller then decodes it whole.
+bool decodeRestartParallel(void *data, size_t len, const JpegInfo &info,
+        cv::Mat &mat, PooledMat *pm, int scale_denom, bool gray,
+        int threads);
+
+// Join JPEGs of consecutive strips of one image into out, under strip
+// 0's headers with the frame height set to rows. Each strip must be
+// coded by JpegStreamEncoder with the same width, channels and quality
+// and a restart_rows equal to the MCU rows of every strip but the last,
+// which may be shorter. strips are emptied. Returns false when their
+// headers disagree.
+bool joinRestartStrips(std::vector< std::vector<uchar> > &strips, int rows,
+        std::vector<uchar> &out);
+
+// Encode mat (BGR or gray) as a baseline JPEG whose restart interval is
+// one strip, coding the strips on up to threads threads. out is
+// replaced. Returns false when the image is too small to split or a
+// strip fails; the caller then encodes it whole.
+bool encodeRestartParallel(const cv::Mat &mat, std::vector<uchar> &out,
+        int quality, int threads);
+
+}
+
+#endif/*_RESTART_H_*/
@@ -1,9 +1,15 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <exception>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <time.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +22,9 @@
 //#include <jpeglib.h>
 //#include <turbojpeg.h>
 
+#include "cv/decoders.h"
+#include "cv/batch.hpp"
+
 using namespace std;
 
 static inline long
@@ -27,82 +36,398 @@ diff(struct timespec c1, struct timespec c2)
 
 // output dimensions known only after start_decompress
 #define get_outlen(cinfo) \
-    (cinfo.output_width * cinfo.output_height * cinfo.num_components)
+    (cinfo.output_width * cinfo.output_height * cinfo.output_components)
 #define get_rowlen(cinfo) \
-    (cinfo.output_width * cinfo.num_components)
+    (cinfo.output_width * cinfo.output_components)
+
+enum mode { MODE_SCANLINE, MODE_MAT, MODE_BATCH };
+
+struct options
+{
+    mode m;
+    int rows;       // scanlines per jpeg_read_scanlines (scanline mode)
+    int denom;      // DCT scaling 1/denom
+    bool gray;
+    bool turbo;     // TurboJPEG backend (mat and batch modes)
+    bool restart;   // allow restart-marker parallel decode (mat mode)
+    int threads;    // 0: one per core
+    int reps;
+    bool quiet;     // summary only
+
+    options(void)
+        : m(MODE_SCANLINE), rows(1), denom(1), gray(false), turbo(false),
+        restart(false), threads(1), reps(1), quiet(false) { ; }
+};
 
-// reads from stdin
-int decode(void)
+struct dims
+{
+    int width, height, comps;
+    int out_width, out_height;
+};
+
+// one mapped input image and what decoding it gave
+struct image
+{
+    string path;
+    void *map;
+    size_t len;
+    int fd;
+    // from the first repetition
+    bool ok;
+    dims d;
+    vector<long> usec; // one per repetition, -1 if it failed
+};
+
+struct jpeg_err
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+static void
+error_exit(j_common_ptr cinfo)
+{
+    longjmp(((jpeg_err*)cinfo->err)->jmp, 1);
+}
+
+// Plain libjpeg, as the original tool did, but straight into a
+// contiguous output buffer rows at a time. buf is reused across calls.
+static bool
+decode_scanline(const image &img, dims &d, const options &o,
+        vector<JSAMPLE> &buf)
 {
     struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    struct timespec c1,c2;
-    struct stat statinfo;
-    off_t maplen, outlen;
-    JSAMPROW rowp[1];
+    jpeg_err jerr;
+    vector<JSAMPROW> rowp;
+    bool ok = false;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = error_exit;
+    jpeg_create_decompress(&cinfo);
+
+    if (setjmp(jerr.jmp) == 0) {
+        jpeg_mem_src(&cinfo, (unsigned char*)img.map, img.len);
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = o.denom;
+        if (o.gray)
+            cinfo.out_color_space = JCS_GRAYSCALE;
+        jpeg_start_decompress(&cinfo);
+
+        size_t outlen = get_outlen(cinfo);
+        if (outlen < 1) {
+            // a throw from here would skip the destroy below
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        if (buf.size() < outlen)
+            buf.resize(outlen);
+        rowp.resize(cinfo.output_height);
+        for (size_t y = 0; y < rowp.size(); y++)
+            rowp[y] = &buf[y * get_rowlen(cinfo)];
+
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JDIMENSION n = min((JDIMENSION)o.rows,
+                    cinfo.output_height - cinfo.output_scanline);
+            jpeg_read_scanlines(&cinfo, &rowp[cinfo.output_scanline], n);
+        }
+        d.width = cinfo.image_width;
+        d.height = cinfo.image_height;
+        d.comps = cinfo.num_components;
+        d.out_width = cinfo.output_width;
+        d.out_height = cinfo.output_height;
+        jpeg_finish_decompress(&cinfo);
+        ok = true;
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return ok;
+}
+
+// The decode StormFuncs and analyze use, into a reused pooled buffer.
+static bool
+decode_mat(const image &img, dims &d, const options &o,
+        jpeg::PooledMat &pm)
+{
+    bool ok;
+    try {
+        ok = jpeg::decodeJPEG(img.map, img.len, pm.mat, &pm,
+                o.denom, o.gray);
+    } catch (exception &e) {
+        ok = false;
+    }
+    if (ok) {
+        jpeg::JpegInfo info;
+        if (jpeg::probe(img.map, img.len, info)) {
+            d.width = info.width;
+            d.height = info.height;
+            d.comps = info.components;
+        }
+        d.out_width = pm.mat.cols;
+        d.out_height = pm.mat.rows;
+    }
+    return ok;
+}
+
+// Decode every image o.reps times on o.threads threads, each taking the
+// next image as it finishes one, timing every image.
+static void
+run_timed(vector<image> &imgs, const options &o, int threads)
+{
+    atomic<size_t> next(0);
+    const size_t total = imgs.size() * o.reps;
+
+    auto work = [&]() {
+        vector<JSAMPLE> buf;
+        jpeg::PooledMat pm;
+        struct timespec c1, c2;
+        size_t i;
+        while ((i = next++) < total) {
+            image &img = imgs[i % imgs.size()];
+            const size_t r = i / imgs.size();
+            dims d = dims();
+            clock_gettime(CLOCK_MONOTONIC, &c1);
+            bool ok = o.m == MODE_SCANLINE
+                ? decode_scanline(img, d, o, buf) : decode_mat(img, d, o, pm);
+            clock_gettime(CLOCK_MONOTONIC, &c2);
+            img.usec[r] = ok ? diff(c1, c2) / 1000 : -1;
+            if (r == 0) {
+                img.ok = ok;
+                img.d = d;
+            }
+        }
+    };
+
+    vector<thread> pool;
+    for (int t = 1; t < threads; t++)
+        pool.push_back(thread(work));
+    work();
+    for (thread &t : pool)
+        t.join();
+}
 
-    cout << "file width height pix_len outbuf_len decode_usec" << endl;
+// The DecodeBatch pool; it hands back results but not per-image times.
+static size_t
+run_batch(vector<image> &imgs, const options &o, jpeg::DecodeBatch &batch)
+{
+    vector<jpeg::DecodeItem> items(imgs.size());
+    for (size_t i = 0; i < imgs.size(); i++) {
+        items[i] = jpeg::DecodeItem(imgs[i].map, imgs[i].len);
+        items[i].scale_denom = o.denom;
+        items[i].gray = o.gray;
+    }
+    size_t ok = 0;
+    for (int r = 0; r < o.reps; r++)
+        ok += batch.decode(items, [&](size_t i, cv::Mat &mat) {
+                imgs[i].ok = mat.data != nullptr;
+                imgs[i].d.out_width = mat.cols;
+                imgs[i].d.out_height = mat.rows; });
+    return ok;
+}
+
+static long
+percentile(const vector<long> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p / 100. * (sorted.size() - 1) + .5);
+    return sorted[min(i, sorted.size() - 1)];
+}
 
+// reads image paths from stdin, first field of each line
+static void
+map_inputs(vector<image> &imgs, int reps)
+{
+    struct stat statinfo;
     string line;
-    while (cin >> line) {
+    while (getline(cin, line)) {
+        size_t end = line.find_first_of(" \t");
+        string path = line.substr(0, end);
+        if (path.empty())
+            continue;
+
         // size of image
-        if (stat(line.data(), &statinfo))
-            throw runtime_error(strerror(errno));
-        maplen = statinfo.st_size;
+        if (stat(path.data(), &statinfo))
+            throw runtime_error(path + ": " + strerror(errno));
 
         // map image; populate to exclude disk i/o from measurement
         const int flags = MAP_SHARED | MAP_POPULATE;
-        int fd = open(line.data(), O_RDONLY);
-        if (fd < 0)
-            throw runtime_error(strerror(errno));
-        void *imgmap = mmap(NULL, maplen, PROT_READ, flags, fd, 0);
-        if (imgmap == MAP_FAILED)
-            throw runtime_error(strerror(errno));
+        image img;
+        img.path = path;
+        img.len = statinfo.st_size;
+        img.fd = open(path.data(), O_RDONLY);
+        if (img.fd < 0)
+            throw runtime_error(path + ": " + strerror(errno));
+        img.map = mmap(NULL, img.len, PROT_READ, flags, img.fd, 0);
+        if (img.map == MAP_FAILED)
+            throw runtime_error(path + ": " + strerror(errno));
+        img.ok = false;
+        img.d = dims();
+        img.usec.assign(reps, -1);
+        imgs.push_back(img);
+    }
+}
 
-        cinfo.err = jpeg_std_error(&jerr);
+static void
+usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [options] < list" << endl
+        << "  list holds one image path per line (extra fields, as in" << endl
+        << "  input-1k.lst, are ignored)" << endl
+        << "  -m mode    scanline (libjpeg, default), mat (decodeJPEG)," << endl
+        << "             batch (DecodeBatch, throughput only)" << endl
+        << "  -r rows    scanlines per read in scanline mode (1)" << endl
+        << "  -s denom   DCT scaling 1/denom: 1, 2, 4 or 8 (1)" << endl
+        << "  -g         grayscale output" << endl
+        << "  -T         TurboJPEG backend (mat, batch; needs TURBOJPEG=1)" << endl
+        << "  -P         allow restart-marker parallel decode of one image" << endl
+        << "  -t threads concurrent decodes, 0 for one per core (1)" << endl
+        << "  -n reps    decode the list this many times (1)" << endl
+        << "  -q         print the summary only" << endl;
+    exit(1);
+}
 
-        jpeg_create_decompress(&cinfo);
-        jpeg_mem_src(&cinfo, (unsigned char*)imgmap, maplen);
-        jpeg_read_header(&cinfo, false);
+int main(int narg, char *args[])
+{
+    options o;
 
-        jpeg_start_decompress(&cinfo);
+    // decode batch [threads]: the original batch invocation
+    if (narg > 1 && string(args[1]) == "batch") {
+        o.m = MODE_BATCH;
+        o.threads = narg > 2 ? atoi(args[2]) : 0;
+        o.quiet = true;
+    } else {
+        int c;
+        while ((c = getopt(narg, args, "m:r:s:gTPt:n:q")) != -1) {
+            switch (c) {
+            case 'm':
+                if (string(optarg) == "scanline") o.m = MODE_SCANLINE;
+                else if (string(optarg) == "mat") o.m = MODE_MAT;
+                else if (string(optarg) == "batch") o.m = MODE_BATCH;
+                else usage(args[0]);
+                break;
+            case 'r': o.rows = max(1, atoi(optarg)); break;
+            case 's': o.denom = atoi(optarg); break;
+            case 'g': o.gray = true; break;
+            case 'T': o.turbo = true; break;
+            case 'P': o.restart = true; break;
+            case 't': o.threads = atoi(optarg); break;
+            case 'n': o.reps = max(1, atoi(optarg)); break;
+            case 'q': o.quiet = true; break;
+            default: usage(args[0]);
+            }
+        }
+        if (optind != narg)
+            usage(args[0]);
+    }
+    if (o.denom != 1 && o.denom != 2 && o.denom != 4 && o.denom != 8)
+        usage(args[0]);
+    if (o.threads < 1)
+        o.threads = max(1U, thread::hardware_concurrency());
 
-        outlen = get_outlen(cinfo);
-        if (outlen < 1)
-            throw runtime_error("output buffer length is zero");
-        rowp[0] = (JSAMPROW)calloc(1, get_rowlen(cinfo));
-        if (!rowp[0])
-            throw runtime_error("OOM");
-        JSAMPARRAY outbuf = (JSAMPARRAY)calloc(1,outlen);
-        if (!outbuf)
-            throw runtime_error("OOM");
+    if (o.turbo) {
+        if (o.m == MODE_SCANLINE) {
+            cerr << "-T needs -m mat or -m batch" << endl;
+            return 1;
+        }
+        jpeg::setJpegBackend(jpeg::JPEG_BACKEND_TURBO);
+        if (jpeg::jpegBackend() != jpeg::JPEG_BACKEND_TURBO) {
+            cerr << "not built with TURBOJPEG=1" << endl;
+            return 1;
+        }
+    } else {
+        jpeg::setJpegBackend(jpeg::JPEG_BACKEND_LIBJPEG);
+    }
+    if (o.restart)
+        jpeg::setParallelDecode(max(1U, thread::hardware_concurrency()),
+                4000000);
+
+    vector<image> imgs;
+    map_inputs(imgs, o.reps);
+    if (imgs.empty())
+        usage(args[0]);
 
+    size_t bytes = 0;
+    for (image &img : imgs)
+        bytes += img.len;
+
+    struct timespec c1, c2;
+    size_t ok = 0;
+    int threads = o.threads;
+    size_t steals = 0;
+    if (o.m == MODE_BATCH) {
+        jpeg::DecodeBatch batch(o.threads);
+        threads = batch.threads();
         clock_gettime(CLOCK_MONOTONIC, &c1);
-        while (cinfo.output_scanline < cinfo.image_height) {
-            jpeg_read_scanlines(&cinfo, rowp, 1);
-        }
-        jpeg_finish_decompress(&cinfo);
+        ok = run_batch(imgs, o, batch);
+        clock_gettime(CLOCK_MONOTONIC, &c2);
+        steals = batch.steals();
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &c1);
+        run_timed(imgs, o, o.threads);
         clock_gettime(CLOCK_MONOTONIC, &c2);
+    }
 
-        cout << line.data();
-        cout << " " << cinfo.image_width;
-        cout << " " << cinfo.image_height;
-        cout << " " << cinfo.num_components;
-        cout << " " << outlen;
-        cout << " " << diff(c1,c2)/1e3 << endl;
-        cout.flush();
-
-        jpeg_destroy_decompress(&cinfo);
-        free(rowp[0]); rowp[0] = NULL;
-        free(outbuf); outbuf = NULL;
-        munmap(imgmap, maplen); imgmap = NULL;
-        close(fd); fd = -1;
+    vector<long> lat;
+    size_t pixels = 0;
+    for (image &img : imgs) {
+        for (long u : img.usec)
+            if (u >= 0)
+                lat.push_back(u);
+        if (o.m != MODE_BATCH)
+            for (long u : img.usec)
+                ok += u >= 0;
+        if (img.ok)
+            pixels += (size_t)img.d.out_width * img.d.out_height;
     }
+    pixels *= o.reps;
 
-    return 0;
-}
+    if (!o.quiet) {
+        cout << "file width height comps out_width out_height"
+            " bytes decode_usec" << endl;
+        for (image &img : imgs) {
+            long best = -1; // fastest successful repetition
+            for (long u : img.usec)
+                if (u >= 0 && (best < 0 || u < best))
+                    best = u;
+            cout << img.path
+                << " " << img.d.width
+                << " " << img.d.height
+                << " " << img.d.comps
+                << " " << img.d.out_width
+                << " " << img.d.out_height
+                << " " << img.len
+                << " " << best
+                << endl;
+        }
+        cout << endl;
+    }
 
-int main(int narg, char *args[])
-{
-    return decode();
+    // compressed input bytes per second, as codec comparisons quote it
+    sort(lat.begin(), lat.end());
+    double sec = diff(c1, c2) / 1e9;
+    const char *names[] = { "scanline", "mat", "batch" };
+    cout << "mode threads images decoded sec img_per_sec MB_per_sec"
+        " Mpix_per_sec p50_usec p90_usec p99_usec max_usec steals" << endl;
+    cout << names[o.m]
+        << " " << threads
+        << " " << imgs.size() * o.reps
+        << " " << ok
+        << " " << sec
+        << " " << ok / sec
+        << " " << bytes * o.reps / sec / (1<<20)
+        << " " << pixels / sec / 1e6;
+    if (lat.empty())
+        cout << " - - - -"; // batch mode has no per-image times
+    else
+        cout << " " << percentile(lat, 50)
+            << " " << percentile(lat, 90)
+            << " " << percentile(lat, 99)
+            << " " << lat.back();
+    cout << " " << steals << endl;
+
+    for (image &img : imgs) {
+        munmap(img.map, img.len);
+        close(img.fd);
+    }
+    return 0;
 }
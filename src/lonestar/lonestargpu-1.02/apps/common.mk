@@ -11,12 +11,20 @@ LINKS :=
 
 EXTRA := $(FLAGS) $(INCLUDES) $(LINKS)
 
+# apps with a main.cpp are host-only, built without nvcc.
+CPUFLAGS := -O3 -fopenmp
+CPUAPPS := $(foreach app,$(APPS),$(if $(wildcard $(patsubst %/.,%,$(app))/main.cpp),$(app)))
+GPUAPPS := $(filter-out $(CPUAPPS),$(APPS))
+
 .PHONY: all $(APPS) inputs
 
 all: $(APPS)
 
-$(APPS):
+$(GPUAPPS):
 	$(NVCC) $(EXTRA) -o $(BIN)/$(notdir $(subst /.,,$@)) $@/main.cu
+
+$(CPUAPPS):
+	$(GCC) $(CPUFLAGS) $(INCLUDES) -o $(BIN)/$(notdir $(subst /.,,$@)) $@/main.cpp
 #$(MAKE) -C $@ all
 
 inputs:
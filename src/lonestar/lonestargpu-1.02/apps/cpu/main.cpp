@@ -0,0 +1,150 @@
+/** CPU graph kernels -*- C++ -*-
+ * @file
+ * @section Description
+ *
+ * BFS, SSSP and connected components with OpenMP (cpukernels.h), on the
+ * same .gr and .edges inputs as the GPU apps, for offline runs on hosts
+ * without one. The number of threads is OMP_NUM_THREADS.
+ */
+
+#include "lonestargpu.h"
+#include "cpukernels.h"
+
+unsigned verifybfs(Graph &graph, InEdges &in, unsigned source, foru *dist, unsigned maxlevel) {
+	unsigned nerr = 0;
+	for (unsigned uu = 0; uu < graph.nnodes; ++uu) {
+		// no edge leads further than one level on, nor past maxlevel.
+		if (dist[uu] != MYINFINITY && dist[uu] > maxlevel) ++nerr;
+		if (dist[uu] < maxlevel) {
+			unsigned edge = cpufirstedge(graph, uu);
+			for (unsigned ee = 0; ee < graph.noutgoing[uu]; ++ee) {
+				unsigned vv = graph.edgessrcdst[edge + ee];
+				if (vv < graph.nnodes && dist[uu] + 1 < dist[vv]) ++nerr;
+			}
+		}
+		// and every vertex reached has a parent one level up.
+		if (uu != source && dist[uu] != MYINFINITY) {
+			bool parent = false;
+			for (unsigned ee = in.first[uu]; ee < in.first[uu + 1] && !parent; ++ee) {
+				parent = dist[in.src[ee]] + 1 == dist[uu];
+			}
+			if (!parent) ++nerr;
+		}
+	}
+	return nerr;
+}
+
+unsigned verifysssp(Graph &graph, foru *dist) {
+	unsigned nerr = 0;
+	for (unsigned uu = 0; uu < graph.nnodes; ++uu) {
+		if (dist[uu] == MYINFINITY) continue;
+		unsigned edge = cpufirstedge(graph, uu);
+		for (unsigned ee = 0; ee < graph.noutgoing[uu]; ++ee) {
+			unsigned vv = graph.edgessrcdst[edge + ee];
+			foru wt = graph.edgessrcwt[edge + ee];
+			if (vv < graph.nnodes && wt > 0 && dist[uu] + wt < dist[vv]) ++nerr;
+		}
+	}
+	return nerr;
+}
+
+unsigned verifycc(Graph &graph, unsigned *comp) {
+	unsigned nerr = 0;
+	for (unsigned uu = 0; uu < graph.nnodes; ++uu) {
+		if (comp[uu] > uu || comp[comp[uu]] != comp[uu]) ++nerr;
+		unsigned edge = cpufirstedge(graph, uu);
+		for (unsigned ee = 0; ee < graph.noutgoing[uu]; ++ee) {
+			unsigned vv = graph.edgessrcdst[edge + ee];
+			if (vv < graph.nnodes && comp[uu] != comp[vv]) ++nerr;
+		}
+	}
+	return nerr;
+}
+
+int main(int argc, char *argv[]) {
+	Graph graph;
+	unsigned source = 0, arg = 0;
+	double starttime, endtime;
+
+	if (argc < 3 || argc > 5 || (strcmp(argv[1], "bfs") && strcmp(argv[1], "sssp") && strcmp(argv[1], "cc"))) {
+		printf("Usage: %s bfs <graph> [source [maxlevel]]\n", argv[0]);
+		printf("       %s sssp <graph> [source [delta]]\n", argv[0]);
+		printf("       %s cc <graph>\n", argv[0]);
+		exit(1);
+	}
+	if (argc > 3) source = atoi(argv[3]);
+	if (argc > 4) arg = atoi(argv[4]);
+	std::string kernel(argv[1]);
+
+	graph.read(argv[2]);
+	if (graph.nnodes == 0) {
+		printf("Error: no graph read from %s.\n", argv[2]);
+		exit(1);
+	}
+	if (source >= graph.nnodes) {
+		printf("Error: source %d out of bounds %d.\n", source, graph.nnodes);
+		exit(1);
+	}
+	printf("threads = %d.\n", omp_get_max_threads());
+
+	std::vector<foru> dist(graph.nnodes);
+	unsigned nerr = 0;
+	if (kernel == "bfs") {
+		unsigned maxlevel = arg ? arg : MYINFINITY;
+		InEdges in;
+		printf("transposing.\n");
+		starttime = rtclock();
+		in.build(graph);
+		endtime = rtclock();
+		printf("\truntime = %.3lf ms.\n", 1000 * (endtime - starttime));
+
+		printf("solving.\n");
+		starttime = rtclock();
+		unsigned levels = cpubfs(graph, in, source, &dist[0], maxlevel);
+		endtime = rtclock();
+		unsigned reached = graph.nnodes - std::count(dist.begin(), dist.end(), (foru)MYINFINITY);
+		printf("\truntime = %.3lf ms levels = %d reached = %d.\n", 1000 * (endtime - starttime), levels, reached);
+
+		printf("verifying.\n");
+		nerr = verifybfs(graph, in, source, &dist[0], maxlevel);
+	} else if (kernel == "sssp") {
+		foru delta = arg;
+		if (delta == 0) {
+			// the mean weight: a few relaxation rounds per bucket.
+			long unsigned total = 0;
+			for (unsigned ee = 1; ee <= graph.nedges; ++ee) {
+				total += graph.edgessrcwt[ee];
+			}
+			delta = graph.nedges ? total / graph.nedges : 1;
+			if (delta == 0) delta = 1;
+		}
+		printf("solving, delta = %d.\n", delta);
+		starttime = rtclock();
+		unsigned rounds = cpusssp(graph, source, &dist[0], delta);
+		endtime = rtclock();
+		unsigned reached = graph.nnodes - std::count(dist.begin(), dist.end(), (foru)MYINFINITY);
+		printf("\truntime = %.3lf ms rounds = %d reached = %d.\n", 1000 * (endtime - starttime), rounds, reached);
+
+		printf("verifying.\n");
+		nerr = verifysssp(graph, &dist[0]);
+	} else {
+		printf("solving.\n");
+		starttime = rtclock();
+		unsigned ncomponents = cpucc(graph, &dist[0]);
+		endtime = rtclock();
+		std::vector<unsigned> complen(graph.nnodes, 0);
+		for (unsigned ii = 0; ii < graph.nnodes; ++ii) {
+			++complen[dist[ii]];
+		}
+		unsigned largest = *std::max_element(complen.begin(), complen.end());
+		printf("\truntime = %.3lf ms components = %d largest = %d.\n", 1000 * (endtime - starttime), ncomponents, largest);
+
+		printf("verifying.\n");
+		nerr = verifycc(graph, &dist[0]);
+	}
+	printf("\tno of errors = %d.\n", nerr);
+
+	// cleanup left to the OS.
+
+	return 0;
+}
@@ -2,7 +2,9 @@
 #define LSG_COMMON
 
 #include <stdio.h>
+#ifdef __CUDACC__
 #include <cuda.h>
+#endif
 #include <time.h>
 #include <fstream>
 #include <string>
@@ -69,6 +71,7 @@ double rtclock()
 }
 
 
+#ifdef __CUDACC__
 __device__ 
 void global_sync(unsigned goalVal, volatile unsigned *Arrayin, volatile unsigned *Arrayout) {
 	// thread ID in a block
@@ -143,6 +146,7 @@ inline int ConvertSMVer2Cores(int major, int minor)
         printf("MapSMtoCores SM %d.%d is undefined (please update to the latest SDK)!\n", major, minor);
         return -1;
 }
+#endif /* __CUDACC__ */
 
 
 #endif
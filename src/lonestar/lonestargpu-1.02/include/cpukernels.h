@@ -0,0 +1,297 @@
+/** CPU graph kernels -*- C++ -*-
+ * @file
+ * @section Description
+ *
+ * OpenMP versions of BFS, SSSP and connected components on the host
+ * copy of a Graph, as read() leaves it, for machines without a GPU:
+ *
+ *	cpubfs	direction-optimizing breadth-first search: top-down from a
+ *		frontier queue while the frontier is small, bottom-up over the
+ *		unvisited vertices (each looking for a parent in the frontier)
+ *		once the frontier's edges outnumber BFSALPHA-th of the rest.
+ *	cpusssp	delta-stepping: vertices in buckets of width delta by
+ *		tentative distance, the lowest bucket relaxed in parallel
+ *		until it stays empty.
+ *	cpucc	connected components, weak ones for directed inputs, by
+ *		lock-free union-find over the edges.
+ *
+ * Distances are MYINFINITY where unreached, as in the GPU apps.
+ */
+
+#ifndef LSG_CPUKERNELS
+#define LSG_CPUKERNELS
+
+#include <omp.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+// top-down -> bottom-up when frontier edges > unexplored edges / BFSALPHA;
+// back when the frontier shrinks below nnodes / BFSBETA.
+#define BFSALPHA	15
+#define BFSBETA		18
+
+// first of src's noutgoing[src] edges in edgessrcdst / edgessrcwt.
+static inline unsigned cpufirstedge(Graph &graph, unsigned src) {
+	return graph.psrc[graph.srcsrc[src]];
+}
+
+// the transpose, for bottom-up steps and checking parents.
+struct InEdges {
+	std::vector<unsigned> first;	// nnodes + 1, into src.
+	std::vector<unsigned> src;
+
+	void build(Graph &graph) {
+		unsigned nn = graph.nnodes;
+		first.assign(nn + 1, 0);
+		for (unsigned ii = 0; ii < nn; ++ii) {
+			unsigned edge = cpufirstedge(graph, ii);
+			for (unsigned ee = 0; ee < graph.noutgoing[ii]; ++ee) {
+				unsigned dst = graph.edgessrcdst[edge + ee];
+				if (dst < nn) ++first[dst + 1];
+			}
+		}
+		for (unsigned ii = 0; ii < nn; ++ii) {
+			first[ii + 1] += first[ii];
+		}
+		src.resize(first[nn]);
+		std::vector<unsigned> next(first.begin(), first.end() - 1);
+		for (unsigned ii = 0; ii < nn; ++ii) {
+			unsigned edge = cpufirstedge(graph, ii);
+			for (unsigned ee = 0; ee < graph.noutgoing[ii]; ++ee) {
+				unsigned dst = graph.edgessrcdst[edge + ee];
+				if (dst < nn) src[next[dst]++] = ii;
+			}
+		}
+	}
+};
+
+// levels from source into dist, at most maxlevel deep (k-hop sets);
+// returns the deepest level reached.
+static inline unsigned cpubfs(Graph &graph, InEdges &in, unsigned source, foru *dist, unsigned maxlevel = MYINFINITY) {
+	unsigned nn = graph.nnodes;
+	#pragma omp parallel for
+	for (unsigned ii = 0; ii < nn; ++ii) {
+		dist[ii] = MYINFINITY;
+	}
+	if (source >= nn) return 0;
+	dist[source] = 0;
+
+	std::vector<unsigned> queue(nn), nextqueue(nn);	// the frontier, top-down.
+	std::vector<unsigned char> front, next;	// the frontier, bottom-up.
+	unsigned qlen = 1;
+	queue[0] = source;
+	long unsigned scout = graph.noutgoing[source];	// frontier edges.
+	long unsigned unexplored = graph.nedges;
+	bool bottomup = false;
+	unsigned level = 0;
+
+	while (qlen && level < maxlevel) {
+		if (!bottomup && scout > unexplored / BFSALPHA) {
+			front.assign(nn, 0);
+			next.assign(nn, 0);
+			for (unsigned ii = 0; ii < qlen; ++ii) {
+				front[queue[ii]] = 1;
+			}
+			bottomup = true;
+		}
+		unexplored -= scout < unexplored ? scout : unexplored;
+
+		if (bottomup) {
+			unsigned awake = 0;
+			long unsigned awakeedges = 0;
+			#pragma omp parallel for schedule(dynamic, 1024) reduction(+:awake, awakeedges)
+			for (unsigned ii = 0; ii < nn; ++ii) {
+				next[ii] = 0;
+				if (dist[ii] != MYINFINITY) continue;
+				for (unsigned ee = in.first[ii]; ee < in.first[ii + 1]; ++ee) {
+					if (front[in.src[ee]]) {
+						dist[ii] = level + 1;
+						next[ii] = 1;
+						++awake;
+						awakeedges += graph.noutgoing[ii];
+						break;
+					}
+				}
+			}
+			front.swap(next);
+			unsigned prev = qlen;
+			qlen = awake;
+			scout = awakeedges;
+			if (qlen < prev && qlen < nn / BFSBETA) {
+				// back to a queue.
+				qlen = 0;
+				for (unsigned ii = 0; ii < nn; ++ii) {
+					if (front[ii]) queue[qlen++] = ii;
+				}
+				bottomup = false;
+			}
+		} else {
+			unsigned nextlen = 0;
+			long unsigned nextscout = 0;
+			#pragma omp parallel reduction(+:nextscout)
+			{
+				std::vector<unsigned> local;
+				#pragma omp for schedule(dynamic, 64) nowait
+				for (unsigned ii = 0; ii < qlen; ++ii) {
+					unsigned src = queue[ii];
+					unsigned edge = cpufirstedge(graph, src);
+					for (unsigned ee = 0; ee < graph.noutgoing[src]; ++ee) {
+						unsigned dst = graph.edgessrcdst[edge + ee];
+						if (dst < nn && dist[dst] == MYINFINITY && __sync_bool_compare_and_swap(&dist[dst], MYINFINITY, level + 1)) {
+							local.push_back(dst);
+							nextscout += graph.noutgoing[dst];
+						}
+					}
+				}
+				unsigned at = __sync_fetch_and_add(&nextlen, (unsigned)local.size());
+				std::copy(local.begin(), local.end(), nextqueue.begin() + at);
+			}
+			queue.swap(nextqueue);
+			qlen = nextlen;
+			scout = nextscout;
+		}
+		++level;
+	}
+	return qlen ? level : level - 1;
+}
+
+// distances from source into dist; returns the number of bucket
+// rounds. Any delta > 0 is correct: 1 makes it a BFS by weight, large
+// ones Bellman-Ford.
+static inline unsigned cpusssp(Graph &graph, unsigned source, foru *dist, foru delta) {
+	unsigned nn = graph.nnodes;
+	#pragma omp parallel for
+	for (unsigned ii = 0; ii < nn; ++ii) {
+		dist[ii] = MYINFINITY;
+	}
+	if (source >= nn || delta == 0) return 0;
+	dist[source] = 0;
+
+	// per thread, buckets bucket, bucket + 1, ...: relaxations never go
+	// below the bucket being relaxed.
+	std::vector<std::deque<std::vector<unsigned> > > bins(omp_get_max_threads());
+	// the lowest bucket each vertex waits in, so it waits there once.
+	std::vector<unsigned> queued(nn, (unsigned)-1);
+	queued[source] = 0;
+	std::vector<unsigned> frontier(1, source);
+	long unsigned bucket = 0;
+	unsigned rounds = 0;
+
+	while (!frontier.empty()) {
+		++rounds;
+		#pragma omp parallel
+		{
+			std::deque<std::vector<unsigned> > &mine = bins[omp_get_thread_num()];
+			#pragma omp for schedule(dynamic, 64)
+			for (unsigned ii = 0; ii < frontier.size(); ++ii) {
+				unsigned src = frontier[ii];
+				// stale: moved to a lower bucket, or relaxed this round.
+				if (queued[src] != bucket) continue;
+				// before reading dist, so any later update queues it again.
+				queued[src] = (unsigned)-1;
+				__sync_synchronize();
+				foru srcdist = dist[src];
+				unsigned edge = cpufirstedge(graph, src);
+				for (unsigned ee = 0; ee < graph.noutgoing[src]; ++ee) {
+					unsigned dst = graph.edgessrcdst[edge + ee];
+					foru altdist = srcdist + graph.edgessrcwt[edge + ee];
+					if (dst >= nn || altdist < srcdist) continue;	// overflow.
+					foru olddist = dist[dst];
+					while (altdist < olddist) {
+						if (__sync_bool_compare_and_swap(&dist[dst], olddist, altdist)) {
+							unsigned newbucket = altdist / delta, oldbucket = queued[dst];
+							while (newbucket < oldbucket) {
+								if (__sync_bool_compare_and_swap(&queued[dst], oldbucket, newbucket)) {
+									long unsigned bin = newbucket - bucket;
+									if (mine.size() <= bin) mine.resize(bin + 1);
+									mine[bin].push_back(dst);
+									break;
+								}
+								oldbucket = queued[dst];
+							}
+							break;
+						}
+						olddist = dist[dst];
+					}
+				}
+			}
+		}
+
+		// the lowest nonempty bucket, this one again if it refilled.
+		long unsigned bin = (long unsigned)-1;
+		for (unsigned tt = 0; tt < bins.size(); ++tt) {
+			for (unsigned bb = 0; bb < bins[tt].size() && bb < bin; ++bb) {
+				if (!bins[tt][bb].empty()) {
+					bin = bb;
+					break;
+				}
+			}
+		}
+		frontier.clear();
+		if (bin == (long unsigned)-1) break;
+		// drop the empty buckets below; the front is the new current one.
+		for (unsigned tt = 0; tt < bins.size(); ++tt) {
+			for (unsigned bb = 0; bb < bin && !bins[tt].empty(); ++bb) {
+				bins[tt].pop_front();
+			}
+			if (!bins[tt].empty()) {
+				frontier.insert(frontier.end(), bins[tt].front().begin(), bins[tt].front().end());
+				bins[tt].front().clear();
+			}
+		}
+		bucket += bin;
+	}
+	return rounds;
+}
+
+static inline unsigned cpufind(unsigned *comp, unsigned element) {
+	// path halving; the CAS fails harmlessly if a parent moved meanwhile.
+	while (comp[element] != element) {
+		unsigned parent = comp[element], grandparent = comp[parent];
+		if (parent != grandparent) {
+			__sync_bool_compare_and_swap(&comp[element], parent, grandparent);
+		}
+		element = grandparent;
+	}
+	return element;
+}
+
+// component of each vertex into comp, named by its smallest vertex;
+// returns the number of components.
+static inline unsigned cpucc(Graph &graph, unsigned *comp) {
+	unsigned nn = graph.nnodes;
+	#pragma omp parallel for
+	for (unsigned ii = 0; ii < nn; ++ii) {
+		comp[ii] = ii;
+	}
+	#pragma omp parallel for schedule(dynamic, 256)
+	for (unsigned ii = 0; ii < nn; ++ii) {
+		unsigned edge = cpufirstedge(graph, ii);
+		for (unsigned ee = 0; ee < graph.noutgoing[ii]; ++ee) {
+			unsigned one = ii, two = graph.edgessrcdst[edge + ee];
+			if (two >= nn) continue;
+			// hook the larger root under the smaller, so links always
+			// point down and cannot form cycles.
+			do {
+				one = cpufind(comp, one);
+				two = cpufind(comp, two);
+				if (one == two) break;
+				if (one < two) {
+					unsigned temp = one;
+					one = two;
+					two = temp;
+				}
+			} while (!__sync_bool_compare_and_swap(&comp[one], one, two));
+		}
+	}
+	unsigned ncomponents = 0;
+	#pragma omp parallel for reduction(+:ncomponents)
+	for (unsigned ii = 0; ii < nn; ++ii) {
+		comp[ii] = cpufind(comp, ii);
+		if (comp[ii] == ii) ++ncomponents;
+	}
+	return ncomponents;
+}
+
+#endif
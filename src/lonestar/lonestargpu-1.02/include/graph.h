@@ -9,27 +9,32 @@ typedef struct Graph {
 	enum {NotAllocated, AllocatedOnHost, AllocatedOnDevice} memory;
 
 	unsigned read(char file[]);
-	long unsigned cudaCopy(struct Graph &copygraph);
 	unsigned optimize();
+#ifdef __CUDACC__
+	long unsigned cudaCopy(struct Graph &copygraph);
 	unsigned printStats();
 	void     print();
+#endif
 
 	Graph();
 	~Graph();
 	unsigned init();
 	unsigned allocOnHost();
-	unsigned allocOnDevice();
 	unsigned dealloc();
 	unsigned deallocOnHost();
-	unsigned deallocOnDevice();
 	unsigned optimizeone();
 	unsigned optimizetwo();
-	void allocLevels();
-	void freeLevels();
 	void progressPrint(unsigned maxii, unsigned ii);
 	unsigned readFromEdges(char file[]);
 	unsigned readFromGR(char file[]);
 
+	// host-only builds (the CPU apps) get the reader and the arrays.
+#ifdef __CUDACC__
+	unsigned allocOnDevice();
+	unsigned deallocOnDevice();
+	void allocLevels();
+	void freeLevels();
+
 	__device__ void printStats1x1();
 	__device__ void print1x1();
 	__device__ unsigned getOutDegree(unsigned src);
@@ -46,6 +51,7 @@ typedef struct Graph {
 	__device__ void computeDiameter();
 	__device__ void computeInOut();
 	__device__ void initLevels();
+#endif
 
 
 	unsigned nnodes, nedges;
@@ -60,6 +66,7 @@ typedef struct Graph {
 
 } Graph;
 
+#ifdef __CUDACC__
 static unsigned CudaTest(char *msg);
 
 __device__ unsigned Graph::getOutDegree(unsigned src) {
@@ -165,6 +172,7 @@ __device__ void Graph::print1x1() {
 		printf("Error: nedges=%d, edgescounted=%d.\n", nedges, edgescounted);
 	}
 }
+#endif /* __CUDACC__ */
 unsigned Graph::init() {
 	noutgoing = nincoming = srcsrc = psrc = edgessrcdst = NULL;
 	edgessrcwt = NULL;
@@ -195,6 +203,7 @@ unsigned Graph::allocOnHost() {
 	memory = AllocatedOnHost;
 	return 0;
 }
+#ifdef __CUDACC__
 unsigned Graph::allocOnDevice() {
 	if (cudaMalloc((void **)&edgessrcdst, (nedges+1) * sizeof(unsigned int)) != cudaSuccess) 
 		CudaTest("allocating edgessrcdst failed");
@@ -217,6 +226,7 @@ unsigned Graph::allocOnDevice() {
 	memory = AllocatedOnDevice;
 	return 0;
 }
+#endif
 unsigned Graph::deallocOnHost() {
 	free(noutgoing);
 	free(nincoming);
@@ -229,6 +239,7 @@ unsigned Graph::deallocOnHost() {
 	free(maxInDegree);
 	return 0;
 }
+#ifdef __CUDACC__
 unsigned Graph::deallocOnDevice() {
 	cudaFree(noutgoing);
 	cudaFree(nincoming);
@@ -241,16 +252,21 @@ unsigned Graph::deallocOnDevice() {
 	cudaFree(maxInDegree);
 	return 0;
 }
+#endif
 unsigned Graph::dealloc() {
 	switch (memory) {
 		case AllocatedOnHost:
 			printf("dealloc on host.\n");
 			deallocOnHost();
 			break;
+#ifdef __CUDACC__
 		case AllocatedOnDevice:
 			printf("dealloc on device.\n");
 			deallocOnDevice();
 			break;
+#endif
+		default:
+			break;
 	}
 	return 0;
 }
@@ -331,7 +347,7 @@ void Graph::progressPrint(unsigned maxii, unsigned ii) {
 	unsigned ineachstep = (maxii / nsteps);
 	/*if (ii == maxii) {
 		printf("\t100%%\n");
-	} else*/ if (ii % ineachstep == 0) {
+	} else*/ if (ineachstep == 0 || ii % ineachstep == 0) {	// under nsteps nodes: every one.
 		printf("\t%3d%%\r", ii*100/maxii + 1);
 		fflush(stdout);
 	}
@@ -447,7 +463,7 @@ unsigned Graph::readFromGR(char file[]) {
 			unsigned dst = le32toh(outs[edgeindex - 1]);
 			if (dst >= nnodes) printf("\tinvalid edge from %d to %d at index %d(%d).\n", ii, dst, jj, edgeindex);
 			edgessrcdst[edgeindex] = dst;
-			edgessrcwt[edgeindex] = edgeData[edgeindex - 1];
+			edgessrcwt[edgeindex] = sizeEdgeTy ? edgeData[edgeindex - 1] : 1;	// unweighted: hops.
 
 			++nincoming[dst];
 			//if (ii == 194 || ii == 352) {
@@ -468,6 +484,7 @@ unsigned Graph::read(char file[]) {
 	}
 	return 0;
 }
+#ifdef __CUDACC__
 long unsigned Graph::cudaCopy(struct Graph &copygraph) {
 	long unsigned totalcommu = 0;
 	copygraph.nnodes = nnodes;
@@ -624,4 +641,5 @@ unsigned Graph::printStats() {
 	freeLevels();
 	return 0;
 }
+#endif /* __CUDACC__ */
 #endif
@@ -3,8 +3,10 @@
 
 #include "common.h"
 #include "graph.h"
+#ifdef __CUDACC__
 #include "kernelconfig.h"
 #include "list.h"
 #include "component.h"
+#endif
 
 #endif
@@ -0,0 +1,615 @@
+/**
+ * AttrIndex.cpp
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include "AttrIndex.hpp"
+
+static const char ATTRINDEX_MAGIC[8] = { 'G','R','A','P','H','A','T','R' };
+
+namespace
+{
+
+const size_t WORDS = (1 << 16) / 64; // in a bits chunk
+
+enum { ARRAY = 0, BITS = 1 };
+
+// serialized chunk header
+struct ChunkHeader
+{
+    uint16_t key;
+    uint16_t kind;
+    uint32_t card;
+};
+
+inline size_t pad8(size_t len) { return (len + 7) & ~(size_t)7; }
+
+inline size_t payload(const ChunkHeader &h)
+{
+    return h.kind == BITS ? WORDS * 8 : pad8(h.card * 2);
+}
+
+// bytes of the serialized bitmap at data, or 0 if it is not one
+size_t check(const uint8_t *data, size_t len)
+{
+    uint64_t count;
+    if (len < 8)
+        return 0;
+    memcpy(&count, data, 8);
+    if (count > (1 << 16) || (len - 8) / 8 < count)
+        return 0;
+    const ChunkHeader *hs = (const ChunkHeader*)(data + 8);
+    size_t at = 8 + count * 8;
+    for (size_t i = 0; i < count; i++) {
+        const ChunkHeader &h = hs[i];
+        if ((i && h.key <= hs[i - 1].key) || h.card == 0
+                || h.kind > BITS || h.card > (1 << 16)
+                || (h.kind == ARRAY && h.card > Bitmap::ARRAY_MAX)
+                || len - at < payload(h))
+            return 0;
+        if (h.kind == ARRAY) {
+            const uint16_t *a = (const uint16_t*)(data + at);
+            for (size_t j = 1; j < h.card; j++)
+                if (a[j] <= a[j - 1])
+                    return 0;
+        } else {
+            const uint64_t *w = (const uint64_t*)(data + at);
+            size_t card = 0;
+            for (size_t j = 0; j < WORDS; j++)
+                card += __builtin_popcountll(w[j]);
+            if (card != h.card)
+                return 0;
+        }
+        at += payload(h);
+    }
+    return at;
+}
+
+// largest value in a checked serialized bitmap, -1 if empty
+int64_t last_value(const uint8_t *data)
+{
+    const uint64_t count = *(const uint64_t*)data;
+    if (!count)
+        return -1;
+    const ChunkHeader *hs = (const ChunkHeader*)(data + 8);
+    const uint8_t *at = data + 8 + count * 8;
+    for (size_t i = 0; i + 1 < count; i++)
+        at += payload(hs[i]);
+    const ChunkHeader &h = hs[count - 1];
+    int64_t lo;
+    if (h.kind == BITS) {
+        const uint64_t *w = (const uint64_t*)at;
+        size_t i = WORDS - 1;
+        while (!w[i])
+            i--;
+        lo = i * 64 + 63 - __builtin_clzll(w[i]);
+    } else
+        lo = ((const uint16_t*)at)[h.card - 1];
+    return ((int64_t)h.key << 16) | lo;
+}
+
+}
+
+//==--------------------------------------------------------------==//
+// Bitmap
+//==--------------------------------------------------------------==//
+
+void Bitmap::toBits(Chunk &c)
+{
+    c.bits.assign(WORDS, 0);
+    for (uint16_t lo : c.array)
+        c.bits[lo >> 6] |= 1ULL << (lo & 63);
+    std::vector<uint16_t>().swap(c.array);
+}
+
+void Bitmap::toArray(Chunk &c)
+{
+    c.array.clear();
+    c.array.reserve(c.card);
+    for (size_t w = 0; w < WORDS; w++)
+        for (uint64_t word = c.bits[w]; word; word &= word - 1)
+            c.array.push_back(w * 64 + __builtin_ctzll(word));
+    std::vector<uint64_t>().swap(c.bits);
+}
+
+void Bitmap::add(uint32_t v)
+{
+    const uint16_t hi = v >> 16, lo = v & 0xFFFF;
+    auto byKey = [](const Chunk &c, uint16_t k) { return c.key < k; };
+    std::vector<Chunk>::iterator c;
+    if (!chunks.empty() && chunks.back().key >= hi)
+        c = std::lower_bound(chunks.begin(), chunks.end(), hi, byKey);
+    else
+        c = chunks.end();
+    if (c == chunks.end() || c->key != hi) {
+        c = chunks.insert(c, Chunk());
+        c->key = hi;
+        c->card = 0;
+    }
+
+    if (c->isBits()) {
+        uint64_t &word = c->bits[lo >> 6];
+        const uint64_t bit = 1ULL << (lo & 63);
+        if (!(word & bit)) {
+            word |= bit;
+            c->card++;
+        }
+        return;
+    }
+    std::vector<uint16_t> &a = c->array;
+    if (a.empty() || a.back() < lo)
+        a.push_back(lo);
+    else {
+        auto at = std::lower_bound(a.begin(), a.end(), lo);
+        if (*at == lo)
+            return;
+        a.insert(at, lo);
+    }
+    if (++c->card > ARRAY_MAX)
+        toBits(*c);
+}
+
+bool Bitmap::contains(uint32_t v) const
+{
+    const uint16_t hi = v >> 16, lo = v & 0xFFFF;
+    auto c = std::lower_bound(chunks.begin(), chunks.end(), hi,
+            [](const Chunk &c, uint16_t k) { return c.key < k; });
+    if (c == chunks.end() || c->key != hi)
+        return false;
+    if (c->isBits())
+        return (c->bits[lo >> 6] >> (lo & 63)) & 1;
+    return std::binary_search(c->array.begin(), c->array.end(), lo);
+}
+
+size_t Bitmap::size(void) const
+{
+    size_t n = 0;
+    for (const Chunk &c : chunks)
+        n += c.card;
+    return n;
+}
+
+Bitmap& Bitmap::operator&=(const Bitmap &b)
+{
+    if (&b == this)
+        return *this;
+    std::vector<Chunk> out;
+    auto i = chunks.begin();
+    auto j = b.chunks.begin();
+    while (i != chunks.end() && j != b.chunks.end()) {
+        if (i->key < j->key) {
+            ++i;
+            continue;
+        }
+        if (j->key < i->key) {
+            ++j;
+            continue;
+        }
+        Chunk c;
+        c.key = i->key;
+        if (i->isBits() && j->isBits()) {
+            c.bits.resize(WORDS);
+            c.card = 0;
+            for (size_t w = 0; w < WORDS; w++) {
+                c.bits[w] = i->bits[w] & j->bits[w];
+                c.card += __builtin_popcountll(c.bits[w]);
+            }
+            if (c.card <= ARRAY_MAX)
+                toArray(c);
+        } else if (i->isBits() || j->isBits()) {
+            const Chunk &bits = i->isBits() ? *i : *j;
+            const Chunk &arr = i->isBits() ? *j : *i;
+            for (uint16_t lo : arr.array)
+                if ((bits.bits[lo >> 6] >> (lo & 63)) & 1)
+                    c.array.push_back(lo);
+            c.card = c.array.size();
+        } else {
+            std::set_intersection(i->array.begin(), i->array.end(),
+                    j->array.begin(), j->array.end(),
+                    std::back_inserter(c.array));
+            c.card = c.array.size();
+        }
+        if (c.card)
+            out.push_back(std::move(c));
+        ++i;
+        ++j;
+    }
+    chunks.swap(out);
+    return *this;
+}
+
+Bitmap& Bitmap::operator|=(const Bitmap &b)
+{
+    if (&b == this)
+        return *this;
+    std::vector<Chunk> out;
+    auto i = chunks.begin();
+    auto j = b.chunks.begin();
+    while (i != chunks.end() || j != b.chunks.end()) {
+        if (j == b.chunks.end() || (i != chunks.end() && i->key < j->key)) {
+            out.push_back(std::move(*i++));
+            continue;
+        }
+        if (i == chunks.end() || j->key < i->key) {
+            out.push_back(*j++);
+            continue;
+        }
+        Chunk c;
+        c.key = i->key;
+        if (i->isBits() || j->isBits()) {
+            const bool ibits = i->isBits();
+            if (ibits)
+                c.bits.swap(i->bits);
+            else
+                c.bits = j->bits;
+            const Chunk &other = ibits ? *j : *i;
+            if (other.isBits())
+                for (size_t w = 0; w < WORDS; w++)
+                    c.bits[w] |= other.bits[w];
+            else
+                for (uint16_t lo : other.array)
+                    c.bits[lo >> 6] |= 1ULL << (lo & 63);
+            c.card = 0;
+            for (uint64_t word : c.bits)
+                c.card += __builtin_popcountll(word);
+        } else {
+            std::set_union(i->array.begin(), i->array.end(),
+                    j->array.begin(), j->array.end(),
+                    std::back_inserter(c.array));
+            c.card = c.array.size();
+            if (c.card > ARRAY_MAX)
+                toBits(c);
+        }
+        out.push_back(std::move(c));
+        ++i;
+        ++j;
+    }
+    chunks.swap(out);
+    return *this;
+}
+
+void Bitmap::values(std::vector<uint32_t> &out) const
+{
+    out.clear();
+    out.reserve(size());
+    for (const Chunk &c : chunks) {
+        const uint32_t hi = (uint32_t)c.key << 16;
+        if (!c.isBits()) {
+            for (uint16_t lo : c.array)
+                out.push_back(hi | lo);
+            continue;
+        }
+        for (size_t w = 0; w < WORDS; w++)
+            for (uint64_t word = c.bits[w]; word; word &= word - 1)
+                out.push_back(hi | (w * 64 + __builtin_ctzll(word)));
+    }
+}
+
+void Bitmap::serialize(std::string &out) const
+{
+    const uint64_t count = chunks.size();
+    out.append((const char*)&count, 8);
+    for (const Chunk &c : chunks) {
+        ChunkHeader h = { c.key, (uint16_t)(c.isBits() ? BITS : ARRAY),
+            c.card };
+        out.append((const char*)&h, sizeof(h));
+    }
+    for (const Chunk &c : chunks) {
+        if (c.isBits())
+            out.append((const char*)c.bits.data(), WORDS * 8);
+        else {
+            out.append((const char*)c.array.data(), c.card * 2);
+            out.append(pad8(c.card * 2) - c.card * 2, '\0');
+        }
+    }
+}
+
+bool Bitmap::deserialize(const void *data, size_t len)
+{
+    chunks.clear();
+    // copied for alignment when it came from a string or the like
+    std::vector<uint64_t> copy;
+    const uint8_t *p = (const uint8_t*)data;
+    if ((uintptr_t)p % 8) {
+        copy.resize((len + 7) / 8);
+        memcpy(copy.data(), data, len);
+        p = (const uint8_t*)copy.data();
+    }
+    if (!check(p, len))
+        return false;
+
+    uint64_t count;
+    memcpy(&count, p, 8);
+    const ChunkHeader *hs = (const ChunkHeader*)(p + 8);
+    const uint8_t *at = p + 8 + count * 8;
+    chunks.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        Chunk &c = chunks[i];
+        c.key = hs[i].key;
+        c.card = hs[i].card;
+        if (hs[i].kind == BITS) {
+            const uint64_t *w = (const uint64_t*)at;
+            c.bits.assign(w, w + WORDS);
+        } else {
+            const uint16_t *a = (const uint16_t*)at;
+            c.array.assign(a, a + c.card);
+        }
+        at += payload(hs[i]);
+    }
+    return true;
+}
+
+bool Bitmap::contains(const void *data, uint32_t v)
+{
+    const uint16_t hi = v >> 16, lo = v & 0xFFFF;
+    const uint8_t *p = (const uint8_t*)data;
+    const uint64_t count = *(const uint64_t*)p;
+    const ChunkHeader *hs = (const ChunkHeader*)(p + 8);
+    const ChunkHeader *h = std::lower_bound(hs, hs + count, hi,
+            [](const ChunkHeader &h, uint16_t k) { return h.key < k; });
+    if (h == hs + count || h->key != hi)
+        return false;
+    const uint8_t *at = p + 8 + count * 8;
+    for (const ChunkHeader *b = hs; b < h; b++)
+        at += payload(*b);
+    if (h->kind == BITS)
+        return (((const uint64_t*)at)[lo >> 6] >> (lo & 63)) & 1;
+    const uint16_t *a = (const uint16_t*)at;
+    return std::binary_search(a, a + h->card, lo);
+}
+
+//==--------------------------------------------------------------==//
+// AttrIndex
+//==--------------------------------------------------------------==//
+
+int AttrIndex::write(const std::string &path, size_t vertices,
+        const std::map<std::string, Bitmap> &index)
+{
+    std::vector<uint64_t> key_idx(1, 0), bitmap_idx(1, 0);
+    std::string keys, bitmaps;
+    for (const auto &kv : index) {
+        std::vector<uint32_t> vs;
+        kv.second.values(vs);
+        if (!vs.empty() && vs.back() >= vertices)
+            return -1;
+        keys += kv.first;
+        key_idx.push_back(keys.size());
+        kv.second.serialize(bitmaps);
+        bitmap_idx.push_back(bitmaps.size());
+    }
+    keys.append(pad8(keys.size()) - keys.size(), '\0');
+
+    AttrIndexHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ATTRINDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = ATTRINDEX_VERSION;
+    hdr.vertices = vertices;
+    hdr.keys = index.size();
+    hdr.keys_bytes = key_idx.back();
+    hdr.bitmaps_bytes = bitmaps.size();
+    hdr.key_idx_offset = pad8(sizeof(hdr));
+    hdr.keys_offset = hdr.key_idx_offset + key_idx.size() * 8;
+    hdr.bitmap_idx_offset = hdr.keys_offset + keys.size();
+    hdr.bitmaps_offset = hdr.bitmap_idx_offset + bitmap_idx.size() * 8;
+
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        perror(("open " + path).c_str());
+        return -1;
+    }
+    static const char zeros[8] = { 0 };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+        && fwrite(zeros, 1, hdr.key_idx_offset - sizeof(hdr), fp)
+            == hdr.key_idx_offset - sizeof(hdr)
+        && fwrite(key_idx.data(), 8, key_idx.size(), fp) == key_idx.size()
+        && fwrite(keys.data(), 1, keys.size(), fp) == keys.size()
+        && fwrite(bitmap_idx.data(), 8, bitmap_idx.size(), fp)
+            == bitmap_idx.size()
+        && fwrite(bitmaps.data(), 1, bitmaps.size(), fp) == bitmaps.size();
+    if (fclose(fp))
+        ok = false;
+    if (!ok)
+        perror(("write " + path).c_str());
+    return ok ? 0 : -1;
+}
+
+AttrIndex::AttrIndex(void)
+    : map(nullptr), maplen(0), n(0), nkeys(0), key_idx(nullptr),
+    bitmap_idx(nullptr), keyv(nullptr), bitmapv(nullptr)
+{ ; }
+
+AttrIndex::~AttrIndex(void)
+{
+    close();
+}
+
+void AttrIndex::close(void)
+{
+    if (map)
+        munmap(map, maplen);
+    map = nullptr;
+    maplen = n = nkeys = 0;
+}
+
+int AttrIndex::open(const std::string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(AttrIndexHeader)) {
+        ::close(fd);
+        return -1;
+    }
+    maplen = st.st_size;
+    map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        return -1;
+    }
+
+    const char *base = (const char*)map;
+    const AttrIndexHeader *hdr = (const AttrIndexHeader*)map;
+    const uint64_t nk = hdr->keys;
+    auto fits = [&](uint64_t off, uint64_t count, size_t size) {
+        return off % 8 == 0 && off <= maplen
+            && count <= (maplen - off) / size;
+    };
+    // offsets that never decrease and end at total
+    auto index_ok = [&](const uint64_t *idx, uint64_t total) {
+        if (idx[0] != 0 || idx[nk] != total)
+            return false;
+        for (size_t i = 0; i < nk; i++)
+            if (idx[i] > idx[i + 1])
+                return false;
+        return true;
+    };
+    std::string why;
+    if (memcmp(hdr->magic, ATTRINDEX_MAGIC, sizeof(hdr->magic)))
+        why = "not an attribute index";
+    else if (hdr->version != ATTRINDEX_VERSION)
+        why = "attribute index version " + std::to_string(hdr->version);
+    else if (hdr->vertices >= GraphCSR::NONE
+            || !fits(hdr->key_idx_offset, nk + 1, 8)
+            || !fits(hdr->keys_offset, hdr->keys_bytes, 1)
+            || !fits(hdr->bitmap_idx_offset, nk + 1, 8)
+            || !fits(hdr->bitmaps_offset, hdr->bitmaps_bytes, 1))
+        why = "section out of bounds";
+    if (why.empty()) {
+        n = hdr->vertices;
+        nkeys = nk;
+        key_idx = (const uint64_t*)(base + hdr->key_idx_offset);
+        bitmap_idx = (const uint64_t*)(base + hdr->bitmap_idx_offset);
+        keyv = base + hdr->keys_offset;
+        bitmapv = base + hdr->bitmaps_offset;
+        if (!index_ok(key_idx, hdr->keys_bytes)
+                || !index_ok(bitmap_idx, hdr->bitmaps_bytes))
+            why = "bad index";
+    }
+    for (size_t i = 0; why.empty() && i < nkeys; i++) {
+        const uint8_t *b = (const uint8_t*)bitmap(i);
+        size_t len = bitmap_idx[i + 1] - bitmap_idx[i];
+        if (bitmap_idx[i] % 8 || check(b, len) != len)
+            why = "bad bitmap " + key(i);
+        else if (i && key(i - 1) >= key(i))
+            why = "keys out of order";
+        else if (last_value(b) >= (int64_t)n)
+            why = "vertex out of bounds in " + key(i);
+    }
+    if (!why.empty()) {
+        std::cerr << path << ": " << why << std::endl;
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+void AttrIndex::range(const std::string &prefix,
+        size_t &first, size_t &last) const
+{
+    // the same order as std::string's
+    auto less = [&](size_t i) {
+        size_t len = key_idx[i + 1] - key_idx[i];
+        int c = memcmp(keyv + key_idx[i], prefix.data(),
+                std::min(len, prefix.size()));
+        return c < 0 || (c == 0 && len < prefix.size());
+    };
+    size_t lo = 0, hi = nkeys;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (less(mid))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    first = last = lo;
+    while (last < nkeys && key_idx[last + 1] - key_idx[last] >= prefix.size()
+            && !memcmp(keyv + key_idx[last], prefix.data(), prefix.size()))
+        last++;
+}
+
+bool AttrIndex::get(const std::string &attr, const std::string &value,
+        Bitmap &out) const
+{
+    const std::string k(attr + ":" + value);
+    size_t first, last;
+    range(k, first, last);
+    if (first == last || key(first) != k)
+        return false;
+    return out.deserialize(bitmap(first),
+            bitmap_idx[first + 1] - bitmap_idx[first]);
+}
+
+void AttrIndex::valuesOf(vid v, const std::string &attr,
+        std::vector<std::string> &out) const
+{
+    out.clear();
+    const std::string prefix(attr + ":");
+    size_t first, last;
+    range(prefix, first, last);
+    for (size_t i = first; i < last; i++)
+        if (Bitmap::contains(bitmap(i), v))
+            out.push_back(key(i).substr(prefix.size()));
+}
+
+Bitmap AttrIndex::filter(const std::string &expr, vid self) const
+{
+    Bitmap result;
+    bool first = true;
+    size_t at = 0;
+    while ((at = expr.find_first_not_of(' ', at)) != std::string::npos) {
+        size_t end = std::min(expr.find(' ', at), expr.size());
+        const std::string term(expr.substr(at, end - at));
+        at = end;
+
+        Bitmap any;
+        size_t from = 0;
+        for (;;) {
+            size_t bar = std::min(term.find('|', from), term.size());
+            const std::string alt(term.substr(from, bar - from));
+            size_t colon = alt.find(':');
+            if (colon == 0 || colon == std::string::npos
+                    || colon + 1 == alt.size())
+                throw std::runtime_error("bad filter term '" + alt + "'");
+            const std::string attr(alt.substr(0, colon));
+            const std::string value(alt.substr(colon + 1));
+            std::vector<std::string> values(1, value);
+            if (value == "@") {
+                if (self == GraphCSR::NONE || self >= n)
+                    throw std::runtime_error("filter '" + alt
+                            + "' without a vertex");
+                valuesOf(self, attr, values);
+            }
+            for (const std::string &val : values) {
+                Bitmap b;
+                if (get(attr, val, b))
+                    any |= b;
+            }
+            if (bar == term.size())
+                break;
+            from = bar + 1;
+        }
+        if (first)
+            result = std::move(any);
+        else
+            result &= any;
+        first = false;
+    }
+    if (first)
+        throw std::runtime_error("empty filter");
+    return result;
+}
@@ -0,0 +1,142 @@
+/**
+ * AttrIndex.hpp
+ *
+ * Bitmap indexes of the egonet features in storm::Vertex, so filters
+ * on them need no vertex objects. There is one bitmap per attribute
+ * value, keyed "attr:value" with attr the Vertex field name (circles,
+ * gender, inst, univ, name, place, jobtitle), over the vertex numbers
+ * of graph.csr. Layout, each section 8-byte aligned:
+ *
+ *      header      see AttrIndexHeader
+ *      key_idx     uint64_t[keys + 1], into keys
+ *      keys        the keys, sorted, back to back
+ *      bitmap_idx  uint64_t[keys + 1], into bitmaps
+ *      bitmaps     as Bitmap::serialize writes them, each 8-byte aligned
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "GraphCSR.hpp"
+
+// Roaring-style set of 32-bit values: split into chunks by the high 16
+// bits, each chunk a sorted array of its low halves while it holds at
+// most ARRAY_MAX of them and a 2^16-bit bitmap beyond that.
+class Bitmap
+{
+    public:
+        static const size_t ARRAY_MAX = 4096;
+
+        Bitmap(void) { ; }
+
+        // cheapest in ascending order
+        void add(uint32_t v);
+        bool contains(uint32_t v) const;
+        size_t size(void) const;
+        inline bool empty(void) const { return chunks.empty(); }
+
+        Bitmap& operator&=(const Bitmap &b);
+        Bitmap& operator|=(const Bitmap &b);
+
+        // ascending
+        void values(std::vector<uint32_t> &out) const;
+
+        // appends; 8 bytes of chunk count, 8 per chunk header, then the
+        // chunks' arrays and bitmaps, each padded to 8 bytes
+        void serialize(std::string &out) const;
+        // false if data is not a whole serialized bitmap
+        bool deserialize(const void *data, size_t len);
+        // contains() on a serialized bitmap, in place; data must be
+        // 8-byte aligned and checked by deserialize or AttrIndex::open
+        static bool contains(const void *data, uint32_t v);
+
+    private:
+        struct Chunk
+        {
+            uint16_t key;
+            uint32_t card;
+            std::vector<uint16_t> array; // while card <= ARRAY_MAX
+            std::vector<uint64_t> bits;  // 1024 words otherwise
+            inline bool isBits(void) const { return !bits.empty(); }
+        };
+        std::vector<Chunk> chunks; // by key
+
+        static void toBits(Chunk &c);
+        static void toArray(Chunk &c);
+};
+
+struct AttrIndexHeader
+{
+    char magic[8];          // "GRAPHATR"
+    uint32_t version;
+    uint32_t flags;
+    uint64_t vertices;      // as in the graph.csr it goes with
+    uint64_t keys;
+    uint64_t keys_bytes;
+    uint64_t bitmaps_bytes;
+    uint64_t key_idx_offset, keys_offset;
+    uint64_t bitmap_idx_offset, bitmaps_offset;
+};
+
+const uint32_t ATTRINDEX_VERSION = 1;
+
+class AttrIndex
+{
+    public:
+        typedef GraphCSR::vid vid;
+
+        AttrIndex(void);
+        ~AttrIndex(void);
+
+        // maps path and checks every section and bitmap
+        int open(const std::string &path);
+        void close(void);
+
+        // vertices numbered
+        inline size_t size(void) const { return n; }
+        inline size_t keys(void) const { return nkeys; }
+
+        // vertices with attr = value; false, leaving out empty, if none
+        bool get(const std::string &attr, const std::string &value,
+                Bitmap &out) const;
+        // the values of attr v has
+        void valuesOf(vid v, const std::string &attr,
+                std::vector<std::string> &out) const;
+
+        // Evaluate a filter: terms separated by spaces are ANDed, and
+        // alternatives within a term, separated by '|', ORed. Each is
+        // attr:value, or attr:@ for any of self's values of attr, e.g.
+        // "univ:@ gender:1|gender:2". Throws std::runtime_error when
+        // malformed.
+        Bitmap filter(const std::string &expr, vid self = GraphCSR::NONE) const;
+
+        // index maps "attr:value" to its vertices, each below vertices
+        static int write(const std::string &path, size_t vertices,
+                const std::map<std::string, Bitmap> &index);
+
+    private:
+        AttrIndex(const AttrIndex&);
+        AttrIndex& operator=(const AttrIndex&);
+
+        inline std::string key(size_t i) const
+        {
+            return std::string(keyv + key_idx[i],
+                    key_idx[i + 1] - key_idx[i]);
+        }
+        inline const void* bitmap(size_t i) const
+            { return bitmapv + bitmap_idx[i]; }
+        // keys beginning with prefix are [first, last)
+        void range(const std::string &prefix,
+                size_t &first, size_t &last) const;
+
+        void *map;
+        size_t maplen;
+        size_t n, nkeys;
+        const uint64_t *key_idx, *bitmap_idx;
+        const char *keyv, *bitmapv;
+};
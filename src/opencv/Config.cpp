@@ -18,6 +18,9 @@ void Config::init(void)
 {
     graph.prefix        = std::string("graph");
     graph.idsFilePrefix = std::string("idsfile");
+    graph.csrFilePrefix = std::string("csrfile");
+    graph.samplingPrefix = std::string("sampling");
+    graph.attrFilePrefix = std::string("attrfile");
 
     memc.prefix         = std::string("memc");
     memc.serversPrefix  = std::string("serv");
@@ -48,6 +51,12 @@ int Config::parseLine(std::list<std::string> &split)
         split.pop_front();
         if (sub == config->graph.idsFilePrefix) {
             config->graph.idsFile = split.front();
+        } else if (sub == config->graph.csrFilePrefix) {
+            config->graph.csrFile = split.front();
+        } else if (sub == config->graph.samplingPrefix) {
+            config->graph.sampling = split.front();
+        } else if (sub == config->graph.attrFilePrefix) {
+            config->graph.attrFile = split.front();
         } else {
             ret = -1;
         }
@@ -27,6 +27,20 @@ class Config
 
             std::string idsFilePrefix;
             std::string idsFile;
+
+            // adjacency for neighbor queries (GraphCSR.hpp); empty to
+            // read vertex objects instead
+            std::string csrFilePrefix;
+            std::string csrFile;
+
+            // which links neighbor queries follow (NeighborSampler.hpp):
+            // prefix, uniform, reservoir or degree
+            std::string samplingPrefix;
+            std::string sampling;
+
+            // attribute bitmaps for filters (AttrIndex.hpp)
+            std::string attrFilePrefix;
+            std::string attrFile;
         };
 
         class MemcConfig
@@ -0,0 +1,276 @@
+/**
+ * GraphCSR.cpp
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "GraphCSR.hpp"
+
+static const char GRAPHCSR_MAGIC[8] = { 'G','R','A','P','H','C','S','R' };
+
+//==--------------------------------------------------------------==//
+// Writing
+//==--------------------------------------------------------------==//
+
+namespace
+{
+
+// fwrite keeping count of the offset, padding sections to 8 bytes
+struct Out
+{
+    FILE *fp;
+    uint64_t pos;
+    bool ok;
+
+    Out(FILE *f) : fp(f), pos(0), ok(true) { ; }
+
+    void write(const void *data, size_t len)
+    {
+        if (len && fwrite(data, 1, len, fp) != len)
+            ok = false;
+        pos += len;
+    }
+    uint64_t section(void)
+    {
+        static const char zeros[8] = { 0 };
+        write(zeros, (8 - pos % 8) % 8);
+        return pos;
+    }
+};
+
+// offsets into edges, which are sorted by their high half, of each
+// vertex's run
+void index_of(const std::vector<uint64_t> &edges, size_t n,
+        std::vector<uint64_t> &idx)
+{
+    idx.assign(n + 1, 0);
+    for (uint64_t e : edges)
+        idx[(e >> 32) + 1]++;
+    for (size_t v = 0; v < n; v++)
+        idx[v + 1] += idx[v];
+}
+
+void write_edges(Out &out, const std::vector<uint64_t> &edges)
+{
+    std::vector<uint32_t> buf;
+    buf.reserve(1 << 16);
+    for (size_t i = 0; i < edges.size(); i++) {
+        buf.push_back((uint32_t)edges[i]);
+        if (buf.size() == buf.capacity() || i + 1 == edges.size()) {
+            out.write(buf.data(), buf.size() * sizeof(buf[0]));
+            buf.clear();
+        }
+    }
+}
+
+}
+
+int GraphCSR::write(const std::string &path,
+        const std::vector<std::string> &names,
+        const std::vector<bool> &present,
+        const std::vector<uint64_t> &following,
+        const std::vector<uint64_t> &followers)
+{
+    const size_t n = names.size();
+    if (present.size() != n || n >= NONE)
+        return -1;
+    for (const std::vector<uint64_t> *edges : { &following, &followers })
+        for (uint64_t e : *edges)
+            if ((e >> 32) >= n || (uint32_t)e >= n)
+                return -1;
+
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        perror(("open " + path).c_str());
+        return -1;
+    }
+    Out out(fp);
+
+    GraphCSRHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, GRAPHCSR_MAGIC, sizeof(hdr.magic));
+    hdr.version = GRAPHCSR_VERSION;
+    hdr.vertices = n;
+    hdr.following_edges = following.size();
+    hdr.followers_edges = followers.size();
+    out.write(&hdr, sizeof(hdr)); // the real one goes in last
+
+    std::vector<uint64_t> words((n + 63) / 64, 0);
+    for (size_t v = 0; v < n; v++)
+        if (present[v])
+            words[v >> 6] |= 1ULL << (v & 63);
+    hdr.present_offset = out.section();
+    out.write(words.data(), words.size() * sizeof(words[0]));
+
+    std::vector<uint64_t> idx;
+    index_of(following, n, idx);
+    hdr.following_idx_offset = out.section();
+    out.write(idx.data(), idx.size() * sizeof(idx[0]));
+    hdr.following_offset = out.section();
+    write_edges(out, following);
+
+    index_of(followers, n, idx);
+    hdr.followers_idx_offset = out.section();
+    out.write(idx.data(), idx.size() * sizeof(idx[0]));
+    hdr.followers_offset = out.section();
+    write_edges(out, followers);
+
+    idx.assign(n + 1, 0);
+    for (size_t v = 0; v < n; v++)
+        idx[v + 1] = idx[v] + names[v].size();
+    hdr.names_bytes = idx[n];
+    hdr.name_idx_offset = out.section();
+    out.write(idx.data(), idx.size() * sizeof(idx[0]));
+    hdr.names_offset = out.section();
+    for (const std::string &s : names)
+        out.write(s.data(), s.size());
+
+    if (fseek(fp, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        out.ok = false;
+    if (fclose(fp))
+        out.ok = false;
+    if (!out.ok)
+        perror(("write " + path).c_str());
+    return out.ok ? 0 : -1;
+}
+
+//==--------------------------------------------------------------==//
+// Reading
+//==--------------------------------------------------------------==//
+
+GraphCSR::GraphCSR(void)
+    : map(nullptr), maplen(0), n(0), presence(nullptr),
+    following_idx(nullptr), followers_idx(nullptr), name_idx(nullptr),
+    following_v(nullptr), followers_v(nullptr), names(nullptr)
+{ ; }
+
+GraphCSR::~GraphCSR(void)
+{
+    close();
+}
+
+void GraphCSR::close(void)
+{
+    if (map)
+        munmap(map, maplen);
+    map = nullptr;
+    maplen = n = 0;
+}
+
+// an index of n + 1 offsets that never decrease and end at total
+static bool index_ok(const uint64_t *idx, size_t n, uint64_t total)
+{
+    if (idx[0] != 0 || idx[n] != total)
+        return false;
+    for (size_t i = 0; i < n; i++)
+        if (idx[i] > idx[i + 1])
+            return false;
+    return true;
+}
+
+int GraphCSR::open(const std::string &path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(GraphCSRHeader)) {
+        ::close(fd);
+        return -1;
+    }
+    maplen = st.st_size;
+    map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        return -1;
+    }
+
+    const char *base = (const char*)map;
+    const GraphCSRHeader *hdr = (const GraphCSRHeader*)map;
+    const uint64_t nv = hdr->vertices;
+    // section at off holding count items of size bytes each
+    auto fits = [&](uint64_t off, uint64_t count, size_t size) {
+        return off % 8 == 0 && off <= maplen
+            && count <= (maplen - off) / size;
+    };
+    std::string why;
+    if (memcmp(hdr->magic, GRAPHCSR_MAGIC, sizeof(hdr->magic)))
+        why = "not a graph CSR file";
+    else if (hdr->version != GRAPHCSR_VERSION)
+        why = "graph CSR version " + std::to_string(hdr->version);
+    else if (nv >= NONE
+            || !fits(hdr->present_offset, (nv + 63) / 64, 8)
+            || !fits(hdr->following_idx_offset, nv + 1, 8)
+            || !fits(hdr->following_offset, hdr->following_edges, 4)
+            || !fits(hdr->followers_idx_offset, nv + 1, 8)
+            || !fits(hdr->followers_offset, hdr->followers_edges, 4)
+            || !fits(hdr->name_idx_offset, nv + 1, 8)
+            || !fits(hdr->names_offset, hdr->names_bytes, 1))
+        why = "section out of bounds";
+    if (why.empty()) {
+        n = nv;
+        presence = (const uint64_t*)(base + hdr->present_offset);
+        following_idx = (const uint64_t*)(base + hdr->following_idx_offset);
+        followers_idx = (const uint64_t*)(base + hdr->followers_idx_offset);
+        name_idx = (const uint64_t*)(base + hdr->name_idx_offset);
+        following_v = (const vid*)(base + hdr->following_offset);
+        followers_v = (const vid*)(base + hdr->followers_offset);
+        names = base + hdr->names_offset;
+        if (!index_ok(following_idx, n, hdr->following_edges)
+                || !index_ok(followers_idx, n, hdr->followers_edges)
+                || !index_ok(name_idx, n, hdr->names_bytes))
+            why = "bad index";
+    }
+    auto edges_ok = [&](const vid *e, uint64_t m) {
+        for (uint64_t i = 0; i < m; i++)
+            if (e[i] >= n)
+                return false;
+        return true;
+    };
+    if (why.empty() && (!edges_ok(following_v, hdr->following_edges)
+                || !edges_ok(followers_v, hdr->followers_edges)))
+        why = "edge out of bounds";
+    if (!why.empty()) {
+        std::cerr << path << ": " << why << std::endl;
+        close();
+        return -1;
+    }
+
+    // lookups land all over
+    madvise(map, maplen, MADV_RANDOM);
+    return 0;
+}
+
+GraphCSR::vid GraphCSR::find(const std::string &id) const
+{
+    // the same order as std::string's
+    auto cmp = [&](vid v) {
+        size_t len = name_idx[v + 1] - name_idx[v];
+        int c = memcmp(names + name_idx[v], id.data(),
+                std::min(len, id.size()));
+        return c ? c : (len < id.size() ? -1 : len > id.size());
+    };
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = cmp(mid);
+        if (c == 0)
+            return mid;
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NONE;
+}
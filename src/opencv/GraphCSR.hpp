@@ -0,0 +1,108 @@
+/**
+ * GraphCSR.hpp
+ *
+ * The social graph's adjacency as integer CSR, in one file to be mapped
+ * read-only and shared by all threads. Vertices are numbered in ID
+ * string order, so the dictionary of IDs is sorted and a lookup by ID
+ * is a binary search; neighbor lists are slices of the mapping, in the
+ * same order as in storm::Vertex. Layout, each section 8-byte aligned:
+ *
+ *      header         see GraphCSRHeader
+ *      present        bitmap of vertices stored as objects; the rest
+ *                     are only ever named as neighbors
+ *      following_idx  uint64_t[vertices + 1], into following
+ *      following      uint32_t vertex numbers
+ *      followers_idx  uint64_t[vertices + 1], into followers
+ *      followers      uint32_t vertex numbers
+ *      name_idx       uint64_t[vertices + 1], into names
+ *      names          the IDs, back to back
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct GraphCSRHeader
+{
+    char magic[8];          // "GRAPHCSR"
+    uint32_t version;
+    uint32_t flags;
+    uint64_t vertices;
+    uint64_t following_edges;
+    uint64_t followers_edges;
+    uint64_t names_bytes;
+    uint64_t present_offset;
+    uint64_t following_idx_offset, following_offset;
+    uint64_t followers_idx_offset, followers_offset;
+    uint64_t name_idx_offset, names_offset;
+};
+
+const uint32_t GRAPHCSR_VERSION = 1;
+
+class GraphCSR
+{
+    public:
+        typedef uint32_t vid;
+        static const vid NONE = 0xFFFFFFFFU;
+
+        GraphCSR(void);
+        ~GraphCSR(void);
+
+        // maps path and checks that every section is in bounds
+        int open(const std::string &path);
+        void close(void);
+
+        inline size_t size(void) const { return n; }
+
+        // NONE when id is not in the graph
+        vid find(const std::string &id) const;
+        inline std::string name(vid v) const
+        {
+            return std::string(names + name_idx[v],
+                    name_idx[v + 1] - name_idx[v]);
+        }
+        // whether v has a storm::Vertex in the object store
+        inline bool present(vid v) const
+            { return (presence[v >> 6] >> (v & 63)) & 1; }
+
+        // v's adjacency, len entries long, within the mapping
+        inline const vid* following(vid v, size_t &len) const
+        {
+            len = following_idx[v + 1] - following_idx[v];
+            return following_v + following_idx[v];
+        }
+        inline const vid* followers(vid v, size_t &len) const
+        {
+            len = followers_idx[v + 1] - followers_idx[v];
+            return followers_v + followers_idx[v];
+        }
+        inline size_t degree(vid v) const
+        {
+            return following_idx[v + 1] - following_idx[v]
+                + followers_idx[v + 1] - followers_idx[v];
+        }
+
+        // Write a graph to path. names must be sorted and are indexed
+        // by vertex number; edges are (vertex << 32 | neighbor) sorted,
+        // as load_egonet builds them.
+        static int write(const std::string &path,
+                const std::vector<std::string> &names,
+                const std::vector<bool> &present,
+                const std::vector<uint64_t> &following,
+                const std::vector<uint64_t> &followers);
+
+    private:
+        GraphCSR(const GraphCSR&);
+        GraphCSR& operator=(const GraphCSR&);
+
+        void *map;
+        size_t maplen;
+        size_t n;
+        const uint64_t *presence;
+        const uint64_t *following_idx, *followers_idx, *name_idx;
+        const vid *following_v, *followers_v;
+        const char *names;
+};
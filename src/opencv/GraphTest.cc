@@ -0,0 +1,402 @@
+// check the graph files and structures load_egonet writes and the bolts
+// read, against plain std containers; needs no object store
+#include <iostream>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <stdio.h>
+#include "AttrIndex.hpp"
+#include "GraphCSR.hpp"
+#include "NeighborSampler.hpp"
+#include "Snapshot.hpp"
+#include "Objects.pb.h"
+
+static size_t failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::cout << __FILE__ << ":" << __LINE__ << ": " \
+            << #cond << " failed" << std::endl; \
+        failures++; \
+    } \
+} while (0)
+
+static std::mt19937 gen(1);
+
+static std::string tmp_path(const char *what)
+{
+    char fname[64];
+    snprintf(fname, 64, "/tmp/graphtest-%d.%s", getpid(), what);
+    return std::string(fname);
+}
+
+static std::vector<uint32_t> values_of(const Bitmap &b)
+{
+    std::vector<uint32_t> out;
+    b.values(out);
+    return out;
+}
+
+static std::vector<uint32_t> values_of(const std::set<uint32_t> &s)
+{
+    return std::vector<uint32_t>(s.begin(), s.end());
+}
+
+// count values in [base, base + span), the span cut into chunks
+static void fill(Bitmap &b, std::set<uint32_t> &s, uint32_t base,
+        uint32_t span, size_t count)
+{
+    std::uniform_int_distribution<uint32_t> dis(base, base + span - 1);
+    std::vector<uint32_t> vs;
+    for (size_t i = 0; i < count; i++)
+        vs.push_back(dis(gen));
+    std::sort(vs.begin(), vs.end());
+    for (uint32_t v : vs) {
+        b.add(v);
+        s.insert(v);
+    }
+}
+
+// sets with chunks on both sides of ARRAY_MAX, some shared, some not
+static void make_set(int shape, Bitmap &b, std::set<uint32_t> &s)
+{
+    switch (shape) {
+        case 0: // empty
+            break;
+        case 1: // sparse arrays
+            fill(b, s, 0, 1 << 18, 500);
+            break;
+        case 2: // dense chunks
+            fill(b, s, 0, 1 << 17, 30000);
+            break;
+        case 3: // just over ARRAY_MAX in one chunk, sparse elsewhere
+            fill(b, s, 1 << 16, 1 << 16, 5000);
+            fill(b, s, 3 << 16, 1 << 16, 100);
+            break;
+        default: // dense and sparse chunks, and values near 2^32
+            fill(b, s, 0, 1 << 16, 40000);
+            fill(b, s, 1 << 17, 1 << 16, 2000);
+            fill(b, s, 0xFFFF0000U, 1 << 16, 6000);
+            break;
+    }
+}
+
+static void test_bitmap_ops(void)
+{
+    const int SHAPES = 5;
+    for (int x = 0; x < SHAPES; x++)
+        for (int y = 0; y < SHAPES; y++) {
+            Bitmap a, b;
+            std::set<uint32_t> sa, sb;
+            make_set(x, a, sa);
+            make_set(y, b, sb);
+            CHECK(a.size() == sa.size());
+            CHECK(values_of(a) == values_of(sa));
+
+            std::set<uint32_t> both, either(sa);
+            std::set_intersection(sa.begin(), sa.end(), sb.begin(),
+                    sb.end(), std::inserter(both, both.begin()));
+            either.insert(sb.begin(), sb.end());
+
+            Bitmap i(a), u(a);
+            i &= b;
+            u |= b;
+            CHECK(values_of(i) == values_of(both));
+            CHECK(i.size() == both.size());
+            CHECK(i.empty() == both.empty());
+            CHECK(values_of(u) == values_of(either));
+            CHECK(u.size() == either.size());
+
+            // and back: the union narrowed to a, the intersection grown
+            u &= a;
+            i |= a;
+            CHECK(values_of(u) == values_of(sa));
+            CHECK(values_of(i) == values_of(sa));
+            for (uint32_t v : { 0U, 65535U, 65536U, 0xFFFFFFFFU })
+                CHECK(u.contains(v) == !!sa.count(v));
+        }
+
+    // two dense chunks meeting in a few values come back as an array
+    Bitmap even, odd;
+    for (uint32_t v = 0; v < (1 << 16); v += 2)
+        even.add(v);
+    for (uint32_t v = 1; v < (1 << 16); v += 2)
+        odd.add(v);
+    odd.add(100);
+    odd.add(200);
+    even &= odd;
+    CHECK(values_of(even) == std::vector<uint32_t>({ 100, 200 }));
+}
+
+static void test_bitmap_serialize(void)
+{
+    for (int shape = 0; shape < 5; shape++) {
+        Bitmap b;
+        std::set<uint32_t> s;
+        make_set(shape, b, s);
+        std::string out;
+        b.serialize(out);
+        CHECK(out.size() % 8 == 0);
+
+        Bitmap back;
+        CHECK(back.deserialize(out.data(), out.size()));
+        CHECK(values_of(back) == values_of(s));
+
+        // in place contains() wants 8-byte alignment
+        std::vector<uint64_t> aligned(out.size() / 8);
+        memcpy(aligned.data(), out.data(), out.size());
+        for (uint32_t v : s)
+            CHECK(Bitmap::contains(aligned.data(), v));
+        CHECK(!Bitmap::contains(aligned.data(), 1U << 20)
+                || s.count(1U << 20));
+
+        // anything cut short is refused
+        if (out.size() > 8) {
+            Bitmap cut;
+            CHECK(!cut.deserialize(out.data(), out.size() - 8));
+        }
+    }
+}
+
+static void test_attr_index(void)
+{
+    const size_t n = 70000;
+    std::map<std::string, Bitmap> index;
+    std::map<std::string, std::set<uint32_t> > want;
+    std::uniform_int_distribution<uint32_t> dis(0, n - 1);
+    const char *keys[] = { "gender:1", "gender:2", "univ:mit", "univ:rice",
+        "place:paris" };
+    for (size_t k = 0; k < 5; k++) {
+        std::vector<uint32_t> vs;
+        for (size_t i = 0; i < (k == 0 ? 20000U : 300U); i++)
+            vs.push_back(dis(gen));
+        std::sort(vs.begin(), vs.end());
+        for (uint32_t v : vs) {
+            index[keys[k]].add(v);
+            want[keys[k]].insert(v);
+        }
+    }
+
+    const std::string path(tmp_path("attr"));
+    CHECK(AttrIndex::write(path, n, index) == 0);
+    AttrIndex attr;
+    CHECK(attr.open(path) == 0);
+    CHECK(attr.size() == n);
+    CHECK(attr.keys() == index.size());
+    for (const auto &kv : want) {
+        size_t colon = kv.first.find(':');
+        Bitmap b;
+        CHECK(attr.get(kv.first.substr(0, colon),
+                    kv.first.substr(colon + 1), b));
+        CHECK(values_of(b) == values_of(kv.second));
+    }
+    Bitmap none;
+    CHECK(!attr.get("univ", "none", none));
+
+    // gender:1 and either university
+    std::set<uint32_t> either(want["univ:mit"]), expect;
+    either.insert(want["univ:rice"].begin(), want["univ:rice"].end());
+    std::set_intersection(want["gender:1"].begin(), want["gender:1"].end(),
+            either.begin(), either.end(),
+            std::inserter(expect, expect.begin()));
+    CHECK(values_of(attr.filter("gender:1 univ:mit|univ:rice"))
+            == values_of(expect));
+
+    uint32_t v = *want["univ:rice"].begin();
+    std::vector<std::string> vals;
+    attr.valuesOf(v, "univ", vals);
+    CHECK(std::find(vals.begin(), vals.end(), "rice") != vals.end());
+    CHECK(values_of(attr.filter("univ:@", v)).size()
+            >= want["univ:rice"].size());
+
+    // a vertex out of range does not write
+    std::map<std::string, Bitmap> bad(index);
+    bad["gender:1"].add(n);
+    CHECK(AttrIndex::write(path, n, bad) != 0);
+
+    attr.close();
+    unlink(path.c_str());
+}
+
+static void test_graph_csr(void)
+{
+    const size_t n = 1000;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < n; i++)
+        names.push_back(std::to_string(1000000 + i));
+    std::vector<bool> present(n);
+    std::vector<std::vector<uint32_t> > following(n), followers(n);
+    std::uniform_int_distribution<uint32_t> dis(0, n - 1);
+    for (size_t v = 0; v < n; v++) {
+        present[v] = (v % 3) != 0;
+        size_t deg = v % 17;
+        for (size_t i = 0; i < deg; i++) {
+            following[v].push_back(dis(gen));
+            followers[v].push_back(dis(gen));
+        }
+    }
+    // (v << 32 | neighbor), each list kept in its own order
+    std::vector<uint64_t> fo, fr;
+    for (size_t v = 0; v < n; v++) {
+        for (uint32_t u : following[v])
+            fo.push_back((uint64_t)v << 32 | u);
+        for (uint32_t u : followers[v])
+            fr.push_back((uint64_t)v << 32 | u);
+    }
+
+    const std::string path(tmp_path("csr"));
+    CHECK(GraphCSR::write(path, names, present, fo, fr) == 0);
+    GraphCSR g;
+    CHECK(g.open(path) == 0);
+    CHECK(g.size() == n);
+    for (size_t v = 0; v < n; v++) {
+        CHECK(g.name(v) == names[v]);
+        CHECK(g.find(names[v]) == v);
+        CHECK(g.present(v) == present[v]);
+        size_t len;
+        const GraphCSR::vid *p = g.following(v, len);
+        CHECK(std::vector<uint32_t>(p, p + len) == following[v]);
+        p = g.followers(v, len);
+        CHECK(std::vector<uint32_t>(p, p + len) == followers[v]);
+        CHECK(g.degree(v) == following[v].size() + followers[v].size());
+    }
+    CHECK(g.find("999") == GraphCSR::NONE);
+    g.close();
+
+    // a neighbor out of range does not write
+    fo.push_back(n);
+    CHECK(GraphCSR::write(path, names, present, fo, fr) != 0);
+    unlink(path.c_str());
+}
+
+static void test_snapshot(void)
+{
+    const size_t n = 5000;
+    std::vector<storm::Vertex> vs(n);
+    for (size_t i = 0; i < n; i++) {
+        vs[i].set_key_id(std::to_string(i));
+        for (size_t j = 0; j < i % 50; j++)
+            vs[i].add_following(std::to_string(i * 7 + j));
+        if (i % 3)
+            vs[i].set_gender(i % 3);
+    }
+
+    const std::string path(tmp_path("snap"));
+    for (bool checksum : { false, true }) {
+        SnapshotWriter w;
+        CHECK(w.open(path, "vertex", checksum, 64) == 0);
+        for (const storm::Vertex &v : vs)
+            CHECK(w.add(v) == 0);
+        CHECK(w.close() == 0);
+
+        SnapshotReader r;
+        CHECK(r.open(path, "image") != 0);
+        CHECK(r.open(path, "vertex") == 0);
+        CHECK(r.size() == n);
+        CHECK(r.checksummed() == checksum);
+
+        size_t next = 0;
+        bool same = true;
+        CHECK(r.read<storm::Vertex>(0, n,
+                    [&](size_t i, const storm::Vertex &v) {
+                        same = same && i == next++
+                            && v.SerializeAsString()
+                                == vs[i].SerializeAsString();
+                        return 0;
+                    }) == 0);
+        CHECK(same && next == n);
+
+        std::vector<char> seen(n, 0);
+        CHECK(r.readParallel<storm::Vertex>(4,
+                    [&](size_t i, const storm::Vertex &v) {
+                        seen[i] = v.key_id() == vs[i].key_id();
+                        return 0;
+                    }) == 0);
+        CHECK(std::count(seen.begin(), seen.end(), 1) == (long)n);
+
+        size_t len;
+        const void *data = r.data(n / 2, len);
+        storm::Vertex one;
+        CHECK(one.ParseFromArray(data, len));
+        CHECK(one.key_id() == vs[n / 2].key_id());
+        CHECK(r.read<storm::Vertex>(0, n + 1,
+                    [](size_t, const storm::Vertex&) { return 0; }) != 0);
+        r.close();
+
+        // flip a byte of a record: checksums catch it
+        if (checksum) {
+            FILE *fp = fopen(path.c_str(), "r+b");
+            CHECK(fp != nullptr);
+            if (fp) {
+                CHECK(fseek(fp, sizeof(SnapshotHeader) + 8, SEEK_SET) == 0);
+                int c = fgetc(fp);
+                fseek(fp, -1, SEEK_CUR);
+                fputc(c ^ 0xFF, fp);
+                fclose(fp);
+            }
+            CHECK(r.open(path, "vertex") == 0);
+            CHECK(!r.verify(0, n));
+            CHECK(r.read<storm::Vertex>(0, n,
+                        [](size_t, const storm::Vertex&) { return 0; }) != 0);
+        }
+    }
+    unlink(path.c_str());
+}
+
+static void test_sampler(void)
+{
+    const SampleMode modes[] = { SampleMode::PREFIX, SampleMode::UNIFORM,
+        SampleMode::RESERVOIR, SampleMode::DEGREE };
+    const size_t ns[] = { 0, 1, 5, 64, 100, 1000, 100000 };
+    const size_t ks[] = { 0, 1, 3, 50, 65, 200, 5000 };
+    NeighborSampler::Weight weight = [](size_t i) { return (i % 7) + 1.0; };
+    for (SampleMode m : modes) {
+        SampleMode back;
+        CHECK(sample_mode(sample_mode_name(m), back) && back == m);
+        for (size_t n : ns)
+            for (size_t k : ks)
+                for (uint64_t seed : { 1ULL, 2ULL }) {
+                    NeighborSampler s(m, seed);
+                    std::vector<size_t> out, again;
+                    s.sample("v" + std::to_string(n), n, k, out, &weight);
+                    // min(k, n) distinct, ascending, below n
+                    CHECK(out.size() == std::min(k, n));
+                    CHECK(std::adjacent_find(out.begin(), out.end(),
+                                std::greater_equal<size_t>()) == out.end());
+                    CHECK(out.empty() || out.back() < n);
+                    // and the same ones for the same seed and vertex
+                    s.sample("v" + std::to_string(n), n, k, again, &weight);
+                    CHECK(out == again);
+                }
+    }
+    SampleMode m;
+    CHECK(!sample_mode("uniformly", m));
+
+    // different seeds spread over different links
+    NeighborSampler a(SampleMode::UNIFORM, 1), b(SampleMode::UNIFORM, 2);
+    std::vector<size_t> oa, ob;
+    a.sample("v", 100000, 50, oa);
+    b.sample("v", 100000, 50, ob);
+    CHECK(oa != ob);
+}
+
+int main(void)
+{
+    test_bitmap_ops();
+    test_bitmap_serialize();
+    test_attr_index();
+    test_graph_csr();
+    test_snapshot();
+    test_sampler();
+
+    if (failures) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}
@@ -12,12 +12,21 @@
 #include "JNILinker.h" // generated by javah
 
 #include "StormFuncs.h"
+#include "cv/decoders.h"
 
 thread_local StormFuncs *funcs;
 
 static std::string servers_g;
 static std::mutex servers_lock;
 
+// one mapping of the adjacency for all threads
+static std::shared_ptr<const GraphCSR> csr_g;
+static std::string csr_path_g;
+static std::mutex csr_lock;
+// and of the attribute index, under csr_lock too
+static std::shared_ptr<const AttrIndex> attr_g;
+static std::string attr_path_g;
+
 static const std::string prefix("JNI: ");
 
 //==------------------------------------------------------------------
@@ -170,6 +179,9 @@ construct(void) {
         throw std::runtime_error("servers_g empty");
     if (funcs->connect(servers_g))
         throw std::runtime_error("funcs connect(" + servers_g + ")");
+    Lock lock(csr_lock);
+    funcs->graphCSR(csr_g);
+    funcs->attrIndex(attr_g);
 }
 
 static inline void
@@ -191,6 +203,93 @@ JNIEXPORT void JNICALL Java_JNILinker_setServers
     set_servers(servers);
 }
 
+// int setGraphCSR(String path);
+JNIEXPORT jint JNICALL Java_JNILinker_setGraphCSR
+  (JNIEnv *env, jobject thisobj, jstring jpath)
+{
+    std::string path(J2C_string(env, jpath));
+    std::shared_ptr<const GraphCSR> csr;
+    {
+        Lock lock(csr_lock);
+        if (!csr_g || csr_path_g != path) {
+            std::shared_ptr<GraphCSR> g(new GraphCSR());
+            if (g->open(path)) {
+                std::string msg("cannot open graph CSR " + path);
+                jthrow(env, JTHROW_NORECOVER, msg);
+                return -1;
+            }
+            csr_g = g;
+            csr_path_g = path;
+        }
+        csr = csr_g;
+    }
+    // threads constructed later pick it up in construct()
+    if (funcs)
+        funcs->graphCSR(csr);
+    return 0;
+}
+
+// int setAttrIndex(String path);
+JNIEXPORT jint JNICALL Java_JNILinker_setAttrIndex
+  (JNIEnv *env, jobject thisobj, jstring jpath)
+{
+    std::string path(J2C_string(env, jpath));
+    std::shared_ptr<const AttrIndex> attr;
+    {
+        Lock lock(csr_lock);
+        if (!attr_g || attr_path_g != path) {
+            std::shared_ptr<AttrIndex> a(new AttrIndex());
+            if (a->open(path)) {
+                std::string msg("cannot open attribute index " + path);
+                jthrow(env, JTHROW_NORECOVER, msg);
+                return -1;
+            }
+            attr_g = a;
+            attr_path_g = path;
+        }
+        attr = attr_g;
+    }
+    if (funcs)
+        funcs->attrIndex(attr);
+    return 0;
+}
+
+// int neighborSampling(String mode);
+JNIEXPORT jint JNICALL Java_JNILinker_neighborSampling
+  (JNIEnv *env, jobject thisobj, jstring jmode)
+{
+    construct();
+
+    std::string name(J2C_string(env, jmode));
+    SampleMode mode;
+    if (!sample_mode(name, mode)) {
+        std::string msg("unknown sampling " + name);
+        jthrow(env, JTHROW_NORECOVER, msg);
+        return -1;
+    }
+    funcs->neighborSampler().mode(mode);
+    return 0;
+}
+
+// int neighborSeed(long seed);
+JNIEXPORT jint JNICALL Java_JNILinker_neighborSeed
+  (JNIEnv *env, jobject thisobj, jlong seed)
+{
+    construct();
+
+    funcs->neighborSampler().seed(seed);
+    return 0;
+}
+
+// int setParallelDecode(int threads, long minPixels);
+JNIEXPORT jint JNICALL Java_JNILinker_setParallelDecode
+  (JNIEnv *env, jobject thisobj, jint threads, jlong min_pixels)
+{
+    // process-wide, like the decoder it configures
+    jpeg::setParallelDecode(threads, (size_t)std::max(min_pixels, (jlong)0));
+    return 0;
+}
+
 // int neighbors(String vertex, HashSet<String> others);
 JNIEXPORT jint JNICALL Java_JNILinker_neighbors
   (JNIEnv *env, jobject thisobj, jstring vertex, jobject hashset)
@@ -243,6 +342,33 @@ JNIEXPORT jint JNICALL Java_JNILinker_imagesOf
     return 0;
 }
 
+// int expand(String seed, int depth, int fanout, int budget,
+//            String filter, HashSet<String> vertices,
+//            HashSet<String> images);
+JNIEXPORT jint JNICALL Java_JNILinker_expand
+  (JNIEnv *env, jobject thisobj, jstring jseed, jint depth, jint fanout,
+   jint budget, jstring jfilter, jobject jvertices, jobject jimages)
+{
+    construct();
+
+    std::string seed(J2C_string(env, jseed));
+    std::string filter;
+    if (jfilter)
+        filter = J2C_string(env, jfilter);
+    std::deque<std::string> vertices, images;
+    try {
+        funcs->expand(seed, depth, fanout, std::max(0, (int)budget),
+                vertices, jimages ? &images : nullptr, filter);
+    } FUNCS_CATCH_BLOCK;
+
+    C2J_hashset(env, vertices, jvertices);
+    if (jimages) {
+        C2J_hashset(env, images, jimages);
+        return images.size();
+    }
+    return vertices.size();
+}
+
 // int feature(String image_key);
 JNIEXPORT jint JNICALL Java_JNILinker_feature
   (JNIEnv *env, jobject thisobj, jstring image_key)
@@ -268,10 +394,11 @@ JNIEXPORT jint JNICALL Java_JNILinker_match
     if (keys.size() == 0)
         return -1;
 
-#if 0 // fucking opencv asserts make me want to die
-    if (funcs.match(keys, matchinfo))
-        return -1;
+    // match every pair not cached yet and cache it, so montage() and
+    // later requests read the pair instead
+    try { funcs->match(keys, matchinfo); } FUNCS_CATCH_BLOCK;
 
+#if 0 // fucking opencv asserts make me want to die
     // pick images above some threshold size
     size_t num = keys.size();
     if (num > 16)
@@ -326,6 +453,44 @@ JNIEXPORT jint JNICALL Java_JNILinker_montage
     return 0;
 }
 
+// int setLumaCache(boolean on);
+JNIEXPORT jint JNICALL Java_JNILinker_setLumaCache
+  (JNIEnv *env, jobject thisobj, jboolean on)
+{
+    construct();
+
+    funcs->lumaCache(on == JNI_TRUE);
+    return 0;
+}
+
+// int cacheStats(StringBuffer stats);
+JNIEXPORT jint JNICALL Java_JNILinker_cacheStats
+  (JNIEnv *env, jobject thisobj, jobject stats)
+{
+    construct();
+
+    const MatchCacheStats &m = funcs->matchCacheStats();
+    const LumaCacheStats &l = funcs->lumaCacheStats();
+    char line[512];
+    snprintf(line, sizeof(line), "match cache: lookups %zu hits %zu"
+            " (%.1f%%) misses %zu stores %zu failures %zu;"
+            " luma cache: lookups %zu hits %zu (%.1f%%) misses %zu"
+            " stores %zu failures %zu saved %ld ms",
+            m.lookups, m.hits, 100. * m.hitRate(), m.misses, m.stores,
+            m.failures, l.lookups, l.hits, 100. * l.hitRate(), l.misses,
+            l.stores.load(), l.failures.load(), l.usecSaved() / 1000);
+
+    jclass cls = env->GetObjectClass(stats);
+    jcheck(env);
+    jmethodID append = env->GetMethodID(cls,
+            "append", "(Ljava/lang/String;)Ljava/lang/StringBuffer;");
+    jcheck(env);
+    env->CallObjectMethod(stats, append, env->NewStringUTF(line));
+    jcheck(env);
+
+    return 0;
+}
+
 // int writeImage(String key, String path);
 JNIEXPORT jint JNICALL Java_JNILinker_writeImage
   (JNIEnv *env, jobject thisobj, jstring jkey, jstring jpath)
@@ -64,17 +64,62 @@ public class JNILinker implements Serializable {
     public native int neighbors(String vertex, HashSet<String> others)
         throws JNIException;
 
+    // Choose how neighbors() and expand() pick links on this thread:
+    // "prefix", "uniform", "reservoir" or "degree" (see
+    // NeighborSampler.hpp). Throws NORECOVER for any other name.
+    public native int neighborSampling(String mode)
+        throws JNIException;
+
+    // Seed the links picked on this thread, e.g. once per request.
+    // The same seed picks the same links.
+    public native int neighborSeed(long seed)
+        throws JNIException;
+
+    // Answer neighbors() from the adjacency file at path (written by
+    // load_egonet as graph.csr) instead of the object store. The file
+    // is mapped once per process.
+    public native int setGraphCSR(String path)
+        throws JNIException;
+
     // Query object store for metadata of given vertex and return a
     // list of keys representing the images associated with it.
     public native int imagesOf(String vertex, HashSet<String> keys)
         throws JNIException;
 
+    // Walk the graph breadth-first from seed for up to depth hops in
+    // one call, each vertex passing on at most fanout links (0 picks
+    // as many as neighbors() does, <0 all). Fills vertices with those
+    // reached, seed included, and images (if not null) with their
+    // images. Stops once budget images, or vertices when images is
+    // null, are found; 0 is no limit. Returns how many that is. A
+    // filter such as "univ:@ gender:1" keeps to vertices with those
+    // attributes, @ being the seed's (needs setGraphCSR and
+    // setAttrIndex); null for none.
+    public native int expand(String seed, int depth, int fanout,
+            int budget, String filter, HashSet<String> vertices,
+            HashSet<String> images)
+        throws JNIException;
+
+    // Map the attribute bitmaps at path (written by load_egonet as
+    // graph.attr, with graph.csr) for expand() filters. The file is
+    // mapped once per process.
+    public native int setAttrIndex(String path)
+        throws JNIException;
+
+    // Decode JPEGs of at least minPixels with up to threads strip
+    // threads when they carry restart markers (load_egonet --restart);
+    // threads < 2 decodes on one thread. Process-wide.
+    public native int setParallelDecode(int threads, long minPixels)
+        throws JNIException;
+
     // Compute features of image. Store back into object store. Uses
     // the GPGPU. Return value <0 is error, else a count of number of
     // features found.
     public native int feature(String image_key)
         throws JNIException;
 
+    // Match every pair of the images' features and cache the results
+    // for montage() (which only reads cached pairs).
     public native int match(HashSet<String> image_keys)
         throws JNIException;
 
@@ -82,5 +127,15 @@ public class JNILinker implements Serializable {
             StringBuffer montage_key)
         throws JNIException;
 
+    // Read and keep grayscale planes (<key>::luma::<size>) for feature
+    // extraction and thumbnails on this thread, instead of decoding
+    // the JPEG each time. Off by default.
+    public native int setLumaCache(boolean on)
+        throws JNIException;
+
+    // Append a line of this thread's match and luma cache hit rates to
+    // stats.
+    public native int cacheStats(StringBuffer stats);
+
     public native int writeImage(String key, String path);
 }
@@ -0,0 +1,113 @@
+/**
+ * LumaPlane.cpp
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "LumaPlane.hpp"
+
+namespace luma
+{
+
+static const char MAGIC[4] = { 'L', 'U', 'M', 'A' };
+
+std::string key(const std::string &image_key, int size)
+{
+    return image_key + "::luma::" + std::to_string(size);
+}
+
+void pack(const cv::Mat &img, int size, std::vector<uchar> &out,
+        bool lz4, int src_cols, int src_rows, cv::Mat *plane)
+{
+    cv::Mat gray = img;
+    if (img.channels() == 3)
+        cv::cvtColor(img, gray, CV_BGR2GRAY);
+    else if (img.channels() == 4)
+        cv::cvtColor(img, gray, CV_BGRA2GRAY);
+
+    double s = (double)size / std::max(gray.cols, gray.rows);
+    if (s < 1.) {
+        cv::Mat scaled;
+        cv::resize(gray, scaled, cv::Size(), s, s, cv::INTER_AREA);
+        gray = scaled;
+    }
+    if (!gray.isContinuous())
+        gray = gray.clone();
+    if (plane)
+        *plane = gray;
+
+    Header hdr;
+    memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+    hdr.version = VERSION;
+    hdr.flags = 0;
+    hdr.cols = gray.cols;
+    hdr.rows = gray.rows;
+    hdr.src_cols = src_cols ? src_cols : img.cols;
+    hdr.src_rows = src_rows ? src_rows : img.rows;
+    hdr.raw_len = gray.cols * gray.rows;
+
+    out.resize(sizeof(hdr) + hdr.raw_len);
+#ifdef HAVE_LZ4
+    if (lz4) {
+        std::vector<uchar> z(sizeof(hdr) + LZ4_compressBound(hdr.raw_len));
+        int n = LZ4_compress_default((const char*)gray.data,
+                (char*)&z[sizeof(hdr)], hdr.raw_len, z.size() - sizeof(hdr));
+        // photos compress poorly; only pay for decompression if it helps
+        if (n > 0 && (size_t)n < hdr.raw_len - hdr.raw_len / 8) {
+            hdr.flags |= FLAG_LZ4;
+            z.resize(sizeof(hdr) + n);
+            out.swap(z);
+        }
+    }
+#else
+    (void)lz4;
+#endif
+    memcpy(out.data(), &hdr, sizeof(hdr));
+    if (!(hdr.flags & FLAG_LZ4))
+        memcpy(&out[sizeof(hdr)], gray.data, hdr.raw_len);
+}
+
+bool unpack(const void *data, size_t len, cv::Mat &out, Header *_hdr)
+{
+    Header hdr;
+    if (len < sizeof(hdr))
+        return false;
+    memcpy(&hdr, data, sizeof(hdr));
+    if (memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) || hdr.version != VERSION)
+        return false;
+    if (hdr.cols < 1 || hdr.rows < 1
+            || hdr.raw_len != (uint64_t)hdr.cols * hdr.rows)
+        return false;
+
+    const char *body = (const char*)data + sizeof(hdr);
+    const size_t blen = len - sizeof(hdr);
+    if (!out.isContinuous())
+        out.release(); // a view into something larger
+    out.create(hdr.rows, hdr.cols, CV_8UC1);
+    if (hdr.flags & FLAG_LZ4) {
+#ifdef HAVE_LZ4
+        int n = LZ4_decompress_safe(body, (char*)out.data, blen, hdr.raw_len);
+        if (n != (int)hdr.raw_len)
+            return false;
+#else
+        return false;
+#endif
+    } else {
+        if (blen != hdr.raw_len)
+            return false;
+        memcpy(out.data, body, hdr.raw_len);
+    }
+    if (_hdr)
+        *_hdr = hdr;
+    return true;
+}
+
+}
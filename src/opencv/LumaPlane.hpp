@@ -0,0 +1,56 @@
+/**
+ * LumaPlane.hpp
+ *
+ * Pre-decoded grayscale copies of images, kept in the object store under
+ * <key>::luma::<size> next to the JPEG they came from. A plane is a
+ * short header followed by 8-bit pixels, raw or LZ4-compressed, and is
+ * scaled so its longer side is at most <size>. Reading one costs a copy
+ * (or an LZ4 pass) instead of Huffman decoding and IDCT.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace luma
+{
+
+// bump whenever the layout below changes
+const uint16_t VERSION = 1;
+
+enum
+{
+    FLAG_LZ4 = 1 << 0,
+};
+
+struct Header
+{
+    char magic[4];       // "LUMA"
+    uint16_t version;
+    uint16_t flags;
+    uint32_t cols, rows; // of the plane
+    uint32_t src_cols, src_rows; // of the image it was made from
+    uint32_t raw_len;    // cols * rows
+};
+
+std::string key(const std::string &image_key, int size);
+
+// gray (or BGR, converted) pixels scaled down to fit size; src_cols and
+// src_rows default to those of img. lz4 is ignored unless built with
+// HAVE_LZ4, and is only kept when it saves space. plane, if given,
+// receives the pixels packed, as unpack() would return them; it may
+// share img's data.
+void pack(const cv::Mat &img, int size, std::vector<uchar> &out,
+        bool lz4 = true, int src_cols = 0, int src_rows = 0,
+        cv::Mat *plane = nullptr);
+
+// false for anything that is not a plane this build can read
+bool unpack(const void *data, size_t len, cv::Mat &out,
+        Header *hdr = nullptr);
+
+}
@@ -0,0 +1,153 @@
+/**
+ * MontageLayout.cpp
+ */
+
+// C includes
+#include <math.h>
+
+// C++ includes
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+// Project includes
+#include "MontageLayout.hpp"
+
+MontageLayout::MontageLayout(void)
+    : aspect(16. / 9.), tileRows(400), minRows(200), maxRows(600), seed(0)
+{
+}
+
+cv::Size MontageLayout::layout(const std::vector<cv::Size> &sizes,
+        std::vector<cv::Rect> &rects) const
+{
+    if (sizes.empty())
+        throw std::runtime_error(std::string(__func__) + ": no tiles");
+    if (minRows < 1 || minRows > tileRows || tileRows > maxRows)
+        throw std::runtime_error(std::string(__func__)
+                + ": bad row limits");
+
+    std::vector<double> ar(sizes.size());
+    double total = 0.;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        if (sizes[i].width <= 0 || sizes[i].height <= 0)
+            throw std::runtime_error(std::string(__func__)
+                    + ": empty tile");
+        ar[i] = (double)sizes[i].width / sizes[i].height;
+        total += ar[i];
+    }
+
+    std::vector<size_t> order(sizes.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (seed) {
+        std::mt19937 gen(seed);
+        std::shuffle(order.begin(), order.end(), gen);
+    }
+
+    // At tileRows every tile covers ar * tileRows^2; the width that
+    // gives that total area the requested aspect is the first guess.
+    // Row breaks are coarse, so try widths around it and keep the one
+    // whose packed canvas comes closest to the aspect.
+    const double guess = sqrt(total * tileRows * tileRows * aspect);
+    std::vector<row> rows, best;
+    int width = 0;
+    double err = HUGE_VAL;
+    for (int step = -8; step <= 8; step++) {
+        int w = std::max(1, (int)lround(guess * (1. + step / 20.)));
+        int h = pack(order, ar, w, rows);
+        double e = fabs(log((double)w / h / aspect));
+        if (e < err) {
+            err = e;
+            width = w;
+            best.swap(rows);
+        }
+    }
+
+    rects.resize(sizes.size());
+    int y = 0;
+    for (const row &r : best) {
+        int h = rowHeight(r, width);
+        justify(r, order, ar, width, y, h, rects);
+        y += h;
+    }
+    return cv::Size(width, y);
+}
+
+// Break tiles into rows for the given width. Rows keep taking tiles
+// while the justified height stays above tileRows, then end on
+// whichever side of the last tile lands closer to tileRows. Returns the
+// canvas height.
+int MontageLayout::pack(const std::vector<size_t> &order,
+        const std::vector<double> &ar, int width,
+        std::vector<row> &rows) const
+{
+    rows.clear();
+    row cur = { 0, 0, 0. };
+    for (size_t i = 0; i < order.size(); i++) {
+        double with = cur.ar + ar[order[i]];
+        if (width / with > tileRows) {
+            cur.ar = with;
+            cur.last = i + 1;
+            continue;
+        }
+        if (cur.last > cur.first &&
+                fabs(width / cur.ar - tileRows) < fabs(width / with - tileRows)) {
+            rows.push_back(cur);
+            cur.first = i;
+            cur.ar = ar[order[i]];
+            cur.last = i + 1;
+        } else {
+            cur.ar = with;
+            cur.last = i + 1;
+            rows.push_back(cur);
+            cur.first = cur.last;
+            cur.ar = 0.;
+        }
+    }
+    if (cur.last > cur.first) {
+        // a short trailing row folds into the one above if that still
+        // leaves a row at least minRows tall
+        if (width / cur.ar > maxRows && !rows.empty()
+                && width / (rows.back().ar + cur.ar) >= minRows) {
+            rows.back().last = cur.last;
+            rows.back().ar += cur.ar;
+        } else {
+            rows.push_back(cur);
+        }
+    }
+
+    int h = 0;
+    for (const row &r : rows)
+        h += rowHeight(r, width);
+    return h;
+}
+
+int MontageLayout::rowHeight(const row &r, int width) const
+{
+    return std::min(maxRows, std::max(minRows, (int)lround(width / r.ar)));
+}
+
+// Place one row of tiles in a band h tall. Tile edges come from the
+// rounded running aspect sum so the widths add up to the row width
+// exactly. Tiles keep their aspect when rowHeight() clamped h: a row
+// held down to maxRows no longer fills the width and is centered
+// across it; one held up to minRows would overflow the width, so its
+// tiles stay at the height that fills it and are centered within h.
+void MontageLayout::justify(const row &r, const std::vector<size_t> &order,
+        const std::vector<double> &ar, int width, int y, int h,
+        std::vector<cv::Rect> &rects) const
+{
+    double span = std::min((double)width, r.ar * h);
+    int th = std::min(h, std::max(1, (int)lround(span / r.ar)));
+    int ty = y + (h - th) / 2;
+    double x0 = (width - span) / 2.;
+    double cum = 0.;
+    int left = (int)lround(x0);
+    for (size_t i = r.first; i < r.last; i++) {
+        cum += ar[order[i]];
+        int right = (int)lround(x0 + span * cum / r.ar);
+        rects[order[i]] = cv::Rect(left, ty, std::max(1, right - left), th);
+        left = right;
+    }
+}
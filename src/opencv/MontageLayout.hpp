@@ -0,0 +1,49 @@
+/**
+ * MontageLayout.hpp
+ *
+ * Justified-row placement of montage tiles. Tiles keep their aspect
+ * ratio and are packed into rows that each span the full canvas width,
+ * so the canvas carries no empty area except possibly around a short
+ * final row.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+class MontageLayout
+{
+    public:
+        MontageLayout(void);
+
+        // canvas width : height to aim for
+        double aspect;
+        // preferred row height, and the range rows may be scaled within
+        int tileRows, minRows, maxRows;
+        // non-zero shuffles tile order with this seed; the same seed and
+        // inputs always give the same layout
+        uint32_t seed;
+
+        // sizes are the source image dimensions. rects receives one
+        // placement per input, in input order. Returns the canvas size.
+        cv::Size layout(const std::vector<cv::Size> &sizes,
+                std::vector<cv::Rect> &rects) const;
+
+    private:
+        struct row {
+            size_t first, last; // [first, last) into order
+            double ar;          // summed aspect ratios
+        };
+
+        int pack(const std::vector<size_t> &order,
+                const std::vector<double> &ar, int width,
+                std::vector<row> &rows) const;
+        int rowHeight(const row &r, int width) const;
+        void justify(const row &r, const std::vector<size_t> &order,
+                const std::vector<double> &ar, int width, int y, int h,
+                std::vector<cv::Rect> &rects) const;
+};
@@ -0,0 +1,179 @@
+/**
+ * NeighborSampler.cpp
+ */
+
+#include <math.h>
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <unordered_set>
+#include <utility>
+
+#include "NeighborSampler.hpp"
+
+namespace
+{
+
+const struct { SampleMode mode; const char *name; } MODES[] = {
+    { SampleMode::PREFIX,    "prefix" },
+    { SampleMode::UNIFORM,   "uniform" },
+    { SampleMode::RESERVOIR, "reservoir" },
+    { SampleMode::DEGREE,    "degree" },
+};
+
+// splitmix64: seeded per call, which mt19937 is too big for
+struct Rng
+{
+    uint64_t s;
+
+    explicit Rng(uint64_t seed) : s(seed) { ; }
+
+    uint64_t next(void)
+    {
+        uint64_t z = (s += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    // uniform below n > 0; values under 2^64 mod n would bias it
+    uint64_t below(uint64_t n)
+    {
+        const uint64_t low = -n % n;
+        uint64_t x;
+        do {
+            x = next();
+        } while (x < low);
+        return x % n;
+    }
+    // uniform in (0, 1)
+    double unit(void)
+    {
+        return ((next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// Floyd: for j in n-k .. n-1 take a position at or below j, or j
+// itself if that one is taken already
+void floyd(Rng &rng, size_t n, size_t k, std::vector<size_t> &out)
+{
+    if (k <= 64) { // a scan beats hashing
+        for (size_t j = n - k; j < n; j++) {
+            size_t t = rng.below(j + 1);
+            bool taken = std::find(out.begin(), out.end(), t) != out.end();
+            out.push_back(taken ? j : t);
+        }
+        return;
+    }
+    std::unordered_set<size_t> taken(2 * k);
+    for (size_t j = n - k; j < n; j++) {
+        size_t t = rng.below(j + 1);
+        if (!taken.insert(t).second) {
+            taken.insert(j);
+            t = j;
+        }
+        out.push_back(t);
+    }
+}
+
+// algorithm L: after the first k, jump straight to the next position
+// that would enter the reservoir
+void reservoir(Rng &rng, size_t n, size_t k, std::vector<size_t> &out)
+{
+    for (size_t i = 0; i < k; i++)
+        out.push_back(i);
+    double w = exp(log(rng.unit()) / k);
+    size_t i = k - 1;
+    for (;;) {
+        double skip = floor(log(rng.unit()) / log1p(-w));
+        if (!(skip < (double)(n - 1 - i)))
+            break;
+        i += (size_t)skip + 1;
+        out[rng.below(k)] = i;
+        w *= exp(log(rng.unit()) / k);
+    }
+}
+
+// Efraimidis-Spirakis A-Res over the candidate positions: the k
+// largest of u^(1/w), kept as log(u)/w in a min-heap
+void weighted(Rng &rng, const std::vector<size_t> &cand, size_t k,
+        const NeighborSampler::Weight &weight, std::vector<size_t> &out)
+{
+    typedef std::pair<double, size_t> Key;
+    std::priority_queue<Key, std::vector<Key>, std::greater<Key>> heap;
+    for (size_t i : cand) {
+        double w = weight(i);
+        double key = w > 0 ? log(rng.unit()) / w : -HUGE_VAL;
+        if (heap.size() < k)
+            heap.push(Key(key, i));
+        else if (key > heap.top().first) {
+            heap.pop();
+            heap.push(Key(key, i));
+        }
+    }
+    for (; !heap.empty(); heap.pop())
+        out.push_back(heap.top().second);
+}
+
+}
+
+uint64_t fnv1a(const void *data, size_t len, uint64_t h)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    return h;
+}
+
+bool sample_mode(const std::string &name, SampleMode &mode)
+{
+    for (const auto &m : MODES)
+        if (name == m.name) {
+            mode = m.mode;
+            return true;
+        }
+    return false;
+}
+
+const char* sample_mode_name(SampleMode mode)
+{
+    for (const auto &m : MODES)
+        if (mode == m.mode)
+            return m.name;
+    return "?";
+}
+
+void NeighborSampler::sample(const std::string &vertex, size_t n,
+        size_t k, std::vector<size_t> &out, const Weight *weight) const
+{
+    out.clear();
+    k = std::min(k, n);
+    if (k == n || smode == SampleMode::PREFIX) {
+        for (size_t i = 0; i < k; i++)
+            out.push_back(i);
+        return;
+    }
+    if (k == 0)
+        return;
+    out.reserve(k);
+
+    Rng rng(Rng(sseed).next() ^ fnv1a(vertex.data(), vertex.size()));
+    if (smode == SampleMode::RESERVOIR)
+        reservoir(rng, n, k, out);
+    else if (smode == SampleMode::DEGREE && weight) {
+        // weigh a uniform pool rather than the whole list
+        std::vector<size_t> cand;
+        if (n > DEGREE_POOL * k) {
+            cand.reserve(DEGREE_POOL * k);
+            floyd(rng, n, DEGREE_POOL * k, cand);
+        } else {
+            cand.resize(n);
+            std::iota(cand.begin(), cand.end(), 0);
+        }
+        weighted(rng, cand, k, *weight, out);
+    }
+    else
+        floyd(rng, n, k, out);
+    // in list order, which is also address order in a CSR slice
+    std::sort(out.begin(), out.end());
+}
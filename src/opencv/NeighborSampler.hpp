@@ -0,0 +1,76 @@
+/**
+ * NeighborSampler.hpp
+ *
+ * Picks which k of a vertex's n links a graph query follows. Samples
+ * are positions into the vertex's link list, so they work the same on
+ * GraphCSR slices and on storm::Vertex fields, and only the links
+ * chosen need to be looked at (or named). Each draw is seeded from the
+ * sampler's seed and the vertex ID: a request given its own seed sees
+ * the same links for a vertex on every thread and every hop, and
+ * different requests spread over different links.
+ *
+ *      prefix     the first k, as neighbors() always did
+ *      uniform    k distinct positions, all equally likely (Floyd);
+ *                 O(k)
+ *      reservoir  the same distribution by skipping through the
+ *                 list (Li's algorithm L); O(k log(n/k))
+ *      degree     k distinct positions, each link weighted by its
+ *                 target's degree + 1 (Efraimidis-Spirakis) among
+ *                 DEGREE_POOL * k uniform candidates, so hubs need not
+ *                 read every weight; exact for shorter lists.
+ *                 O(k log k)
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// candidates per link kept that degree sampling weighs
+const size_t DEGREE_POOL = 16;
+
+enum class SampleMode
+{
+    PREFIX,
+    UNIFORM,
+    RESERVOIR,
+    DEGREE,
+};
+
+// false if name is none of the modes above
+bool sample_mode(const std::string &name, SampleMode &mode);
+const char* sample_mode_name(SampleMode mode);
+
+// 64-bit FNV-1a; pass a previous result as h to chain
+uint64_t fnv1a(const void *data, size_t len,
+        uint64_t h = 0xCBF29CE484222325ULL);
+
+class NeighborSampler
+{
+    public:
+        // weight of the link at a position; used by DEGREE only
+        typedef std::function<double(size_t)> Weight;
+
+        NeighborSampler(SampleMode mode = SampleMode::PREFIX,
+                uint64_t seed = 0)
+            : smode(mode), sseed(seed) { ; }
+
+        inline void mode(SampleMode m) { smode = m; }
+        inline SampleMode mode(void) const { return smode; }
+        // e.g. one per request
+        inline void seed(uint64_t s) { sseed = s; }
+        inline uint64_t seed(void) const { return sseed; }
+
+        // min(k, n) distinct positions below n, ascending, into out.
+        // Without a weight DEGREE samples as UNIFORM does.
+        void sample(const std::string &vertex, size_t n, size_t k,
+                std::vector<size_t> &out,
+                const Weight *weight = nullptr) const;
+
+    private:
+        SampleMode smode;
+        uint64_t sseed;
+};
@@ -56,6 +56,15 @@ public class SearchTopology {
     // topology - how many neighbor bolts to create
     static int numNeighbor = 3;
 
+    // topology - true to replace the neighbor, uniq and imagesof bolts
+    // with one Expand bolt doing the numNeighbor hops natively
+    static boolean nativeExpand = false;
+
+    // expand - keep to vertices matching this attribute filter (e.g.
+    // "univ:@" for those sharing a university with the request's
+    // vertex), or null for all
+    static String expandFilter = null;
+
     // parallelism hints given to storm for each bolt
     public static class SearchConfig {
         // cluster information (hardware)
@@ -215,6 +224,57 @@ public class SearchTopology {
                 + " vertices");
     }
 
+    // the graph sampling entry: how neighbor queries pick links
+    public static String readGraphSampling(String confPath)
+        throws IOException {
+
+        String mode = "prefix";
+        BufferedReader in = new BufferedReader(new FileReader(confPath));
+        while (in.ready()) {
+            String line = in.readLine();
+            String[] tokens = line.split(" ");
+            if (tokens[0].equals("graph"))
+                if (tokens[1].equals("sampling"))
+                    mode = tokens[2];
+        }
+        return mode;
+    }
+
+    // path of the graph entry (e.g. csrfile) in the resources
+    // directory, or null when the conf has none
+    public static String readGraphFilePath(String confPath, String entry)
+        throws IOException {
+
+        String path = null;
+        BufferedReader in = new BufferedReader(new FileReader(confPath));
+        while (in.ready()) {
+            String line = in.readLine();
+            String[] tokens = line.split(" ");
+            if (tokens[0].equals("graph"))
+                if (tokens[1].equals(entry))
+                    path = tokens[2];
+        }
+        if (null == path)
+            return null;
+        return getResourcePath(path);
+    }
+
+    // a jpeg entry, e.g. "jpeg parallel 4", or dflt when there is none
+    public static String readJpegEntry(String confPath, String entry,
+            String dflt) throws IOException {
+
+        String value = dflt;
+        BufferedReader in = new BufferedReader(new FileReader(confPath));
+        while (in.ready()) {
+            String line = in.readLine();
+            String[] tokens = line.split(" ");
+            if (tokens[0].equals("jpeg"))
+                if (tokens[1].equals(entry))
+                    value = tokens[2];
+        }
+        return value;
+    }
+
     public static final String TopologyName = new String("search");
 
     // ---------------------------------------------------------------
@@ -555,6 +615,81 @@ public class SearchTopology {
     // Bolt - Neighbors
     // ---------------------------------------------------------------
 
+    // how Neighbors and Expand pick links, from the conf
+    public static String confSampling(Logger log) {
+        try {
+            String mode = readGraphSampling(getResourcePath(confName));
+            Logger.println(log, "neighbor sampling " + mode);
+            return mode;
+        } catch (IOException e) {
+            System.err.println("Error opening conf file");
+        }
+        return "prefix";
+    }
+
+    // without the adjacency file, vertices are fetched instead
+    public static void useGraphCSR(JNILinker jni, Logger log) {
+        try {
+            String csrPath = readGraphFilePath(getResourcePath(confName),
+                    "csrfile");
+            if (null != csrPath && new File(csrPath).exists())
+                jni.setGraphCSR(csrPath);
+            else
+                Logger.println(log, "no graph CSR; using object store");
+        } catch (IOException e) {
+            System.err.println("Error opening conf file");
+        } catch (JNIException e) {
+            Logger.println(log, "graph CSR: " + e.e2s());
+        }
+    }
+
+    // strip-parallel decodes of large images with restart markers
+    public static void useParallelDecode(JNILinker jni, Logger log) {
+        try {
+            String conf = getResourcePath(confName);
+            int threads = Integer.parseInt(
+                    readJpegEntry(conf, "parallel", "1"));
+            long minPixels = Long.parseLong(
+                    readJpegEntry(conf, "parallelmin", "4000000"));
+            jni.setParallelDecode(threads, minPixels);
+            Logger.println(log, "parallel decode " + threads
+                    + " threads from " + minPixels + " pixels");
+        } catch (IOException e) {
+            System.err.println("Error opening conf file");
+        } catch (NumberFormatException e) {
+            Logger.println(log, "parallel decode: " + e.getMessage());
+        }
+    }
+
+    // grayscale planes in the object store instead of JPEG decodes
+    public static void useLumaCache(JNILinker jni, Logger log) {
+        try {
+            String conf = getResourcePath(confName);
+            boolean on = readJpegEntry(conf, "lumacache", "off")
+                .equals("on");
+            jni.setLumaCache(on);
+            Logger.println(log, "luma cache " + (on ? "on" : "off"));
+        } catch (IOException e) {
+            System.err.println("Error opening conf file");
+        }
+    }
+
+    // for expand filters; they fail without it
+    public static void useAttrIndex(JNILinker jni, Logger log) {
+        try {
+            String attrPath = readGraphFilePath(getResourcePath(confName),
+                    "attrfile");
+            if (null != attrPath && new File(attrPath).exists())
+                jni.setAttrIndex(attrPath);
+            else
+                Logger.println(log, "no attribute index");
+        } catch (IOException e) {
+            System.err.println("Error opening conf file");
+        } catch (JNIException e) {
+            Logger.println(log, "attribute index: " + e.e2s());
+        }
+    }
+
     public static class Neighbors extends SimpleBolt {
         private JNILinker jni;
         private Random rand;
@@ -567,6 +702,9 @@ public class SearchTopology {
                 TopologyContext context, OutputCollector collector) {
             super.prepare(conf, context, collector);
             jni = new JNILinker(memcInfo);
+            useGraphCSR(jni, log);
+            // an unknown mode fails here rather than on every tuple
+            jni.neighborSampling(confSampling(log));
         }
 
         @Override // ignore superclass implementation
@@ -595,6 +733,8 @@ public class SearchTopology {
             Logger.println(log, "querying neighbors for " + vertex);
             HashSet<String> others = new HashSet<String>();
             try {
+                // every hop of a request samples a vertex the same way
+                jni.neighborSeed(reqID.hashCode());
                 jni.neighbors(vertex, others);
             }
             catch (JNIException e) {
@@ -935,12 +1075,86 @@ public class SearchTopology {
         }
     }
 
+    // ---------------------------------------------------------------
+    // Bolt - Expand
+    // ---------------------------------------------------------------
+
+    // Does the work of the neighbor bolts, uniq and imagesOf for a
+    // request in one native call: emits up to maxImgsPer images and
+    // their count, like imagesOf.
+    public static class Expand extends SimpleBolt {
+        private JNILinker jni;
+
+        Expand() {
+            name = "EXPAND";
+        }
+
+        public void prepare(Map conf,
+                TopologyContext context, OutputCollector collector) {
+            super.prepare(conf, context, collector);
+            jni = new JNILinker(memcInfo);
+            useGraphCSR(jni, log);
+            if (null != expandFilter)
+                useAttrIndex(jni, log);
+            // an unknown mode fails here rather than on every tuple
+            jni.neighborSampling(confSampling(log));
+        }
+
+        @Override
+        public void declareOutputFields(OutputFieldsDeclarer d) {
+            Fields fields = new Fields(Labels.reqID, Labels.count);
+            d.declareStream(Labels.Stream.counts, fields);
+            fields = new Fields(Labels.reqID, Labels.image);
+            d.declareStream(Labels.Stream.images, fields);
+        }
+
+        @Override
+        public void execute(Tuple tuple) {
+            String reqID = tuple.getString(0);
+            String vertex = tuple.getString(1);
+            Logger.println(log, "expanding " + vertex + " for " + reqID);
+            HashSet<String> vertices = new HashSet<String>();
+            HashSet<String> images = new HashSet<String>();
+            try {
+                jni.neighborSeed(reqID.hashCode());
+                jni.expand(vertex, numNeighbor, 0, maxImgsPer,
+                        expandFilter, vertices, images);
+            }
+            catch (JNIException e) {
+                System.out.println("exception: " + e.e2s());
+                Logger.println(log, "exception: " + e.e2s());
+                switch (e.type) {
+                    case JNIException.PROTOBUF:
+                    case JNIException.OPENCV:
+                    case JNIException.MEMC_NOTFOUND:
+                        // a count of zero still completes it in montage
+                        images.clear();
+                        break;
+                    case JNIException.NORECOVER:
+                    default:
+                        throw e;
+                }
+            }
+            Logger.println(log, reqID + " " + vertices.size()
+                    + " vertices " + images.size() + " images");
+
+            c.emit(Labels.Stream.counts, new Values(reqID,
+                        Integer.toString(images.size())));
+            for (String imageID : images)
+                c.emit(Labels.Stream.images, new Values(reqID, imageID));
+            c.ack(tuple);
+        }
+    }
+
     // ---------------------------------------------------------------
     // Bolt - Feature
     // ---------------------------------------------------------------
 
     public static class Feature extends SimpleBolt {
         private JNILinker jni;
+        private long executed;
+        // log the cache hit rates every this many tuples
+        private static final long STATS_EVERY = 100;
 
         Feature() {
             name = "FEATURE";
@@ -956,6 +1170,8 @@ public class SearchTopology {
                 TopologyContext context, OutputCollector collector) {
             super.prepare(conf, context, collector);
             jni = new JNILinker(memcInfo);
+            useParallelDecode(jni, log);
+            useLumaCache(jni, log);
         }
 
         @Override
@@ -994,6 +1210,12 @@ public class SearchTopology {
             Values values = new Values(reqID, imageID);
             c.emit(Labels.Stream.images, values);
             c.ack(tuple);
+
+            if (++executed % STATS_EVERY == 0) {
+                StringBuffer stats = new StringBuffer();
+                jni.cacheStats(stats);
+                Logger.println(log, stats.toString());
+            }
         }
     }
 
@@ -1011,9 +1233,8 @@ public class SearchTopology {
             boolean emitted;
             HashSet<String> imageIDs;
             public boolean done() {
-                boolean nonZero = (imageRecv > 0) && (imageWait > 0)
-                    && (countRecv > 0); // must consider countRecv
-                return (nonZero && (imageRecv >= imageWait));
+                // a count of zero completes the request by itself
+                return (countRecv > 0) && (imageRecv >= imageWait);
             }
             public boolean wasEmitted() { return emitted; }
             public void setEmitted() { emitted = true; }
@@ -1042,6 +1263,8 @@ public class SearchTopology {
                 TopologyContext context, OutputCollector collector) {
             super.prepare(conf, context, collector);
             jni = new JNILinker(memcInfo);
+            useParallelDecode(jni, log);
+            useLumaCache(jni, log);
         }
 
         @Override // spits out montage key (which is an image)
@@ -1068,6 +1291,7 @@ public class SearchTopology {
             info.imageWait += count;
             Logger.println(log, reqID + " imageWait " +
                     info.imageWait);
+            checkDone(reqID, info);
         }
         private void handleImage(Tuple tuple) {
             String reqID = tuple.getString(0);
@@ -1087,28 +1311,34 @@ public class SearchTopology {
             Logger.println(log, reqID + " set has "
                     + Integer.toString(info.imageIDs.size())
                     + " images");
-
+            checkDone(reqID, info);
+        }
+        private void checkDone(String reqID, TrackingInfo info) {
             if (info.done() && !info.wasEmitted()) {
                 Logger.println(log, "Got all "
                         + Integer.toString(info.imageIDs.size())
                         + " images (uniq'd set) for " + reqID);
                 StringBuffer montage_key = new StringBuffer();
-                try {
-                    jni.montage(info.imageIDs, montage_key);
-                }
-                catch (JNIException e) {
-                    System.out.println("exception: " + e.e2s());
-                    Logger.println(log, "exception: " + e.e2s());
-                    switch (e.type) {
-                        case JNIException.PROTOBUF:
-                        case JNIException.OPENCV:
-                        case JNIException.MEMC_NOTFOUND:
-                            // XXX hack: just pick some existing image...
-                            montage_key.append(imageID);
-                            break;
-                        case JNIException.NORECOVER:
-                        default:
-                            throw e;
+                // nothing to lay out: complete with an empty key
+                if (!info.imageIDs.isEmpty()) {
+                    try {
+                        jni.montage(info.imageIDs, montage_key);
+                    }
+                    catch (JNIException e) {
+                        System.out.println("exception: " + e.e2s());
+                        Logger.println(log, "exception: " + e.e2s());
+                        switch (e.type) {
+                            case JNIException.PROTOBUF:
+                            case JNIException.OPENCV:
+                            case JNIException.MEMC_NOTFOUND:
+                                // XXX hack: just pick some existing image...
+                                montage_key.append(
+                                        info.imageIDs.iterator().next());
+                                break;
+                            case JNIException.NORECOVER:
+                            default:
+                                throw e;
+                        }
                     }
                 }
                 // XXX add a failed status (e.g. as field), if needed?
@@ -1116,6 +1346,10 @@ public class SearchTopology {
                 c.emit(Labels.Stream.completed, v);
                 info.setEmitted();
 
+                StringBuffer stats = new StringBuffer();
+                jni.cacheStats(stats);
+                Logger.println(log, stats.toString());
+
                 // don't remove... hold onto it b/c we may get
                 // remaining image IDs for something we already
                 // completed...
@@ -1158,46 +1392,56 @@ public class SearchTopology {
         reqMgr.setNumTasks(SearchConfig.tasks.reqMgr);
         reqMgr.fieldsGrouping("gen", Labels.Stream.vertices, sortByID);
 
-        name = neighBase + (numNeighbor - 1);
-        BoltDeclarer uniq = builder.setBolt("uniq",
-                new Uniquer(name), SearchConfig.threads.uniq);
-        uniq.setNumTasks(SearchConfig.tasks.uniq);
-
-        name = neighBase + 0;
-        BoltDeclarer neigh = builder.setBolt(name, new Neighbors(),
-                SearchConfig.threads.neighbor);
-        neigh.setNumTasks(SearchConfig.tasks.neighbor);
-        neigh.shuffleGrouping("mgr", Labels.Stream.vertices);
-        uniq.fieldsGrouping(name, Labels.Stream.counts, sortByID);
-        uniq.fieldsGrouping(name, Labels.Stream.vertices, sortByID);
-        for (int n = 1; n < numNeighbor; n++) {
-            String prior = neighBase + (n - 1);
-            name = neighBase + n;
-            neigh = builder.setBolt(name, new Neighbors(),
+        // bolt sending images and their count on to feature and montage
+        String images = "imagesOf";
+        if (nativeExpand) {
+            images = "expand";
+            BoltDeclarer expand = builder.setBolt(images, new Expand(),
+                    SearchConfig.threads.neighbor);
+            expand.setNumTasks(SearchConfig.tasks.neighbor);
+            expand.shuffleGrouping("mgr", Labels.Stream.vertices);
+        } else {
+            name = neighBase + (numNeighbor - 1);
+            BoltDeclarer uniq = builder.setBolt("uniq",
+                    new Uniquer(name), SearchConfig.threads.uniq);
+            uniq.setNumTasks(SearchConfig.tasks.uniq);
+
+            name = neighBase + 0;
+            BoltDeclarer neigh = builder.setBolt(name, new Neighbors(),
                     SearchConfig.threads.neighbor);
-            neigh.fieldsGrouping(prior, Labels.Stream.vertices, sortByID);
             neigh.setNumTasks(SearchConfig.tasks.neighbor);
+            neigh.shuffleGrouping("mgr", Labels.Stream.vertices);
             uniq.fieldsGrouping(name, Labels.Stream.counts, sortByID);
             uniq.fieldsGrouping(name, Labels.Stream.vertices, sortByID);
-        }
+            for (int n = 1; n < numNeighbor; n++) {
+                String prior = neighBase + (n - 1);
+                name = neighBase + n;
+                neigh = builder.setBolt(name, new Neighbors(),
+                        SearchConfig.threads.neighbor);
+                neigh.fieldsGrouping(prior, Labels.Stream.vertices, sortByID);
+                neigh.setNumTasks(SearchConfig.tasks.neighbor);
+                uniq.fieldsGrouping(name, Labels.Stream.counts, sortByID);
+                uniq.fieldsGrouping(name, Labels.Stream.vertices, sortByID);
+            }
 
-        BoltDeclarer imagesof = builder.setBolt("imagesOf",
-                new ImagesOf(), SearchConfig.threads.imagesOf);
-        imagesof.setNumTasks(SearchConfig.tasks.imagesOf);
-        imagesof.fieldsGrouping("uniq", Labels.Stream.vertices, sortByID);
-        imagesof.fieldsGrouping("uniq", Labels.Stream.counts, sortByID);
+            BoltDeclarer imagesof = builder.setBolt("imagesOf",
+                    new ImagesOf(), SearchConfig.threads.imagesOf);
+            imagesof.setNumTasks(SearchConfig.tasks.imagesOf);
+            imagesof.fieldsGrouping("uniq", Labels.Stream.vertices, sortByID);
+            imagesof.fieldsGrouping("uniq", Labels.Stream.counts, sortByID);
+        }
 
         BoltDeclarer feature = builder.setBolt("feature", new Feature(),
                 SearchConfig.threads.feature);
         feature.setNumTasks(SearchConfig.tasks.feature);
-        feature.shuffleGrouping("imagesOf", Labels.Stream.images);
+        feature.shuffleGrouping(images, Labels.Stream.images);
 
         BoltDeclarer montage = builder.setBolt("montage", new Montage(),
                 SearchConfig.threads.montage);
         montage.setNumTasks(SearchConfig.tasks.montage);
         montage.fieldsGrouping("feature",
                 Labels.Stream.images, sortByID);
-        montage.fieldsGrouping("imagesOf",
+        montage.fieldsGrouping(images,
                 Labels.Stream.counts, sortByID);
 
         reqMgr.fieldsGrouping("montage",
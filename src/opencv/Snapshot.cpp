@@ -0,0 +1,262 @@
+/**
+ * Snapshot.cpp
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "Snapshot.hpp"
+
+static const char SNAPSHOT_MAGIC[8] = { 'S','N','A','P','S','H','O','T' };
+
+// reflected CRC-32, as zlib computes it
+struct CrcTable
+{
+    uint32_t t[256];
+    CrcTable(void)
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+uint32_t snapshot_crc32(uint32_t crc, const void *data, size_t len)
+{
+    static const CrcTable table;
+    const uint8_t *p = (const uint8_t*)data;
+    crc = ~crc;
+    while (len--)
+        crc = table.t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+//==--------------------------------------------------------------==//
+// SnapshotWriter
+//==--------------------------------------------------------------==//
+
+SnapshotWriter::SnapshotWriter(void)
+    : fp(nullptr), crc(0), pos(0)
+{
+    memset(&hdr, 0, sizeof(hdr));
+}
+
+SnapshotWriter::~SnapshotWriter(void)
+{
+    if (fp)
+        fclose(fp);
+}
+
+int SnapshotWriter::write(const void *data, size_t len)
+{
+    if (len && fwrite(data, 1, len, fp) != len)
+        return -1;
+    pos += len;
+    return 0;
+}
+
+int SnapshotWriter::open(const std::string &path, const std::string &kind,
+        bool checksum, uint32_t block_records)
+{
+    if (fp || kind.size() >= sizeof(hdr.kind))
+        return -1;
+    if (!(fp = fopen(path.c_str(), "wb")))
+        return -1;
+
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.flags = checksum ? SNAPSHOT_CRC : 0;
+    strncpy(hdr.kind, kind.c_str(), sizeof(hdr.kind) - 1);
+    hdr.block_records = block_records ? block_records : 1;
+    hdr.align = SNAPSHOT_ALIGN;
+    index.clear();
+    crcs.clear();
+    crc = 0;
+    pos = 0;
+
+    // the real header goes in on close
+    return write(&hdr, sizeof(hdr));
+}
+
+int SnapshotWriter::add(const google::protobuf::MessageLite &msg)
+{
+    static const char zeros[SNAPSHOT_ALIGN] = { 0 };
+    if (!fp)
+        return -1;
+
+    buf.clear();
+    if (!msg.AppendToString(&buf))
+        return -1;
+
+    // pad so the record starts aligned; padding is part of the block
+    size_t pad = (SNAPSHOT_ALIGN - pos % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN;
+    if (write(zeros, pad))
+        return -1;
+    crc = snapshot_crc32(crc, zeros, pad);
+
+    SnapshotIndex ent = { pos, buf.size() };
+    if (write(buf.data(), buf.size()))
+        return -1;
+    crc = snapshot_crc32(crc, buf.data(), buf.size());
+    index.push_back(ent);
+
+    if (index.size() % hdr.block_records == 0) {
+        crcs.push_back(crc);
+        crc = 0;
+    }
+    return 0;
+}
+
+int SnapshotWriter::close(void)
+{
+    static const char zeros[SNAPSHOT_ALIGN] = { 0 };
+    if (!fp)
+        return -1;
+    if (index.size() % hdr.block_records)
+        crcs.push_back(crc);
+
+    int ret = 0;
+    size_t pad = (SNAPSHOT_ALIGN - pos % SNAPSHOT_ALIGN) % SNAPSHOT_ALIGN;
+    ret |= write(zeros, pad);
+    hdr.count = index.size();
+    hdr.index_offset = pos;
+    ret |= write(index.data(), index.size() * sizeof(index[0]));
+    if (hdr.flags & SNAPSHOT_CRC) {
+        hdr.crc_offset = pos;
+        ret |= write(crcs.data(), crcs.size() * sizeof(crcs[0]));
+    }
+
+    if (fseek(fp, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        ret = -1;
+    if (fclose(fp))
+        ret = -1;
+    fp = nullptr;
+    return ret ? -1 : 0;
+}
+
+//==--------------------------------------------------------------==//
+// SnapshotReader
+//==--------------------------------------------------------------==//
+
+SnapshotReader::SnapshotReader(void)
+    : map(nullptr), maplen(0), count(0),
+    index(nullptr), crcs(nullptr), block_records(1)
+{ ; }
+
+SnapshotReader::~SnapshotReader(void)
+{
+    close();
+}
+
+void SnapshotReader::close(void)
+{
+    if (map)
+        munmap(map, maplen);
+    map = nullptr;
+    maplen = count = 0;
+    index = nullptr;
+    crcs = nullptr;
+}
+
+int SnapshotReader::open(const std::string &path, const char *kind)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        return -1;
+    }
+    maplen = st.st_size;
+    map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        return -1;
+    }
+
+    const SnapshotHeader *hdr = (const SnapshotHeader*)map;
+    std::string why;
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)))
+        why = "not a snapshot (regenerate it with 'proto')";
+    else if (hdr->version != SNAPSHOT_VERSION)
+        why = "snapshot version " + std::to_string(hdr->version);
+    else if (kind && strncmp(hdr->kind, kind, sizeof(hdr->kind)))
+        why = "holds '" + std::string(hdr->kind, strnlen(hdr->kind,
+                    sizeof(hdr->kind))) + "' records";
+    else if (hdr->index_offset > maplen
+            || hdr->count > (maplen - hdr->index_offset) / sizeof(SnapshotIndex))
+        why = "index out of bounds";
+    if (!why.empty()) {
+        std::cerr << path << ": " << why << std::endl;
+        close();
+        return -1;
+    }
+
+    count = hdr->count;
+    index = (const SnapshotIndex*)((const char*)map + hdr->index_offset);
+    block_records = hdr->block_records ? hdr->block_records : 1;
+    uint64_t prev = sizeof(*hdr); // records are in file order
+    for (size_t i = 0; i < count; prev = index[i].offset + index[i].length, i++)
+        if (index[i].offset < prev || index[i].offset > hdr->index_offset
+                || index[i].length > hdr->index_offset - index[i].offset) {
+            std::cerr << path << ": record " << i << " out of bounds"
+                << std::endl;
+            close();
+            return -1;
+        }
+
+    if (hdr->flags & SNAPSHOT_CRC) {
+        size_t blocks = (count + block_records - 1) / block_records;
+        if (hdr->crc_offset > maplen
+                || blocks > (maplen - hdr->crc_offset) / sizeof(uint32_t)) {
+            std::cerr << path << ": checksums out of bounds" << std::endl;
+            close();
+            return -1;
+        }
+        crcs = (const uint32_t*)((const char*)map + hdr->crc_offset);
+    }
+
+    // records are read front to back
+    madvise(map, maplen, MADV_SEQUENTIAL);
+    return 0;
+}
+
+const void* SnapshotReader::data(size_t i, size_t &len) const
+{
+    if (i >= count)
+        return nullptr;
+    len = index[i].length;
+    return (const char*)map + index[i].offset;
+}
+
+bool SnapshotReader::verify(size_t first, size_t last) const
+{
+    if (!crcs || first >= last)
+        return true;
+    // a block runs from the end of the previous block's last record
+    for (size_t b = first / block_records; b * block_records < last; b++) {
+        size_t r0 = b * block_records;
+        size_t r1 = std::min(count, r0 + block_records);
+        uint64_t start = r0 ? index[r0 - 1].offset + index[r0 - 1].length
+            : sizeof(SnapshotHeader);
+        uint64_t end = index[r1 - 1].offset + index[r1 - 1].length;
+        if (snapshot_crc32(0, (const char*)map + start, end - start) != crcs[b]) {
+            std::cerr << "snapshot checksum mismatch in records " << r0
+                << "-" << r1 - 1 << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,187 @@
+/**
+ * Snapshot.hpp
+ *
+ * Container for the graph.pb and imagelist.pb snapshots load_egonet
+ * writes and loads. Layout:
+ *
+ *      header    fixed size, see SnapshotHeader
+ *      records   serialized messages, each starting on an ALIGN boundary
+ *      index     (offset, length) of every record
+ *      checksums optional CRC32 of each block of blockRecords records
+ *
+ * A reader maps the file and can parse any range of records on its own,
+ * so a snapshot can be read at random or split across threads.
+ */
+
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/message_lite.h>
+
+struct SnapshotHeader
+{
+    char magic[8];          // "SNAPSHOT"
+    uint32_t version;
+    uint32_t flags;
+    char kind[16];          // what the records are, e.g. "vertex"
+    uint64_t count;         // records
+    uint64_t index_offset;
+    uint64_t crc_offset;    // 0 without checksums
+    uint32_t block_records; // records per checksum block
+    uint32_t align;
+};
+
+struct SnapshotIndex
+{
+    uint64_t offset, length;
+};
+
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t SNAPSHOT_CRC     = 1 << 0;
+const uint32_t SNAPSHOT_ALIGN   = 8;
+
+uint32_t snapshot_crc32(uint32_t crc, const void *data, size_t len);
+
+class SnapshotWriter
+{
+    public:
+        SnapshotWriter(void);
+        ~SnapshotWriter(void);
+
+        int open(const std::string &path, const std::string &kind,
+                bool checksum = true, uint32_t block_records = 1024);
+        int add(const google::protobuf::MessageLite &msg);
+        // writes index, checksums and header
+        int close(void);
+
+    private:
+        int write(const void *data, size_t len);
+
+        FILE *fp;
+        SnapshotHeader hdr;
+        std::vector<SnapshotIndex> index;
+        std::vector<uint32_t> crcs;
+        uint32_t crc;
+        uint64_t pos;
+        std::string buf;
+};
+
+class SnapshotReader
+{
+    public:
+        SnapshotReader(void);
+        ~SnapshotReader(void);
+
+        // maps path and checks the header and index; kind, if given,
+        // must match what the writer recorded
+        int open(const std::string &path, const char *kind = nullptr);
+        void close(void);
+
+        inline size_t size(void) const { return count; }
+        inline bool checksummed(void) const { return crcs != nullptr; }
+
+        // serialized bytes of record i, within the mapping
+        const void* data(size_t i, size_t &len) const;
+        // checksums of the blocks holding records [first, last); true
+        // when there are none
+        bool verify(size_t first, size_t last) const;
+
+        // Parse records [first, last) in order with one CodedInputStream
+        // per ~1 GB run, calling fn(i, msg) for each. Checksums, if any,
+        // are verified first. Returns -1 on a bad checksum or record or
+        // when fn does.
+        template <typename Msg, typename F>
+        int read(size_t first, size_t last, F fn) const;
+
+        // read() over all records, split into one contiguous range per
+        // thread; fn must be thread safe
+        template <typename Msg, typename F>
+        int readParallel(int threads, F fn) const;
+
+    private:
+        SnapshotReader(const SnapshotReader&);
+        SnapshotReader& operator=(const SnapshotReader&);
+
+        void *map;
+        size_t maplen;
+        size_t count;
+        const SnapshotIndex *index;
+        const uint32_t *crcs;
+        uint32_t block_records;
+};
+
+template <typename Msg, typename F>
+int SnapshotReader::read(size_t first, size_t last, F fn) const
+{
+    if (last > count || first > last)
+        return -1;
+    if (!verify(first, last))
+        return -1;
+
+    const uint8_t *base = (const uint8_t*)map;
+    // CodedInputStream sizes are ints; take runs well under that
+    const uint64_t RUN = 1ULL << 30;
+    size_t i = first;
+    while (i < last) {
+        const uint64_t start = index[i].offset;
+        size_t j = i;
+        while (j < last && index[j].offset + index[j].length - start <= RUN)
+            j++;
+        if (j == i)
+            return -1; // one record over a gigabyte
+        const uint64_t end = index[j - 1].offset + index[j - 1].length;
+
+        google::protobuf::io::CodedInputStream in(base + start, end - start);
+        // the default total limit is 64 MB before protobuf 3.6
+#if GOOGLE_PROTOBUF_VERSION < 3006000
+        in.SetTotalBytesLimit(INT_MAX, -1);
+#else
+        in.SetTotalBytesLimit(INT_MAX);
+#endif
+        uint64_t at = start;
+        for (; i < j; i++) {
+            if (!in.Skip(index[i].offset - at))
+                return -1;
+            auto limit = in.PushLimit(index[i].length);
+            Msg msg;
+            if (!msg.MergeFromCodedStream(&in) || !in.ConsumedEntireMessage())
+                return -1;
+            in.PopLimit(limit);
+            at = index[i].offset + index[i].length;
+            if (fn(i, msg))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+template <typename Msg, typename F>
+int SnapshotReader::readParallel(int threads, F fn) const
+{
+    if (threads < 1)
+        threads = 1;
+    size_t per = (count + threads - 1) / threads;
+    std::vector<std::thread> pool;
+    std::vector<int> ret(threads, 0);
+    for (int t = 1; t < threads; t++)
+        pool.push_back(std::thread([&, t] {
+            size_t first = std::min(count, t * per);
+            ret[t] = read<Msg>(first, std::min(count, first + per), fn);
+        }));
+    ret[0] = read<Msg>(0, std::min(count, per), fn);
+    for (std::thread &th : pool)
+        th.join();
+    for (int r : ret)
+        if (r)
+            return r;
+    return 0;
+}
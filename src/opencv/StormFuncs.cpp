@@ -18,10 +18,20 @@
 #include <sys/socket.h>
 
 // C++ headers
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
 #include <opencv2/opencv.hpp>
 #include <sstream>
 #include <memory>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 // Local headers
 #include "StormFuncs.h"
@@ -37,9 +47,17 @@
 //==--------------------------------------------------------------==//
 
 StormFuncs::StormFuncs(void)
-: memc(nullptr), rd(), gen(rd()), dis(0,1UL<<20)
+: memc(nullptr), mckeep(false), mluma(false), mstream(true),
+    mthreads(std::max(1U, std::thread::hardware_concurrency())),
+    rd(), gen(rd()), dis(0,1UL<<20)
 {
+    mlayout.tileRows = MONTAGE_TILE_ROWS;
+}
 
+StormFuncs::~StormFuncs(void)
+{
+    for (memcached_st *mc : mclones)
+        memcached_free(mc);
 }
 
 int StormFuncs::connect(std::string &servers)
@@ -50,11 +68,55 @@ int StormFuncs::connect(std::string &servers)
     return !memc;
 }
 
+// memc_set for derived copies (thumbnails, planes) that can be made
+// again: a failed store is reported, not thrown
+static inline bool cache_set(memcached_st *mc, const std::string &key,
+        const void *val, size_t len)
+{
+    try { memc_set(mc, key, val, len); }
+    catch (std::runtime_error &e) { return false; }
+    return true;
+}
+
+// how many of n links neighbors() emits; otherwise growth is too great
+static inline size_t neighbors_kept(size_t n)
+{
+    const float base = 1.5f;
+    if (n > 20)
+        return std::log2(n) / std::log2(base);
+    return n;
+}
+
 int StormFuncs::neighbors(std::string &vertex,
         std::deque<std::string> &others)
 {
     if (vertex.length() == 0)
         throw runtime_error("vertex zero length");
+
+    if (mcsr) {
+        // only the names of the links kept are made
+        GraphCSR::vid v = mcsr->find(vertex);
+        if (v == GraphCSR::NONE || !mcsr->present(v))
+            throw memc_notfound(std::string(__func__) + ": "
+                    + vertex + " not in graph");
+        size_t ower, ing;
+        const GraphCSR::vid *fs = mcsr->followers(v, ower);
+        const GraphCSR::vid *gs = mcsr->following(v, ing);
+        if (ower + ing == 0) {
+            std::cout << "zero links" << std::endl;
+            others.push_back(vertex);
+            return 0;
+        }
+        const GraphCSR::vid *links = ower > ing ? fs : gs;
+        const size_t n = std::max(ower, ing);
+        std::vector<size_t> pos;
+        sampleLinks(vertex, links, n, neighbors_kept(n), pos);
+        others.resize(pos.size());
+        for (size_t i = 0; i < others.size(); i++)
+            others[i] = mcsr->name(links[pos[i]]);
+        return 0;
+    }
+
     storm::Vertex vobj;
     memc_get(memc, vertex, vobj);
 
@@ -68,29 +130,32 @@ int StormFuncs::neighbors(std::string &vertex,
         others.push_back(vertex);
         return 0;
     }
-    const float base = 1.5f;
-    size_t num;
-    if (ower > ing) {
-        num = ower;
-        if (ower > 20)
-            num = std::log2(ower) / std::log2(base);
-        others.resize(num);
-        for (size_t i = 0; i < others.size(); i++)
-            others[i] = vobj.followers(i);
-            //others[i] = vobj.followers(dis(gen) % ower);
-    } else {
-        num = ing;
-        if (ing > 20)
-            num = std::log2(ing) / std::log2(base);
-        others.resize(num);
-        for (size_t i = 0; i < others.size(); i++)
-            others[i] = vobj.following(i);
-            //others[i] = vobj.following(dis(gen) % ing);
-    }
+    const size_t n = std::max(ower, ing);
+    std::vector<size_t> pos;
+    sampleLinks(vertex, nullptr, n, neighbors_kept(n), pos);
+    others.resize(pos.size());
+    for (size_t i = 0; i < others.size(); i++)
+        others[i] = ower > ing
+            ? vobj.followers(pos[i]) : vobj.following(pos[i]);
 
     return 0;
 }
 
+void StormFuncs::sampleLinks(const std::string &vertex,
+        const GraphCSR::vid *links, size_t n, size_t k,
+        std::vector<size_t> &pos)
+{
+    if (!links || msampler.mode() != SampleMode::DEGREE) {
+        msampler.sample(vertex, n, k, pos);
+        return;
+    }
+    const GraphCSR &g = *mcsr;
+    NeighborSampler::Weight degree = [&](size_t i) {
+        return g.degree(links[i]) + 1.0;
+    };
+    msampler.sample(vertex, n, k, pos, &degree);
+}
+
 int StormFuncs::imagesOf(std::string &vertex,
         std::deque<std::string> &keys)
 {
@@ -116,26 +181,209 @@ int StormFuncs::imagesOf(std::string &vertex,
     return 0;
 }
 
+// how many links expand() follows out of a vertex with n of them
+static inline size_t expand_kept(size_t n, int fanout)
+{
+    if (fanout < 0)
+        return n;
+    return fanout > 0 ? std::min(n, (size_t)fanout) : neighbors_kept(n);
+}
+
+// rounds of drawing (each FILTER_GROWTH times the last) before a filtered
+// vertex settles for fewer links than expand_kept()
+static const int FILTER_DRAWS = 3;
+static const size_t FILTER_GROWTH = 4;
+
+int StormFuncs::expand(const std::string &seed, int depth, int fanout,
+        size_t budget, std::deque<std::string> &vertices,
+        std::deque<std::string> *images, const std::string &filter)
+{
+    typedef GraphCSR::vid vid;
+
+    if (seed.length() == 0)
+        throw std::runtime_error("vertex zero length");
+    auto start = std::chrono::steady_clock::now();
+    xstats = ExpandStats();
+    vertices.clear();
+    if (images)
+        images->clear();
+
+    std::deque<std::string> &out = images ? *images : vertices;
+    auto full = [&] { return budget > 0 && out.size() >= budget; };
+
+    // Dedup: a bitmap over vertex numbers with the CSR, else a set of
+    // IDs. Each frontier is a list of IDs, with their numbers alongside
+    // when there is a CSR.
+    std::unordered_set<std::string> seen, seen_images;
+    std::vector<vid> reached, fvids, nextvids;
+    std::deque<std::string> frontier(1, seed), next, vals;
+    if (mcsr) {
+        vid v = mcsr->find(seed);
+        if (v == GraphCSR::NONE || !mcsr->present(v))
+            throw memc_notfound(std::string(__func__) + ": "
+                    + seed + " not in graph");
+        fvids.push_back(v);
+    } else
+        seen.insert(seed);
+
+    // vertices links may lead to
+    std::unique_ptr<Bitmap> keep;
+    if (!filter.empty()) {
+        if (!mcsr || !mattr)
+            throw std::runtime_error(std::string(__func__)
+                    + ": filter needs the graph CSR and attribute index");
+        if (mattr->size() != mcsr->size())
+            throw std::runtime_error(std::string(__func__)
+                    + ": attribute index is not of this graph");
+        keep.reset(new Bitmap(mattr->filter(filter, fvids[0])));
+    }
+    if (mcsr) {
+        vid v = fvids[0];
+        mvisited.resize((mcsr->size() + 63) / 64);
+        mvisited[v >> 6] |= 1ULL << (v & 63);
+        reached.push_back(v);
+    }
+    vertices.push_back(seed);
+    // vertex objects are needed for images, and without the CSR for links
+    const bool fetch = images || !mcsr;
+
+    bool stop = full();
+    // a throw from the store must not leave bits set for the next call
+    auto unvisit = [&] {
+        for (vid v : reached)
+            mvisited[v >> 6] = 0;
+    };
+    try {
+        for (int level = 0; !stop && !frontier.empty(); level++) {
+            const bool last = level >= depth;
+            xstats.levels++;
+            if (fetch) {
+                memc_mget(memc, frontier, vals);
+                xstats.fetches++;
+                xstats.fetched += frontier.size();
+            }
+            next.clear();
+            nextvids.clear();
+            storm::Vertex vobj;
+            std::vector<size_t> pos;
+            std::vector<vid> passed; // links the filter keeps
+            for (size_t i = 0; i < frontier.size() && !stop; i++) {
+                bool have = false;
+                if (fetch) {
+                    vobj.Clear();
+                    have = !vals[i].empty() && vobj.ParseFromString(vals[i]);
+                    if (!have && level == 0 && !mcsr)
+                        throw memc_notfound(std::string(__func__) + ": "
+                                + seed + " not found");
+                }
+                if (images && have) {
+                    for (int j = 0; j < vobj.images_size() && !stop; j++)
+                        if (seen_images.insert(vobj.images(j)).second) {
+                            images->push_back(vobj.images(j));
+                            stop = full();
+                        }
+                }
+                if (stop || last)
+                    continue;
+
+                // the links neighbors() would pick, in the same order
+                if (mcsr) {
+                    vid v = fvids[i];
+                    if (!mcsr->present(v))
+                        continue;
+                    size_t ower, ing;
+                    const vid *fs = mcsr->followers(v, ower);
+                    const vid *gs = mcsr->following(v, ing);
+                    const vid *links = ower > ing ? fs : gs;
+                    size_t n = std::max(ower, ing);
+                    const size_t k = expand_kept(n, fanout);
+                    if (keep) {
+                        // test only drawn links, not all n of them
+                        size_t want = k;
+                        for (int t = 1; ; t++) {
+                            sampleLinks(frontier[i], links, n, want, pos);
+                            passed.clear();
+                            for (size_t j = 0; j < pos.size(); j++)
+                                if (keep->contains(links[pos[j]]))
+                                    passed.push_back(links[pos[j]]);
+                            if (passed.size() >= k || want >= n
+                                    || t == FILTER_DRAWS)
+                                break;
+                            want = std::min(n, want * FILTER_GROWTH);
+                        }
+                        links = passed.data();
+                        n = passed.size();
+                    }
+                    sampleLinks(frontier[i], links, n, k, pos);
+                    for (size_t j = 0; j < pos.size() && !stop; j++) {
+                        vid u = links[pos[j]];
+                        uint64_t bit = 1ULL << (u & 63);
+                        if (mvisited[u >> 6] & bit)
+                            continue;
+                        mvisited[u >> 6] |= bit;
+                        reached.push_back(u);
+                        vertices.push_back(mcsr->name(u));
+                        next.push_back(vertices.back());
+                        nextvids.push_back(u);
+                        stop = !images && full();
+                    }
+                } else if (have) {
+                    const size_t ower = vobj.followers_size();
+                    const size_t ing  = vobj.following_size();
+                    const size_t n = std::max(ower, ing);
+                    sampleLinks(frontier[i], nullptr, n,
+                            expand_kept(n, fanout), pos);
+                    for (size_t j = 0; j < pos.size() && !stop; j++) {
+                        const std::string &u = ower > ing
+                            ? vobj.followers(pos[j]) : vobj.following(pos[j]);
+                        if (!seen.insert(u).second)
+                            continue;
+                        vertices.push_back(u);
+                        next.push_back(u);
+                        stop = !images && full();
+                    }
+                }
+            }
+            frontier.swap(next);
+            fvids.swap(nextvids);
+        }
+    } catch (...) {
+        unvisit();
+        throw;
+    }
+
+    unvisit();
+    xstats.usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
 int StormFuncs::feature(std::string &image_key, int &found)
 {
     storm::Image iobj;
     memc_get(memc, image_key, iobj);
 
-    // get image
     void *data; size_t len;
-    memc_get(memc, iobj.key_data(), &data, len);
-
-    // decode
     cv::Mat img;
-    img = jpeg::JPEGasMat(data, len);
-    if (!img.data || img.cols < 1 || img.rows < 1) {
+    if (mluma && lumaOf(iobj, mplane)) {
+        img = mplane;
+    } else {
+        // get image
+        memc_get(memc, iobj.key_data(), &data, len);
+
+        // decode into the reusable buffer
+        if (!jpeg::JPEGasMat(data, len, mdecoded))
+            mdecoded.mat.release();
+        img = mdecoded.mat;
+        if (!img.data || img.cols < 1 || img.rows < 1) {
+            free(data);
+            throw ocv_vomit(std::string(__func__) + ": "
+                    + "JPEGasMat failed on " + image_key);
+        }
+
         free(data);
-        throw ocv_vomit(std::string(__func__) + ": "
-                + "JPEGasMat failed on " + image_key);
     }
 
-    free(data);
-
     // feature detect
     cv::Ptr<cv::detail::FeaturesFinder> finder;
     cv::detail::ImageFeatures features;
@@ -172,9 +420,12 @@ int StormFuncs::feature(std::string &image_key, int &found)
 }
 
 int StormFuncs::match(std::deque<std::string> &imgkeys,
-        std::deque<cv::detail::MatchesInfo> &matches)
+        std::deque<cv::detail::MatchesInfo> &matches, bool compute)
 {
-    //std::deque<cv::detail::ImageFeatures> features;
+    std::deque<cv::detail::ImageFeatures> features;
+    std::deque<std::string> ids; // image key of each features entry
+
+    matches.clear();
 
     // get all the image features
     size_t i = 0;
@@ -190,9 +441,80 @@ int StormFuncs::match(std::deque<std::string> &imgkeys,
             if (unmarshal(cvfeat, fobj))
                 continue; // ignore..
             cvfeat.img_idx = i++;
-            //features.push_back(cvfeat);
+            features.push_back(cvfeat);
+            ids.push_back(iobj.key_id());
+        }
+    }
+
+    // Pair up images with the lesser key first, so a pair has one key
+    // regardless of the order a request lists its images in.
+    std::deque<std::pair<size_t,size_t>> pairs;
+    std::deque<std::string> pairkeys;
+    for (size_t a = 0; a < features.size(); a++) {
+        for (size_t b = a + 1; b < features.size(); b++) {
+            if (ids[a] == ids[b])
+                continue;
+            if (ids[a] < ids[b])
+                pairs.push_back(std::make_pair(a, b));
+            else
+                pairs.push_back(std::make_pair(b, a));
+            pairkeys.push_back(matchKey(ids[pairs.back().first],
+                        ids[pairs.back().second]));
+        }
+    }
+    if (pairs.empty())
+        return 0;
+
+    // one batched lookup before any matching is done
+    std::deque<std::string> vals;
+    memc_mget(memc, pairkeys, vals);
+    mcstats.lookups += pairs.size();
+
+    cv::Ptr<cv::detail::FeaturesMatcher> matcher;
+    for (size_t p = 0; p < pairs.size(); p++) {
+        const cv::detail::ImageFeatures &f1 = features[pairs[p].first];
+        const cv::detail::ImageFeatures &f2 = features[pairs[p].second];
+        cv::detail::MatchesInfo minfo;
+
+        storm::Matches mobj;
+        if (!vals[p].empty() && mobj.ParseFromString(vals[p])) {
+            mcstats.hits++;
+            unmarshal(minfo, mobj);
+        } else {
+            mcstats.misses++;
+            if (!compute)
+                continue;
+            // a pair without keypoints is stored as matching nothing,
+            // so it hits from then on
+            if (!f1.keypoints.empty() && !f2.keypoints.empty()) {
+                if (matcher.empty())
+                    matcher = new cv::detail::BestOf2NearestMatcher(false,
+                            0.3f);
+                try { (*matcher)(f1, f2, minfo); }
+                catch (cv::Exception &e) {
+                    throw ocv_vomit(std::string(__func__) + ": "
+                            + "matcher failed on " + pairkeys[p]
+                            + ": " + e.what());
+                }
+            }
+            marshal(minfo, mobj, pairkeys[p]);
+            // a failed store only costs the next request a recompute
+            try {
+                memc_set(memc, pairkeys[p], mobj, MATCH_CACHE_TTL);
+                mcstats.stores++;
+            } catch (std::runtime_error &e) {
+                mcstats.failures++;
+            }
+            // answer with what a hit would read back
+            minfo = cv::detail::MatchesInfo();
+            unmarshal(minfo, mobj);
         }
+        minfo.src_img_idx = f1.img_idx;
+        minfo.dst_img_idx = f2.img_idx;
+        matches.push_back(minfo);
     }
+    if (!matcher.empty())
+        matcher->collectGarbage();
 
     return 0;
 }
@@ -205,83 +527,34 @@ int StormFuncs::montage(std::deque<std::string> &image_keys,
     if (image_keys.size() < 4)
         throw ocv_vomit("image set too small");
 
-    // touch the features
-    try { match(image_keys, matches); }
-    catch (memc_notfound &e) { ; }
-
-    // get all images
-    std::deque<cv::Mat> images;
-    images.resize(image_keys.size());
-    for (size_t i = 0; i < images.size(); i++) {
-        storm::Image iobj;
-        memc_get(memc, image_keys[i], iobj);
-        void *data; size_t len;
-        memc_get(memc, iobj.key_data(), &data, len);
-        images[i] = jpeg::JPEGasMat(data, len);
-        free(data);
-    }
-
-    // create canvas and montage within it
-    size_t area = 0;
-    for (cv::Mat &img : images)
-        area += img.rows * img.cols;
-    area <<= 1;
+    // touch the features and whatever pairs are cached; matching the
+    // misses is left to match()'s callers, off the montage path
+    try { match(image_keys, matches, false); }
+    catch (std::runtime_error &e) { ; }
 
-    // 16:9 ratio for canvas
-    cv::Size size;
-    size.height   = (3 * (int)std::sqrt(area)) >> 2;
-    size.width    = area / size.height;
+    // image headers carry the dimensions, so layout needs no pixels
+    std::deque<storm::Image> iobjs(image_keys.size());
+    for (size_t i = 0; i < iobjs.size(); i++)
+        memc_get(memc, image_keys[i], iobjs[i]);
 
-    cv::Rect rect;
-    rect.height = size.height >> 1;
-    rect.width  = size.width >> 1;
-    rect.x      = rect.width >> 2;
-    rect.y      = rect.height >> 2;
-    cv::Mat canvas(cv::Mat::zeros(size.height, size.width,
-                        images[0].type()));
-
-    std::random_device rd;
-    std::mt19937 gen_rand(rd());
-    std::uniform_int_distribution<> dis(0, rect.area());
-    for (cv::Mat &img : images) {
-        auto _scale = std::log1p(img.rows) * 400 / img.rows;
-        cv::Mat scaled;
-        try {
-            cv::resize(img, scaled, cv::Size(), _scale, _scale);
-            auto loc = dis(gen_rand);
-            int x = (loc % rect.width) + rect.x;
-            int y = (loc / rect.width) + rect.y;
-            scaled.copyTo(canvas(cv::Rect(x, y,
-                            scaled.cols, scaled.rows)));
-        } catch (cv::Exception e) {
-            std::cerr << "Error: caught exception"
-                << std::endl;
-            return -1;
-        }
-    }
-
-    cv::Mat montage;
-    try {
-        montage = canvas(rect);
-    } catch (cv::Exception e) {
-        throw ocv_vomit("montage: creating canvas: "
-                + std::string(e.what()));
-    }
-    void *buf;
-    size_t len;
-    if (jpeg::MatToJPEG(montage, &buf, len))
+    std::vector<uchar> jpg;
+    auto t0 = std::chrono::steady_clock::now();
+    if (mstream ? montageBands(iobjs, jpg) : montageCanvas(iobjs, jpg))
         return -1;
+    auto t1 = std::chrono::steady_clock::now();
+    mstats.usec = std::chrono::duration_cast<
+        std::chrono::microseconds>(t1 - t0).count();
+
     std::stringstream ss;
     for (int i = 0; i < 4; i++)
-        ss << dis(gen_rand);
+        ss << dis(gen);
     ss << ".jpg";
-    memc_set(memc, ss.str(), buf, len);
-    free(buf);
-    buf = nullptr;
+    memc_set(memc, ss.str(), jpg.data(), jpg.size());
     montage_key = ss.str();
 
 #if 0
     // test
+    void *buf; size_t len;
     memc_get(memc, ss.str(), &buf, len);
     cv::Mat image = jpeg::JPEGasMat(buf, len);
     free(buf);
@@ -463,6 +736,520 @@ int StormFuncs::do_match(std::deque<cv::detail::ImageFeatures> &features,
 }
 #endif
 
+std::string StormFuncs::matchKey(const std::string &a,
+        const std::string &b)
+{
+    return "matches::" + a + "::" + b + "::" + MATCH_CACHE_VERSION;
+}
+
+inline void StormFuncs::marshal(const cv::detail::MatchesInfo &minfo,
+        storm::Matches &mobj, const std::string &key)
+{
+    mobj.Clear();
+    mobj.set_key_id(key);
+    mobj.set_num_inliers(minfo.num_inliers);
+    mobj.set_confidence(minfo.confidence);
+    if (!minfo.H.empty()) {
+        cv::Mat H;
+        minfo.H.convertTo(H, CV_64F);
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                mobj.add_h(H.at<double>(r, c));
+    }
+    if (!mckeep)
+        return;
+    for (size_t m = 0; m < minfo.matches.size(); m++) {
+        if (m < minfo.inliers_mask.size() && !minfo.inliers_mask[m])
+            continue;
+        mobj.add_inliers(minfo.matches[m].queryIdx);
+        mobj.add_inliers(minfo.matches[m].trainIdx);
+    }
+}
+
+inline void StormFuncs::unmarshal(cv::detail::MatchesInfo &minfo,
+        const storm::Matches &mobj)
+{
+    minfo.num_inliers = mobj.num_inliers();
+    minfo.confidence = mobj.confidence();
+    if (mobj.h_size() == 9) {
+        minfo.H.create(3, 3, CV_64F);
+        for (int e = 0; e < 9; e++)
+            minfo.H.at<double>(e / 3, e % 3) = mobj.h(e);
+    }
+    // only inliers were kept, so the mask is all set
+    const int n = mobj.inliers_size() >> 1;
+    minfo.matches.resize(n);
+    minfo.inliers_mask.assign(n, 1);
+    for (int m = 0; m < n; m++) {
+        minfo.matches[m].queryIdx = mobj.inliers(2 * m);
+        minfo.matches[m].trainIdx = mobj.inliers(2 * m + 1);
+    }
+}
+
+// Original implementation: composite every tile into a canvas twice
+// the summed tile area, crop the middle, encode the crop. Kept for
+// comparison against montageBands.
+int StormFuncs::montageCanvas(std::deque<storm::Image> &iobjs,
+        std::vector<uchar> &jpg)
+{
+    std::deque<cv::Mat> images;
+    images.resize(iobjs.size());
+
+    size_t held = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        thumbnail(iobjs[i], MONTAGE_TILE_ROWS, images[i]);
+        held += images[i].total() * images[i].elemSize();
+    }
+
+    // create canvas and montage within it
+    size_t area = 0;
+    for (cv::Mat &img : images)
+        area += img.rows * img.cols;
+    area <<= 1;
+
+    // 16:9 ratio for canvas
+    cv::Size size;
+    size.height   = (3 * (int)std::sqrt(area)) >> 2;
+    size.width    = area / size.height;
+
+    cv::Rect rect;
+    rect.height = size.height >> 1;
+    rect.width  = size.width >> 1;
+    rect.x      = rect.width >> 2;
+    rect.y      = rect.height >> 2;
+    cv::Mat canvas(cv::Mat::zeros(size.height, size.width,
+                        images[0].type()));
+    held += canvas.total() * canvas.elemSize();
+
+    std::random_device rd;
+    std::mt19937 gen_rand(rd());
+    std::uniform_int_distribution<> dis(0, rect.area());
+    for (cv::Mat &img : images) {
+        auto _scale = (double)MONTAGE_TILE_ROWS / img.rows;
+        cv::Mat scaled;
+        try {
+            cv::resize(img, scaled, cv::Size(), _scale, _scale);
+            auto loc = dis(gen_rand);
+            int x = (loc % rect.width) + rect.x;
+            int y = (loc / rect.width) + rect.y;
+            scaled.copyTo(canvas(cv::Rect(x, y,
+                            scaled.cols, scaled.rows)));
+        } catch (cv::Exception e) {
+            std::cerr << "Error: caught exception"
+                << std::endl;
+            return -1;
+        }
+    }
+    mstats.peak_bytes = held;
+
+    cv::Mat montage;
+    try {
+        montage = canvas(rect);
+    } catch (cv::Exception e) {
+        throw ocv_vomit("montage: creating canvas: "
+                + std::string(e.what()));
+    }
+    if (jpeg::MatToJPEG(montage, jpg))
+        return -1;
+    return 0;
+}
+
+// Pack tiles with mlayout, then rasterize the output a band of rows at a
+// time and stream each band to the encoder. A tile is decoded when the first
+// band touches it and dropped once the bands have passed it, so only
+// a few bands and the tiles crossing them are ever held in memory.
+// With more than one thread each band is encoded on its own, as one
+// restart interval, by a pool of encoders and the strips are joined at
+// the end (jpeg::joinRestartStrips); the montage then also decodes in
+// parallel.
+int StormFuncs::montageBands(std::deque<storm::Image> &iobjs,
+        std::vector<uchar> &jpg)
+{
+    struct tile {
+        size_t idx;
+        cv::Rect r; // placement within the output
+        cv::Mat pix;
+        bool done;  // pix is ready
+        tile(void) : idx(0), done(false) { ; }
+    };
+    std::deque<tile> tiles(iobjs.size());
+
+    std::vector<cv::Size> sizes(iobjs.size());
+    for (size_t i = 0; i < sizes.size(); i++) {
+        const storm::Image &iobj = iobjs[i];
+        if (iobj.width() == 0 || iobj.height() == 0)
+            throw ocv_vomit(std::string(__func__) + ": "
+                    + "no dimensions for " + iobj.key_id());
+        sizes[i] = cv::Size(iobj.width(), iobj.height());
+    }
+
+    std::vector<cv::Rect> rects;
+    cv::Size out;
+    try {
+        out = mlayout.layout(sizes, rects);
+    } catch (std::runtime_error &e) {
+        throw ocv_vomit("montage: layout: " + std::string(e.what()));
+    }
+    for (size_t i = 0; i < tiles.size(); i++) {
+        tiles[i].idx = i;
+        tiles[i].r = rects[i];
+    }
+
+    const int quality = 95;
+    const int nbands = (out.height + MONTAGE_BAND_ROWS - 1)
+        / MONTAGE_BAND_ROWS;
+    // restart intervals (DRI) hold at most 65535 MCUs
+    const int mpr = (out.width + 15) / 16;
+    const size_t nenc = (mthreads > 1 && nbands > 1
+            && out.width <= 0xFFFF && out.height <= 0xFFFF
+            && MONTAGE_BAND_ROWS / 16 * mpr <= 0xFFFF)
+        ? (size_t)std::min(mthreads, nbands) : 0;
+
+    jpeg::JpegStreamEncoder enc;
+    if (!nenc && !enc.open(out.width, out.height, 3, jpg, quality))
+        return -1;
+
+    // Tiles are fetched, decoded and scaled by a pool of workers and
+    // composited here as each band comes up. Workers claim tiles in
+    // raster order and stay within MONTAGE_AHEAD_ROWS of the band being
+    // encoded, which bounds how many prepared tiles are held.
+    std::vector<size_t> order(tiles.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            const cv::Rect &ra = tiles[a].r, &rb = tiles[b].r;
+            return ra.y < rb.y || (ra.y == rb.y && ra.x < rb.x); });
+
+    std::mutex mtx;
+    std::condition_variable ready, advance;
+    std::atomic<size_t> next(0);
+    int encY = 0; // first output row not yet encoded
+    bool failed = false;
+    std::string why;
+
+    // band buffers: one per encoder and one being composited
+    std::vector<cv::Mat> spare(nenc + 1);
+    for (cv::Mat &b : spare)
+        b.create(MONTAGE_BAND_ROWS, out.width, CV_8UC3);
+    size_t live = 0, peak = 0;
+    const size_t bandbytes = spare.size()
+        * spare[0].total() * spare[0].elemSize();
+
+    // bands composited and waiting for an encoder
+    struct strip {
+        int band;
+        cv::Mat buf; // a whole band buffer
+        int rows;
+    };
+    std::deque<strip> todo;
+    std::vector< std::vector<uchar> > strips(nenc ? nbands : 0);
+    std::mutex emtx;
+    std::condition_variable queued, freed;
+    bool edone = false, efailed = false;
+
+    auto encoder = [&](void) {
+        for (;;) {
+            strip job;
+            {
+                std::unique_lock<std::mutex> lk(emtx);
+                queued.wait(lk, [&] { return edone || !todo.empty(); });
+                if (todo.empty())
+                    return;
+                job = todo.front();
+                todo.pop_front();
+            }
+            jpeg::JpegStreamEncoder e;
+            bool ok = e.open(out.width, job.rows, 3, strips[job.band],
+                    quality, 0, MONTAGE_BAND_ROWS / 16)
+                && e.write(job.buf.rowRange(0, job.rows)) && e.close();
+            std::lock_guard<std::mutex> lk(emtx);
+            efailed = efailed || !ok;
+            spare.push_back(job.buf);
+            freed.notify_all();
+        }
+    };
+
+    auto worker = [&](memcached_st *mc) {
+        // the tiles are the parallelism; no strip threads per decode
+        jpeg::setThreadParallelDecode(false);
+        jpeg::PooledMat decoded; // reused for each tile this worker takes
+        size_t k;
+        while ((k = next++) < order.size()) {
+            tile &t = tiles[order[k]];
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                advance.wait(lk, [&] {
+                        return failed || t.r.y < encY + MONTAGE_AHEAD_ROWS; });
+                if (failed)
+                    break;
+            }
+            cv::Mat pix;
+            try {
+                cv::Mat img;
+                thumbnail(mc, iobjs[t.idx], t.r.height, img, &decoded);
+                cv::resize(img, pix, t.r.size(), 0, 0, cv::INTER_AREA);
+            } catch (std::exception &e) {
+                std::lock_guard<std::mutex> lk(mtx);
+                failed = true;
+                why = "montage: preparing tile: " + std::string(e.what());
+                ready.notify_all();
+                advance.notify_all();
+                break;
+            }
+            std::lock_guard<std::mutex> lk(mtx);
+            t.pix = pix;
+            t.done = true;
+            live += pix.total() * pix.elemSize();
+            peak = std::max(peak, live + bandbytes);
+            ready.notify_all();
+        }
+    };
+
+    size_t nworkers = std::max(1, std::min(mthreads, (int)tiles.size()));
+    while (mclones.size() < nworkers) {
+        memcached_st *mc = memcached_clone(NULL, memc);
+        if (!mc)
+            break;
+        mclones.push_back(mc);
+    }
+    nworkers = std::min(nworkers, mclones.size());
+    if (nworkers == 0)
+        throw ocv_vomit(std::string(__func__) + ": memcached_clone failed");
+
+    // the workers and encoders are stopped and joined however this
+    // returns; encoders finish the bands already queued
+    std::vector<std::thread> pool, encoders;
+    auto stop = [&](void) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            failed = true;
+            advance.notify_all();
+        }
+        for (std::thread &th : pool)
+            th.join();
+        pool.clear();
+        {
+            std::lock_guard<std::mutex> lk(emtx);
+            edone = true;
+            queued.notify_all();
+        }
+        for (std::thread &th : encoders)
+            th.join();
+        encoders.clear();
+    };
+    struct joiner {
+        std::function<void(void)> fn;
+        ~joiner(void) { fn(); }
+    } joined = { stop };
+    for (size_t i = 0; i < nworkers; i++)
+        pool.push_back(std::thread(worker, mclones[i]));
+    for (size_t i = 0; i < nenc; i++)
+        encoders.push_back(std::thread(encoder));
+
+    for (int y0 = 0; y0 < out.height; y0 += MONTAGE_BAND_ROWS) {
+        const int rows = std::min(MONTAGE_BAND_ROWS, out.height - y0);
+        const cv::Rect brect(0, y0, out.width, rows);
+        cv::Mat buf;
+        {
+            std::unique_lock<std::mutex> lk(emtx);
+            freed.wait(lk, [&] { return !spare.empty(); });
+            buf = spare.back();
+            spare.pop_back();
+        }
+        cv::Mat band = buf.rowRange(0, rows);
+        band.setTo(cv::Scalar::all(0));
+
+        for (size_t k : order) {
+            tile &t = tiles[k];
+            if (t.r.y >= y0 + rows)
+                break;
+            cv::Rect isect = t.r & brect;
+            if (isect.area() == 0)
+                continue;
+            {
+                std::unique_lock<std::mutex> lk(mtx);
+                ready.wait(lk, [&] { return failed || t.done; });
+                if (!t.done)
+                    throw ocv_vomit(why);
+            }
+            cv::Rect src(isect.x - t.r.x, isect.y - t.r.y,
+                    isect.width, isect.height);
+            cv::Rect dst(isect.x, isect.y - y0,
+                    isect.width, isect.height);
+            t.pix(src).copyTo(band(dst));
+            if (t.r.y + t.r.height <= y0 + rows) {
+                std::lock_guard<std::mutex> lk(mtx);
+                live -= t.pix.total() * t.pix.elemSize();
+                t.pix.release();
+            }
+        }
+
+        if (nenc) {
+            std::lock_guard<std::mutex> lk(emtx);
+            todo.push_back(strip{ y0 / MONTAGE_BAND_ROWS, buf, rows });
+            queued.notify_one();
+        } else {
+            if (!enc.write(band))
+                return -1;
+            std::lock_guard<std::mutex> lk(emtx);
+            spare.push_back(buf);
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        encY = y0 + rows;
+        advance.notify_all();
+    }
+    stop();
+    mstats.peak_bytes = std::max(peak, bandbytes);
+
+    if (nenc)
+        return !efailed && jpeg::joinRestartStrips(strips, out.height, jpg)
+            ? 0 : -1;
+    return enc.close() ? 0 : -1;
+}
+
+// Fill out with the image's grayscale plane, making and storing it if
+// there is none yet. On a miss the JPEG is decoded gray at the coarsest
+// DCT scale that still covers LUMA_SIZE, into mdecoded, which out may
+// then be a view of. The store is best effort. False if the JPEG won't
+// decode.
+bool StormFuncs::lumaOf(const storm::Image &iobj, cv::Mat &out)
+{
+    const std::string key(luma::key(iobj.key_id(), LUMA_SIZE));
+    void *data; size_t len;
+    bool ok = false;
+
+    lstats.lookups++;
+    auto t0 = std::chrono::steady_clock::now();
+    try {
+        memc_get(memc, key, &data, len);
+        ok = luma::unpack(data, len, out);
+        free(data);
+    } catch (memc_notfound &e) { ; }
+    auto t1 = std::chrono::steady_clock::now();
+    if (ok) {
+        lstats.hits++;
+        lstats.hit_usec += std::chrono::duration_cast<
+            std::chrono::microseconds>(t1 - t0).count();
+        return true;
+    }
+    lstats.misses++;
+
+    unsigned int longest = std::max(iobj.width(), iobj.height());
+    int denom = 8;
+    while (denom > 1 && longest / denom < (unsigned int)LUMA_SIZE)
+        denom >>= 1;
+
+    memc_get(memc, iobj.key_data(), &data, len);
+    ok = jpeg::decodeJPEG(data, len, mdecoded.mat, &mdecoded, denom, true);
+    free(data);
+    if (!ok || !mdecoded.mat.data)
+        return false;
+
+    std::vector<uchar> buf;
+    luma::pack(mdecoded.mat, LUMA_SIZE, buf, true,
+            iobj.width(), iobj.height(), &out);
+    t1 = std::chrono::steady_clock::now();
+    lstats.miss_usec += std::chrono::duration_cast<
+        std::chrono::microseconds>(t1 - t0).count();
+
+    if (cache_set(memc, key, buf.data(), buf.size()))
+        lstats.stores++;
+    else
+        lstats.failures++;
+    return true;
+}
+
+// smallest stored thumbnail at least 'rows' tall, or 0 when the image
+// itself is no taller than that
+int StormFuncs::thumbRows(const storm::Image &iobj, int rows)
+{
+    for (int t : THUMB_ROWS)
+        if (t >= rows && (unsigned int)t < iobj.height())
+            return t;
+    return 0;
+}
+
+std::string StormFuncs::thumbKey(const std::string &key, int rows)
+{
+    return key + "::thumb::" + std::to_string(rows);
+}
+
+// largest DCT scaling that still leaves at least 'rows' rows
+static inline int scale_denom_for(unsigned int height, int rows)
+{
+    int denom = 8;
+    while (denom > 1 && (int)(height / denom) < rows)
+        denom >>= 1;
+    return denom;
+}
+
+// Fill out with a version of the image at least 'rows' tall. Uses the
+// smallest stored thumbnail that is large enough; on a miss, decodes
+// the original at reduced scale and stores the thumbnail for next time.
+void StormFuncs::thumbnail(memcached_st *mc, const storm::Image &iobj,
+        int rows, cv::Mat &out, jpeg::PooledMat *pm)
+{
+    void *data; size_t len;
+    std::unique_ptr<void, void (*)(void*)> hold(nullptr, free);
+    auto decode = [&](int denom) -> cv::Mat {
+        if (!pm)
+            return jpeg::JPEGasMat(data, len, denom);
+        if (!jpeg::JPEGasMat(data, len, *pm, denom))
+            pm->mat.release();
+        return pm->mat;
+    };
+
+    int trows = thumbRows(iobj, rows);
+    if (trows > 0) {
+        const std::string key(thumbKey(iobj.key_id(), trows));
+        try {
+            memc_get(mc, key, &data, len);
+            hold.reset(data);
+            out = decode(1);
+            hold.reset();
+            if (out.data)
+                return;
+        } catch (memc_notfound &e) { ; }
+    }
+
+    // no thumbnail (or the image is already small): scaled decode
+    memc_get(mc, iobj.key_data(), &data, len);
+    hold.reset(data);
+    int want = (trows > 0 ? trows : rows);
+    out = decode(scale_denom_for(iobj.height(), want));
+    hold.reset();
+    if (!out.data || out.cols < 1 || out.rows < 1)
+        throw ocv_vomit(std::string(__func__) + ": "
+                + "JPEGasMat failed on " + iobj.key_id());
+
+    // the decode is paid for; keep a plane for feature extraction too.
+    // Images too small for a thumbnail come through here every time,
+    // so theirs is only stored once.
+    const std::string lkey(luma::key(iobj.key_id(), LUMA_SIZE));
+    if (mluma && (int)std::max(out.cols, out.rows) >= LUMA_SIZE
+            && (trows > 0 || !memc_exists(mc, lkey))) {
+        std::vector<uchar> buf;
+        luma::pack(out, LUMA_SIZE, buf, true, iobj.width(), iobj.height());
+        if (cache_set(mc, lkey, buf.data(), buf.size()))
+            lstats.stores++;
+        else
+            lstats.failures++;
+    }
+
+    if (trows == 0)
+        return;
+
+    double s = (double)trows / out.rows;
+    if (s < 1.) {
+        cv::Mat scaled;
+        cv::resize(out, scaled, cv::Size(), s, s, cv::INTER_AREA);
+        out = scaled;
+    }
+    std::vector<uchar> jpg;
+    if (jpeg::MatToJPEG(out, jpg))
+        return; // not fatal; we have the pixels
+    cache_set(mc, thumbKey(iobj.key_id(), trows), jpg.data(), jpg.size());
+}
+
 inline int StormFuncs::unmarshal(cv::detail::ImageFeatures &cv_feat,
         const storm::ImageFeatures &fobj)
 {
@@ -778,15 +1565,66 @@ int memc_get(memcached_st *memc, const std::string &key,
     return 0;
 }
 
+size_t memc_mget(memcached_st *memc, const std::deque<std::string> &keys,
+        std::deque<std::string> &vals)
+{
+    memcached_return_t mret;
+    size_t found = 0;
+
+    if (!memc)
+        throw std::runtime_error(std::string(__func__) + ": "
+                + "memc arg is null");
+    vals.clear();
+    vals.resize(keys.size());
+    if (keys.empty())
+        return 0;
+
+    std::vector<const char*> names(keys.size());
+    std::vector<size_t> lens(keys.size());
+    std::map<std::string, std::deque<size_t>> index;
+    for (size_t i = 0; i < keys.size(); i++) {
+        names[i] = keys[i].c_str();
+        lens[i] = keys[i].length();
+        index[keys[i]].push_back(i);
+    }
+
+    mret = memcached_mget(memc, names.data(), lens.data(), keys.size());
+    if (mret != MEMCACHED_SUCCESS)
+        throw std::runtime_error(std::string(__func__) + ": "
+                + "mget failed: " + memcached_strerror(memc, mret));
+
+    memcached_result_st *result = memcached_result_create(memc, NULL);
+    if (!result)
+        throw std::runtime_error(std::string(__func__) + ": "
+                + "out of memory");
+    while (memcached_fetch_result(memc, result, &mret)) {
+        if (mret != MEMCACHED_SUCCESS)
+            break;
+        std::string key(memcached_result_key_value(result),
+                memcached_result_key_length(result));
+        auto iter = index.find(key);
+        if (iter == index.end())
+            continue;
+        for (size_t i : iter->second) {
+            vals[i].assign(memcached_result_value(result),
+                    memcached_result_length(result));
+            found++;
+        }
+    }
+    memcached_result_free(result);
+
+    return found;
+}
+
 int memc_set(memcached_st *memc, const std::string &key,
-        const void *val, size_t len)
+        const void *val, size_t len, time_t expire)
 {
     memcached_return_t mret;
     if (!memc || !val)
         throw std::runtime_error(std::string(__func__) + ": "
                 + "invalid args");
     mret = memcached_set(memc, key.c_str(), key.length(),
-            (char*)val, len, 0, 0);
+            (char*)val, len, expire, 0);
     if (!(mret == MEMCACHED_SUCCESS))
         throw std::runtime_error(std::string(__func__) + ": "
                 + "failed to fetch " + key);
@@ -794,7 +1632,7 @@ int memc_set(memcached_st *memc, const std::string &key,
 }
 
 int memc_set(memcached_st *memc, const std::string &key,
-        const google::protobuf::MessageLite &msg)
+        const google::protobuf::MessageLite &msg, time_t expire)
 {
     size_t len(0);
     void *val(nullptr);
@@ -807,15 +1645,14 @@ int memc_set(memcached_st *memc, const std::string &key,
     if (!(val = malloc(len)))
         throw std::runtime_error(std::string(__func__) + ": "
                 + "out of memory");
+    std::unique_ptr<void, void (*)(void*)> hold(val, free);
 
     if (!msg.SerializeToArray(val, len)) {
         throw protobuf_parsefail(std::string(__func__) + ": "
                 + "failed to serialize object " + key);
     }
 
-    int ret = memc_set(memc, key, val, len);
-    free(val);
-    return ret;
+    return memc_set(memc, key, val, len, expire);
 }
 
 int memc_exists(memcached_st *memc,
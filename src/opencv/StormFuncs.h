@@ -5,15 +5,26 @@
 #pragma once
 
 #include <stdlib.h>
+#include <time.h>
+#include <atomic>
 #include <deque>
+#include <memory>
+#include <vector>
 #include <stdexcept>
 #include <random>
+#include <algorithm>
 #include <exception>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/stitching/detail/matchers.hpp>
 
+#include "AttrIndex.hpp"
 #include "Config.hpp"
+#include "GraphCSR.hpp"
+#include "LumaPlane.hpp"
+#include "MontageLayout.hpp"
+#include "NeighborSampler.hpp"
+#include "cv/bufpool.hpp"
 #include <google/protobuf/message_lite.h>
 
 #include "Objects.pb.h" // generated
@@ -27,6 +38,31 @@ const char CMD_ARG_FEATURE[] = "feature";
 const char CMD_ARG_USER[]    = "user";
 const char CMD_ARG_MONTAGE[] = "montage";
 
+// Pairwise match results are cached in the object store. Bump the
+// version whenever the feature finder or matcher parameters change so
+// results from an older pipeline are never reused.
+const char   MATCH_CACHE_VERSION[] = "surfgpu-4000-1-6.bo2n-0.3";
+const time_t MATCH_CACHE_TTL       = (24 * 60 * 60); // seconds
+
+// Montage tiles are scaled to this many rows (the layout's preferred
+// row height; justified rows may be a little shorter or taller).
+// Reduced-size encodings of each image are kept under
+// <key>::thumb::<rows> for these row counts and montage uses the
+// smallest one at least as tall as a tile.
+const int MONTAGE_TILE_ROWS = 400;
+const int THUMB_ROWS[]      = { 200, 400, 800 };
+// Longer side of the grayscale planes kept under <key>::luma::<size>
+// (see LumaPlane.hpp). At 960 a raw plane stays under memcached's
+// default 1 MB item limit.
+const int LUMA_SIZE = 960;
+// rows of output composited and handed to the encoder at a time; a
+// multiple of 16, the color MCU height, so each band can be a restart
+// interval of its own
+const int MONTAGE_BAND_ROWS = 64;
+// how far below the band being encoded tile workers may prepare tiles
+// (must be at least MONTAGE_BAND_ROWS)
+const int MONTAGE_AHEAD_ROWS = 2 * MONTAGE_TILE_ROWS;
+
 int init_log(const char *prefix);
 
 extern FILE *logfp;
@@ -61,20 +97,99 @@ class ocv_vomit : public std::runtime_error
         { ; }
 };
 
+// failures are results computed but not stored
+struct MatchCacheStats
+{
+    size_t lookups, hits, misses, stores, failures;
+    MatchCacheStats(void)
+        : lookups(0), hits(0), misses(0), stores(0), failures(0) { ; }
+    inline float hitRate(void) const
+        { return lookups ? (float)hits / lookups : 0.f; }
+};
+
+// usec are wall time spent getting pixels: reading planes on hits,
+// fetching and decoding the JPEG on misses. Montage tile workers also
+// store planes, so stores and failures (planes made but not stored)
+// are atomic.
+struct LumaCacheStats
+{
+    size_t lookups, hits, misses;
+    std::atomic<size_t> stores, failures;
+    long hit_usec, miss_usec;
+    LumaCacheStats(void)
+        : lookups(0), hits(0), misses(0), stores(0), failures(0),
+        hit_usec(0), miss_usec(0) { ; }
+    inline float hitRate(void) const
+        { return lookups ? (float)hits / lookups : 0.f; }
+    // hits priced at the average miss, less what they did cost
+    inline long usecSaved(void) const
+        { return misses ? (long)hits * miss_usec / (long)misses - hit_usec : 0; }
+};
+
+// measurements of the last montage built
+struct MontageStats
+{
+    size_t peak_bytes; // most pixel memory held at once
+    long usec;         // layout, composite and encode
+    MontageStats(void) : peak_bytes(0), usec(0) { ; }
+};
+
+// measurements of the last expand()
+struct ExpandStats
+{
+    int levels;      // frontiers processed, the seed's included
+    size_t fetches;  // object store round trips
+    size_t fetched;  // vertex objects asked for
+    long usec;
+    ExpandStats(void) : levels(0), fetches(0), fetched(0), usec(0) { ; }
+};
+
 class StormFuncs
 {
     public:
         StormFuncs(void);
+        ~StormFuncs(void);
         int connect(std::string &servers);
         // graph-based functions
         int neighbors(std::string &vertex,
                 std::deque<std::string> &others);
         int imagesOf(std::string &vertex,
                 std::deque<std::string> &keys);
+        // answer neighbors() from this adjacency instead of fetching
+        // vertex objects; null goes back to the object store
+        inline void graphCSR(std::shared_ptr<const GraphCSR> g)
+            { mcsr = g; }
+        // which links neighbors() and expand() follow; set a seed per
+        // request for reproducible walks (default: the first ones)
+        inline NeighborSampler& neighborSampler(void) { return msampler; }
+        // attribute bitmaps over mcsr's vertex numbers, for filters
+        inline void attrIndex(std::shared_ptr<const AttrIndex> a)
+            { mattr = a; }
+        // Breadth-first search out of seed for up to depth hops, each
+        // vertex passing on at most fanout of its links (0: as many as
+        // neighbors() would, <0: all). vertices gets the seed and
+        // everything reached, in BFS order; with images, the images of
+        // those vertices, without duplicates. Stops early once budget
+        // images (or vertices, without images) are out; 0 is no limit.
+        // One object store round trip per level. A filter (see
+        // AttrIndex::filter, with @ meaning the seed) drops picked
+        // links to vertices outside it, picking more while too few
+        // pass; the count kept follows the unfiltered degree. It needs
+        // both graphCSR() and attrIndex().
+        int expand(const std::string &seed, int depth, int fanout,
+                size_t budget, std::deque<std::string> &vertices,
+                std::deque<std::string> *images = nullptr,
+                const std::string &filter = std::string());
+        inline const ExpandStats& expandStats(void) const
+            { return xstats; }
         // image-processing
         int feature(std::string &image_key, int &found);
+        // Pairwise matches of the images' features, cached pairs read
+        // in one batch first; without compute, misses are left out
+        // rather than matched and stored.
         int match(std::deque<std::string> &imgkeys,
-                std::deque<cv::detail::MatchesInfo> &matches);
+                std::deque<cv::detail::MatchesInfo> &matches,
+                bool compute = true);
         int montage(std::deque<std::string> &imgs,
                 std::string &montage_key);
 
@@ -82,9 +197,89 @@ class StormFuncs
 
         inline memcached_st* getMemc(void) { return memc; }
 
+        // pairwise match cache
+        inline const MatchCacheStats& matchCacheStats(void) const
+            { return mcstats; }
+        inline void matchCacheInliers(bool keep) { mckeep = keep; }
+
+        // Feature extraction works on LUMA_SIZE grayscale planes, made
+        // on first use and read back after. Off by default: features
+        // of a downscaled plane differ from full-size ones, so bump
+        // MATCH_CACHE_VERSION before enabling on a populated store.
+        inline void lumaCache(bool on) { mluma = on; }
+        inline const LumaCacheStats& lumaCacheStats(void) const
+            { return lstats; }
+
+        // false selects the original whole-canvas montage
+        inline void montageStreaming(bool on) { mstream = on; }
+        inline const MontageStats& montageStats(void) const
+            { return mstats; }
+        // tile placement for the streaming montage; set seed for
+        // reproducible layouts
+        inline MontageLayout& montageLayout(void) { return mlayout; }
+        // tile workers for the streaming montage, and threads encoding
+        // its bands (default: one per core)
+        inline void montageThreads(int n) { mthreads = std::max(1, n); }
+
     private:
         memcached_st *memc;
 
+        std::shared_ptr<const GraphCSR> mcsr;
+        std::shared_ptr<const AttrIndex> mattr;
+        NeighborSampler msampler;
+        // positions of the k of n links to follow out of vertex; links
+        // are mcsr's, to weigh by degree, or null
+        void sampleLinks(const std::string &vertex,
+                const GraphCSR::vid *links, size_t n, size_t k,
+                std::vector<size_t> &pos);
+
+        ExpandStats xstats;
+        // vertices of mcsr expand() has reached; cleared bit by bit
+        // after each call so a search costs what it touches
+        std::vector<uint64_t> mvisited;
+
+        MatchCacheStats mcstats;
+        bool mckeep; // also cache the inlier list
+
+        bool mluma;
+        LumaCacheStats lstats;
+        bool lumaOf(const storm::Image &iobj, cv::Mat &out);
+
+        static std::string matchKey(const std::string &a,
+                const std::string &b);
+        inline void marshal(const cv::detail::MatchesInfo &minfo,
+                storm::Matches &mobj, const std::string &key);
+        inline void unmarshal(cv::detail::MatchesInfo &minfo,
+                const storm::Matches &mobj);
+
+        bool mstream;
+        MontageStats mstats;
+        MontageLayout mlayout;
+        int mthreads;
+
+        int montageCanvas(std::deque<storm::Image> &iobjs,
+                std::vector<uchar> &jpg);
+        int montageBands(std::deque<storm::Image> &iobjs,
+                std::vector<uchar> &jpg);
+        // tile worker connections, cloned from memc as first needed
+        std::vector<memcached_st*> mclones;
+
+        static int thumbRows(const storm::Image &iobj, int rows);
+        static std::string thumbKey(const std::string &key, int rows);
+        // mc lets tile workers use their own connection; with pm the
+        // decode lands in that pooled buffer and out may be a view of it
+        void thumbnail(memcached_st *mc, const storm::Image &iobj,
+                int rows, cv::Mat &out, jpeg::PooledMat *pm = nullptr);
+        inline void thumbnail(const storm::Image &iobj, int rows,
+                cv::Mat &out) { thumbnail(memc, iobj, rows, out); }
+
+        // feature()'s and lumaOf()'s decodes. A member, not
+        // thread_local: a PooledMat must not outlive the thread's
+        // BufferPool it returns its buffer to, and thread_locals are
+        // destroyed in reverse order of construction.
+        jpeg::PooledMat mdecoded;
+        cv::Mat mplane; // feature()'s luma plane, may view mdecoded
+
         std::random_device rd;
         std::mt19937 gen;
         std::uniform_int_distribution<> dis;
@@ -181,11 +376,16 @@ int memc_get(memcached_st *memc, const std::string &key,
 int memc_get(memcached_st *memc, const std::string &key,
         /* output */ void **val, size_t &len);
 
+// Fetch many keys in one round trip. vals is resized to match keys;
+// keys not found are left as empty strings. Returns the number found.
+size_t memc_mget(memcached_st *memc, const std::deque<std::string> &keys,
+        /* output */ std::deque<std::string> &vals);
+
 int memc_set(memcached_st *memc, const std::string &key,
-        const void *val, size_t len);
+        const void *val, size_t len, time_t expire = 0);
 
 int memc_set(memcached_st *memc, const std::string &key,
-        const google::protobuf::MessageLite &msg);
+        const google::protobuf::MessageLite &msg, time_t expire = 0);
 
 int memc_exists(memcached_st *memc,
         const std::string &key);
@@ -0,0 +1,146 @@
+/**
+ * batch.cpp
+ */
+
+#include "batch.hpp"
+#include "bufpool.hpp"
+#include "grfmt_jpeg.hpp"
+
+#include <algorithm>
+
+namespace jpeg
+{
+
+DecodeBatch::DecodeBatch(int threads)
+    : m_gen(0), m_active(0), m_quit(false),
+      m_items(0), m_out(0), m_cb(0), m_ok(0), m_steals(0)
+{
+    if (threads < 1)
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads; i++)
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue));
+    for (int i = 0; i < threads; i++)
+        m_threads.push_back(std::thread(&DecodeBatch::worker, this, i));
+}
+
+DecodeBatch::~DecodeBatch()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_lock);
+        m_quit = true;
+        m_start.notify_all();
+    }
+    for (std::thread &t : m_threads)
+        t.join();
+}
+
+size_t DecodeBatch::decode(const std::vector<DecodeItem> &items,
+        std::vector<cv::Mat> &out)
+{
+    out.clear();
+    out.resize(items.size());
+    return run(items, &out, 0);
+}
+
+size_t DecodeBatch::decode(const std::vector<DecodeItem> &items,
+        const Callback &cb)
+{
+    return run(items, 0, &cb);
+}
+
+size_t DecodeBatch::run(const std::vector<DecodeItem> &items,
+        std::vector<cv::Mat> *out, const Callback *cb)
+{
+    std::lock_guard<std::mutex> rlk(m_run);
+    if (items.empty())
+        return 0;
+
+    // contiguous blocks keep each worker's items adjacent in memory
+    const size_t n = m_queues.size();
+    const size_t per = (items.size() + n - 1) / n;
+    for (size_t q = 0; q < n; q++) {
+        std::lock_guard<std::mutex> qlk(m_queues[q]->lock);
+        for (size_t i = q * per; i < std::min(items.size(), (q + 1) * per); i++)
+            m_queues[q]->idx.push_back(i);
+    }
+
+    std::unique_lock<std::mutex> lk(m_lock);
+    m_items = &items;
+    m_out = out;
+    m_cb = cb;
+    m_ok = 0;
+    m_active = (int)n;
+    m_gen++;
+    m_start.notify_all();
+    m_done.wait(lk, [&] { return m_active == 0; });
+    m_items = 0;
+    m_out = 0;
+    m_cb = 0;
+    return m_ok;
+}
+
+// own queue from the front, then others' from the back
+bool DecodeBatch::next(int id, size_t &i)
+{
+    const size_t n = m_queues.size();
+    for (size_t k = 0; k < n; k++) {
+        Queue &q = *m_queues[(id + k) % n];
+        std::lock_guard<std::mutex> lk(q.lock);
+        if (q.idx.empty())
+            continue;
+        if (k == 0) {
+            i = q.idx.front();
+            q.idx.pop_front();
+        } else {
+            i = q.idx.back();
+            q.idx.pop_back();
+            m_steals++;
+        }
+        return true;
+    }
+    return false;
+}
+
+void DecodeBatch::worker(int id)
+{
+    PooledMat scratch; // per-worker pixels for the callback form
+    uint64_t seen = 0;
+
+    // the batch already keeps every core busy
+    setThreadParallelDecode(false);
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lk(m_lock);
+            m_start.wait(lk, [&] { return m_quit || m_gen != seen; });
+            if (m_quit)
+                return;
+            seen = m_gen;
+        }
+
+        size_t i;
+        while (next(id, i)) {
+            const DecodeItem &it = (*m_items)[i];
+            cv::Mat &mat = m_out ? (*m_out)[i] : scratch.mat;
+            bool ok;
+            try {
+                ok = decodeJPEG(it.data, it.len, mat, m_out ? 0 : &scratch,
+                        it.scale_denom, it.gray, it.roi);
+            } catch (std::exception &e) {
+                ok = false; // e.g. out of memory for a huge image
+            }
+            if (!ok)
+                mat.release();
+            if (m_cb)
+                (*m_cb)(i, mat);
+            if (ok)
+                m_ok++;
+        }
+
+        std::lock_guard<std::mutex> lk(m_lock);
+        if (--m_active == 0)
+            m_done.notify_all();
+    }
+}
+
+}
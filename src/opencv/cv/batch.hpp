@@ -0,0 +1,98 @@
+/**
+ * batch.hpp
+ *
+ * Decode many JPEGs at once on a persistent pool of threads. Items are
+ * dealt out in contiguous blocks, one queue per worker; a worker that
+ * empties its own queue steals from the back of another's.
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace jpeg
+{
+
+struct DecodeItem
+{
+    void *data;
+    size_t len;
+    int scale_denom; // 1, 2, 4 or 8
+    bool gray;
+    cv::Rect roi;    // empty for the whole image
+
+    DecodeItem(void *d = 0, size_t l = 0)
+        : data(d), len(l), scale_denom(1), gray(false) {}
+};
+
+class DecodeBatch
+{
+public:
+    // mat is only valid during the call; it lives in the worker's
+    // scratch buffer and is reused for that worker's next item. It is
+    // empty if the item failed to decode.
+    typedef std::function<void(size_t idx, cv::Mat &mat)> Callback;
+
+    // threads = 0 uses one per core
+    explicit DecodeBatch(int threads = 0);
+    ~DecodeBatch();
+
+    // out[i] is the decode of items[i] (empty on failure). Returns the
+    // number decoded.
+    size_t decode(const std::vector<DecodeItem> &items,
+            std::vector<cv::Mat> &out);
+    // As above, but hand each result to cb on the worker that decoded
+    // it instead of keeping it. cb must be thread safe and not throw.
+    size_t decode(const std::vector<DecodeItem> &items, const Callback &cb);
+
+    int threads() const { return (int)m_threads.size(); }
+    // items taken from another worker's queue, over all batches
+    size_t steals() const { return m_steals; }
+
+private:
+    DecodeBatch(const DecodeBatch&);
+    DecodeBatch& operator=(const DecodeBatch&);
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<size_t> idx;
+    };
+
+    void worker(int id);
+    bool next(int id, size_t &i);
+    size_t run(const std::vector<DecodeItem> &items,
+            std::vector<cv::Mat> *out, const Callback *cb);
+
+    std::vector<std::thread> m_threads;
+    std::vector< std::unique_ptr<Queue> > m_queues;
+
+    std::mutex m_run;  // one batch at a time
+    std::mutex m_lock; // guards the fields below
+    std::condition_variable m_start, m_done;
+    uint64_t m_gen;
+    int m_active;
+    bool m_quit;
+    const std::vector<DecodeItem> *m_items;
+    std::vector<cv::Mat> *m_out;
+    const Callback *m_cb;
+
+    std::atomic<size_t> m_ok, m_steals;
+};
+
+}
+
+#endif/*_BATCH_H_*/
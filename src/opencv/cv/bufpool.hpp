@@ -0,0 +1,86 @@
+/**
+ * bufpool.hpp
+ *
+ * Reusable pixel buffers for decoding. Each thread keeps a pool of
+ * freed buffers in power-of-two size classes; PooledMat holds one and
+ * only goes back to the pool when it needs a larger one.
+ */
+
+#ifndef _BUFPOOL_H_
+#define _BUFPOOL_H_
+
+#include <stddef.h>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace jpeg
+{
+
+struct BufferPoolStats
+{
+    size_t hits;    // acquire served from the pool
+    size_t misses;  // acquire had to allocate
+    size_t returns; // release kept the buffer
+    size_t drops;   // release freed it (class full)
+    size_t cached;  // bytes held in the pool now
+    BufferPoolStats() : hits(0), misses(0), returns(0), drops(0), cached(0) {}
+};
+
+class BufferPool
+{
+public:
+    ~BufferPool();
+
+    // the calling thread's pool
+    static BufferPool& local();
+
+    // Returns a buffer of at least bytes; cap receives its real size,
+    // which must be handed back to release. Never returns NULL.
+    void* acquire( size_t bytes, size_t& cap );
+    void  release( void* buf, size_t cap );
+
+    const BufferPoolStats& stats() const { return m_stats; }
+
+    // Settings shared by all threads' pools. Huge pages apply to new
+    // buffers of 2 MB and up (transparent huge pages via madvise).
+    static void setHugePages( bool on );
+    static void setMaxPerClass( int n );
+
+private:
+    enum { MIN_SHIFT = 16, MAX_SHIFT = 31, CLASSES = MAX_SHIFT - MIN_SHIFT + 1 };
+
+    BufferPool();
+    BufferPool( const BufferPool& );
+    BufferPool& operator=( const BufferPool& );
+
+    std::vector<void*> m_free[CLASSES];
+    BufferPoolStats m_stats;
+};
+
+// A cv::Mat whose pixels come from the thread's BufferPool. create()
+// reuses the current buffer whenever it is large enough, so decoding a
+// stream of images into one PooledMat allocates only when a larger image
+// arrives. Views of mat are only valid until the next create() or
+// destruction.
+class PooledMat
+{
+public:
+    PooledMat();
+    ~PooledMat();
+
+    cv::Mat& create( int rows, int cols, int type );
+    void release();
+
+    cv::Mat mat;
+
+private:
+    PooledMat( const PooledMat& );
+    PooledMat& operator=( const PooledMat& );
+
+    void*  m_buf;
+    size_t m_cap;
+};
+
+}
+
+#endif/*_BUFPOOL_H_*/
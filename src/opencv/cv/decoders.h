@@ -3,3 +3,5 @@
 #include "grfmt_base.hpp"
 #include "grfmt_jpeg.hpp"
 #include "utils.hpp"
+#include "probe.hpp"
+#include "restart.hpp"
@@ -41,6 +41,8 @@
 
 #include "precomp.hpp"
 #include "grfmt_jpeg.hpp"
+#include "probe.hpp"
+#include "restart.hpp"
 
 #include <stdio.h>
 #include <setjmp.h>
@@ -57,6 +59,17 @@
 #include <jpeglib.h>
 //}
 
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 namespace jpeg
 {
 
@@ -151,6 +164,8 @@ JpegDecoder::JpegDecoder()
     m_signature = "\xFF\xD8\xFF";
     m_state = 0;
     m_f = 0;
+    m_scale_denom = 1;
+    m_roi = Rect();
     parse_buf = nullptr;
     parse_buflen = 0;
     m_buf_supported = true;
@@ -224,10 +239,22 @@ bool JpegDecoder::readHeader(void)
         {
             jpeg_read_header( &state->cinfo, TRUE );
 
-            m_width = state->cinfo.image_width;
-            m_height = state->cinfo.image_height;
+            state->cinfo.scale_num = 1;
+            state->cinfo.scale_denom = m_scale_denom;
+            jpeg_calc_output_dimensions( &state->cinfo );
+
+            m_width = state->cinfo.output_width;
+            m_height = state->cinfo.output_height;
             m_type = state->cinfo.num_components > 1 ? CV_8UC3 : CV_8UC1;
             result = true;
+
+            if( m_roi.area() > 0 )
+            {
+                m_roi &= Rect( 0, 0, m_width, m_height );
+                m_width = m_roi.width;
+                m_height = m_roi.height;
+                result = m_roi.area() > 0;
+            }
         }
     }
 
@@ -428,30 +455,58 @@ bool  JpegDecoder::readData( Mat& img )
 
             jpeg_start_decompress( cinfo );
 
+            // For a region, decode only the iMCU columns and rows that
+            // cover it. libjpeg-turbo can narrow the scanlines and skip
+            // rows without the IDCT; plain libjpeg reads and drops the
+            // rows above and still decodes the full width.
+            bool roi = m_roi.area() > 0;
+            int skip_cols = 0;
+            if( roi )
+            {
+#ifdef LIBJPEG_TURBO_VERSION
+                JDIMENSION xoff = m_roi.x, w = m_roi.width;
+                jpeg_crop_scanline( cinfo, &xoff, &w );
+                skip_cols = m_roi.x - (int)xoff;
+                jpeg_skip_scanlines( cinfo, m_roi.y );
+#else
+                skip_cols = m_roi.x;
+#endif
+            }
+
             buffer = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo,
-                                              JPOOL_IMAGE, m_width*4, 1 );
+                                              JPOOL_IMAGE, cinfo->output_width*4, 1 );
+
+#ifndef LIBJPEG_TURBO_VERSION
+            for( int y = 0; roi && y < m_roi.y; y++ )
+                jpeg_read_scanlines( cinfo, buffer, 1 );
+#endif
 
             uchar* data = img.data;
             for( ; m_height--; data += step )
             {
                 jpeg_read_scanlines( cinfo, buffer, 1 );
+                uchar* src = buffer[0] + skip_cols*cinfo->out_color_components;
                 if( color )
                 {
                     if( cinfo->out_color_components == 3 )
-                        icvCvt_RGB2BGR_8u_C3R( buffer[0], 0, data, 0, cvSize(m_width,1) );
+                        icvCvt_RGB2BGR_8u_C3R( src, 0, data, 0, cvSize(m_width,1) );
                     else
-                        icvCvt_CMYK2BGR_8u_C4C3R( buffer[0], 0, data, 0, cvSize(m_width,1) );
+                        icvCvt_CMYK2BGR_8u_C4C3R( src, 0, data, 0, cvSize(m_width,1) );
                 }
                 else
                 {
                     if( cinfo->out_color_components == 1 )
-                        memcpy( data, buffer[0], m_width );
+                        memcpy( data, src, m_width );
                     else
-                        icvCvt_CMYK2Gray_8u_C4C1R( buffer[0], 0, data, 0, cvSize(m_width,1) );
+                        icvCvt_CMYK2Gray_8u_C4C1R( src, 0, data, 0, cvSize(m_width,1) );
                 }
             }
             result = true;
-            jpeg_finish_decompress( cinfo );
+            // rows below a region are never decoded
+            if( roi )
+                jpeg_abort_decompress( cinfo );
+            else
+                jpeg_finish_decompress( cinfo );
         }
     }
 
@@ -462,49 +517,57 @@ bool  JpegDecoder::readData( Mat& img )
 
 /////////////////////// JpegEncoder ///////////////////
 
-struct JpegDestination
+// Compresses into the caller's vector, after whatever it already holds.
+// libjpeg writes straight into the vector's tail: it is sized to the hint
+// up front, doubled whenever the encoder fills it, and cut back to the
+// bytes written when compression ends.
+struct JpegVectorDestination
 {
     struct jpeg_destination_mgr pub;
-    vector<uchar> *buf, *dst;
+    vector<uchar>* dst;
+    size_t start; // where this image begins in dst
+    size_t hint;
 };
 
 METHODDEF(void)
-stub(j_compress_ptr)
+init_vector_destination (j_compress_ptr cinfo)
 {
+    JpegVectorDestination* dest = (JpegVectorDestination*)cinfo->dest;
+    dest->start = dest->dst->size();
+    dest->dst->resize(dest->start + MAX(dest->hint, (size_t)1 << 12));
+    dest->pub.next_output_byte = &(*dest->dst)[dest->start];
+    dest->pub.free_in_buffer = dest->dst->size() - dest->start;
 }
 
-METHODDEF(void)
-term_destination (j_compress_ptr cinfo)
+METHODDEF(boolean)
+grow_vector_destination (j_compress_ptr cinfo)
 {
-    JpegDestination* dest = (JpegDestination*)cinfo->dest;
-    size_t sz = dest->dst->size(), bufsz = dest->buf->size() - dest->pub.free_in_buffer;
-    if( bufsz > 0 )
-    {
-        dest->dst->resize(sz + bufsz);
-        memcpy( &(*dest->dst)[0] + sz, &(*dest->buf)[0], bufsz);
-    }
+    // libjpeg only calls this once the whole tail is used
+    JpegVectorDestination* dest = (JpegVectorDestination*)cinfo->dest;
+    size_t used = dest->dst->size();
+    dest->dst->resize(used + MAX(used - dest->start, (size_t)1 << 12));
+    dest->pub.next_output_byte = &(*dest->dst)[used];
+    dest->pub.free_in_buffer = dest->dst->size() - used;
+    return TRUE;
 }
 
-METHODDEF(boolean)
-empty_output_buffer (j_compress_ptr cinfo)
+METHODDEF(void)
+term_vector_destination (j_compress_ptr cinfo)
 {
-    JpegDestination* dest = (JpegDestination*)cinfo->dest;
-    size_t sz = dest->dst->size(), bufsz = dest->buf->size();
-    dest->dst->resize(sz + bufsz);
-    memcpy( &(*dest->dst)[0] + sz, &(*dest->buf)[0], bufsz);
-
-    dest->pub.next_output_byte = &(*dest->buf)[0];
-    dest->pub.free_in_buffer = bufsz;
-    return TRUE;
+    JpegVectorDestination* dest = (JpegVectorDestination*)cinfo->dest;
+    dest->dst->resize(dest->dst->size() - dest->pub.free_in_buffer);
 }
 
-static void jpeg_buffer_dest(j_compress_ptr cinfo, JpegDestination* destination)
+static void jpeg_vector_dest(j_compress_ptr cinfo, JpegVectorDestination* destination,
+                             vector<uchar>* dst, size_t hint)
 {
     cinfo->dest = &destination->pub;
 
-    destination->pub.init_destination = stub;
-    destination->pub.empty_output_buffer = empty_output_buffer;
-    destination->pub.term_destination = term_destination;
+    destination->dst = dst;
+    destination->hint = hint;
+    destination->pub.init_destination = init_vector_destination;
+    destination->pub.empty_output_buffer = grow_vector_destination;
+    destination->pub.term_destination = term_vector_destination;
 }
 
 
@@ -512,6 +575,7 @@ JpegEncoder::JpegEncoder()
 {
     m_description = "JPEG files (*.jpeg;*.jpg;*.jpe)";
     m_buf_supported = true;
+    m_size_hint = 0;
 }
 
 
@@ -539,13 +603,12 @@ bool JpegEncoder::write( const Mat& img, const vector<int>& params )
     fileWrapper fw;
     int width = img.cols, height = img.rows;
 
-    vector<uchar> out_buf(1 << 12);
     AutoBuffer<uchar> _buffer;
     uchar* buffer;
 
     struct jpeg_compress_struct cinfo;
     JpegErrorMgr jerr;
-    JpegDestination dest;
+    JpegVectorDestination dest;
 
     jpeg_create_compress(&cinfo);
     cinfo.err = jpeg_std_error(&jerr.pub);
@@ -560,13 +623,9 @@ bool JpegEncoder::write( const Mat& img, const vector<int>& params )
     }
     else
     {
-        dest.dst = m_buf;
-        dest.buf = &out_buf;
-
-        jpeg_buffer_dest( &cinfo, &dest );
-
-        dest.pub.next_output_byte = &out_buf[0];
-        dest.pub.free_in_buffer = out_buf.size();
+        size_t hint = m_size_hint ? m_size_hint
+            : (size_t)width * height * img.channels() / 8;
+        jpeg_vector_dest( &cinfo, &dest, m_buf, hint );
     }
 
     if( setjmp( jerr.setjmp_buffer ) == 0 )
@@ -635,29 +694,379 @@ _exit_:
     return result;
 }
 
-cv::Mat JPEGasMat(void *data, size_t len)
+/////////////////////// JpegStreamEncoder ///////////////////
+
+struct JpegStreamState
 {
-    JpegDecoder decoder;
-    cv::Mat mat;
+    jpeg_compress_struct cinfo;
+    JpegErrorMgr jerr;
+    JpegVectorDestination dest;
+    AutoBuffer<uchar> row;
+    int channels;
+};
+
+JpegStreamEncoder::JpegStreamEncoder()
+{
+    m_state = 0;
+}
+
+JpegStreamEncoder::~JpegStreamEncoder()
+{
+    if( m_state )
+    {
+        JpegStreamState* state = (JpegStreamState*)m_state;
+        jpeg_destroy_compress( &state->cinfo );
+        delete state;
+        m_state = 0;
+    }
+}
+
+bool JpegStreamEncoder::open( int width, int height, int channels,
+                              vector<uchar>& buf, int quality, size_t hint,
+                              int restart_rows )
+{
+    if( m_state || width < 1 || height < 1 )
+        return false;
+
+    JpegStreamState* state = new JpegStreamState;
+    m_state = state;
+    state->channels = channels;
+
+    state->cinfo.err = jpeg_std_error( &state->jerr.pub );
+    state->jerr.pub.error_exit = error_exit;
+    jpeg_create_compress( &state->cinfo );
+
+    if( !hint )
+        hint = (size_t)width * height * (channels > 1 ? 3 : 1) / 8;
+    jpeg_vector_dest( &state->cinfo, &state->dest, &buf, hint );
+
+    if( setjmp( state->jerr.setjmp_buffer ) != 0 )
+        return false;
+
+    state->cinfo.image_width = width;
+    state->cinfo.image_height = height;
+    state->cinfo.input_components = channels > 1 ? 3 : 1;
+    state->cinfo.in_color_space = channels > 1 ? JCS_RGB : JCS_GRAYSCALE;
+
+    jpeg_set_defaults( &state->cinfo );
+    jpeg_set_quality( &state->cinfo, MIN(MAX(quality, 0), 100),
+                      TRUE /* limit to baseline-JPEG values */ );
+    state->cinfo.restart_in_rows = MAX(restart_rows, 0);
+    // encodeRestartParallel splices strips under one set of tables, so
+    // never let them be optimized per image
+    if( restart_rows > 0 )
+        state->cinfo.optimize_coding = FALSE;
+    jpeg_start_compress( &state->cinfo, TRUE );
+
+    if( channels > 1 )
+        state->row.allocate( width * 3 );
+    return true;
+}
+
+bool JpegStreamEncoder::write( const Mat& rows )
+{
+    if( !m_state )
+        return false;
+    JpegStreamState* state = (JpegStreamState*)m_state;
+    jpeg_compress_struct* cinfo = &state->cinfo;
+
+    if( rows.cols != (int)cinfo->image_width ||
+        rows.channels() != state->channels ||
+        cinfo->next_scanline + rows.rows > cinfo->image_height )
+        return false;
+
+    if( setjmp( state->jerr.setjmp_buffer ) != 0 )
+        return false;
+
+    for( int y = 0; y < rows.rows; y++ )
+    {
+        uchar *data = (uchar*)rows.ptr(y), *ptr = data;
+        if( state->channels == 3 )
+        {
+            icvCvt_BGR2RGB_8u_C3R( data, 0, state->row, 0, cvSize(rows.cols,1) );
+            ptr = state->row;
+        }
+        else if( state->channels == 4 )
+        {
+            icvCvt_BGRA2BGR_8u_C4C3R( data, 0, state->row, 0, cvSize(rows.cols,1), 2 );
+            ptr = state->row;
+        }
+        jpeg_write_scanlines( cinfo, &ptr, 1 );
+    }
+    return true;
+}
+
+bool JpegStreamEncoder::close()
+{
+    if( !m_state )
+        return false;
+    JpegStreamState* state = (JpegStreamState*)m_state;
+    bool result = false;
+
+    if( setjmp( state->jerr.setjmp_buffer ) == 0 &&
+        state->cinfo.next_scanline == state->cinfo.image_height )
+    {
+        jpeg_finish_compress( &state->cinfo );
+        result = true;
+    }
+
+    jpeg_destroy_compress( &state->cinfo );
+    delete state;
+    m_state = 0;
+    return result;
+}
 
+/////////////////////// TurboJPEG backend ///////////////////
+
+static int jpeg_backend_init()
+{
+    const char* env = getenv( "JPEG_BACKEND" );
+    if( env && strcmp( env, "libjpeg" ) == 0 )
+        return JPEG_BACKEND_LIBJPEG;
+#ifdef HAVE_TURBOJPEG
+    return JPEG_BACKEND_TURBO;
+#else
+    return JPEG_BACKEND_LIBJPEG;
+#endif
+}
+
+// set from any thread, read by every decode and encode
+static std::atomic<int> jpeg_backend( jpeg_backend_init() );
+
+void setJpegBackend( JpegBackend b )
+{
+#ifdef HAVE_TURBOJPEG
+    jpeg_backend = b;
+#else
+    (void)b;
+#endif
+}
+
+JpegBackend jpegBackend()
+{
+    return (JpegBackend)jpeg_backend.load();
+}
+
+#ifdef HAVE_TURBOJPEG
+
+// TurboJPEG handles are not thread safe but are reusable, so keep one
+// of each kind per thread.
+struct TurboHandles
+{
+    tjhandle dec, enc;
+    TurboHandles() : dec(0), enc(0) {}
+    ~TurboHandles()
+    {
+        if( dec ) tjDestroy( dec );
+        if( enc ) tjDestroy( enc );
+    }
+};
+
+static thread_local TurboHandles turbo_handles;
+
+static void allocMat( cv::Mat& mat, PooledMat* pm, int rows, int cols, int type );
+
+// Whole-image decode to BGR or gray. Returns false when TurboJPEG cannot handle
+// the stream (e.g. CMYK) so the caller can fall back.
+static bool turboDecode( void* data, size_t len, int scale_denom, bool gray,
+                         cv::Mat& mat, PooledMat* pm )
+{
+    if( !turbo_handles.dec && !(turbo_handles.dec = tjInitDecompress()) )
+        return false;
+
+    int width = 0, height = 0, subsamp = 0, colorspace = 0;
+    if( tjDecompressHeader3( turbo_handles.dec, (unsigned char*)data,
+                             (unsigned long)len, &width, &height,
+                             &subsamp, &colorspace ) != 0 )
+        return false;
+    if( colorspace == TJCS_CMYK || colorspace == TJCS_YCCK )
+        return false;
+
+    if( scale_denom != 2 && scale_denom != 4 && scale_denom != 8 )
+        scale_denom = 1;
+    tjscalingfactor sf = { 1, scale_denom };
+    width = TJSCALED( width, sf );
+    height = TJSCALED( height, sf );
+
+    allocMat( mat, pm, height, width, gray ? CV_8UC1 : CV_8UC3 );
+    return tjDecompress2( turbo_handles.dec, (unsigned char*)data,
+                          (unsigned long)len, mat.data, width, (int)mat.step,
+                          height, gray ? TJPF_GRAY : TJPF_BGR, 0 ) == 0;
+}
+
+// Whole-image encode of 8-bit gray or BGR into a malloc'd buffer, to
+// match MatToJPEG. Returns -1 for anything else so the caller can fall
+// back.
+static int turboEncode( const cv::Mat& mat, void** data, size_t& len )
+{
+    int pf, samp;
+    if( mat.type() == CV_8UC3 )
+        pf = TJPF_BGR, samp = TJSAMP_420;
+    else if( mat.type() == CV_8UC1 )
+        pf = TJPF_GRAY, samp = TJSAMP_GRAY;
+    else
+        return -1;
+
+    if( !turbo_handles.enc && !(turbo_handles.enc = tjInitCompress()) )
+        return -1;
+
+    // preallocate the worst case ourselves so the result is plain
+    // malloc memory and TurboJPEG never reallocates it
+    unsigned long size = tjBufSize( mat.cols, mat.rows, samp );
+    unsigned char* buf = (unsigned char*)malloc( size );
+    if( !buf )
+        return -1;
+    if( tjCompress2( turbo_handles.enc, mat.data, mat.cols, (int)mat.step,
+                     mat.rows, pf, &buf, &size, samp, 95,
+                     TJFLAG_NOREALLOC ) != 0 )
+    {
+        free( buf );
+        return -1;
+    }
+    *data = buf;
+    len = size;
+    return 0;
+}
+
+// As turboEncode, but into buf (replacing its contents). buf is sized to
+// the worst case, or to hint when that is larger, TurboJPEG compresses
+// straight into it, and it is then cut to the bytes produced.
+static int turboEncode( const cv::Mat& mat, vector<uchar>& buf, size_t hint )
+{
+    int pf, samp;
+    if( mat.type() == CV_8UC3 )
+        pf = TJPF_BGR, samp = TJSAMP_420;
+    else if( mat.type() == CV_8UC1 )
+        pf = TJPF_GRAY, samp = TJSAMP_GRAY;
+    else
+        return -1;
+
+    if( !turbo_handles.enc && !(turbo_handles.enc = tjInitCompress()) )
+        return -1;
+
+    unsigned long size = tjBufSize( mat.cols, mat.rows, samp );
+    buf.resize( MAX( (size_t)size, hint ) );
+    unsigned char* out = buf.data();
+    if( tjCompress2( turbo_handles.enc, mat.data, mat.cols, (int)mat.step,
+                     mat.rows, pf, &out, &size, samp, 95,
+                     TJFLAG_NOREALLOC ) != 0 )
+    {
+        buf.clear();
+        return -1;
+    }
+    buf.resize( size );
+    return 0;
+}
+
+#endif /* HAVE_TURBOJPEG */
+
+static void allocMat( cv::Mat& mat, PooledMat* pm, int rows, int cols, int type )
+{
+    if( pm )
+        mat = pm->create( rows, cols, type );
+    else
+        mat.create( rows, cols, type );
+}
+
+/////////////////////// parallel decode ///////////////////
+
+// off by default: callers mostly decode on several threads already
+static std::atomic<int>    parallel_threads( 1 );
+static std::atomic<size_t> parallel_min_pixels( 4000000 );
+static thread_local bool parallel_here = true;
+
+void setParallelDecode( int threads, size_t min_pixels )
+{
+    parallel_threads = threads;
+    parallel_min_pixels = min_pixels;
+}
+
+void setThreadParallelDecode( bool on )
+{
+    parallel_here = on;
+}
+
+bool decodeJPEG( void* data, size_t len, cv::Mat& mat, PooledMat* pm,
+                 int scale_denom, bool gray, const cv::Rect& roi )
+{
+    // large images carrying restart markers are split into row strips
+    // and decoded on several threads
+    if( parallel_threads > 1 && parallel_here && roi.area() == 0 )
+    {
+        JpegInfo info;
+        if( probe( data, len, info ) && info.restart_interval > 0 &&
+            (size_t)info.width * info.height >= parallel_min_pixels &&
+            decodeRestartParallel( data, len, info, mat, pm, scale_denom,
+                                   gray, parallel_threads ) )
+            return true;
+    }
+
+#ifdef HAVE_TURBOJPEG
+    // TurboJPEG 2.x cannot crop, so regions always take the libjpeg path
+    if( jpeg_backend == JPEG_BACKEND_TURBO && roi.area() == 0 &&
+        turboDecode( data, len, scale_denom, gray, mat, pm ) )
+        return true;
+#endif
+
+    JpegDecoder decoder;
+    decoder.setScale(scale_denom);
+    decoder.setROI(roi);
     decoder.setParseBuffer(data, len);
     if (!decoder.readHeader())
-        return mat;
+        return false;
+
+    int type = CV_MAKETYPE(CV_MAT_DEPTH(decoder.type()), gray ? 1 : 3);
+    allocMat(mat, pm, decoder.height(), decoder.width(), type);
+    return decoder.readData(mat);
+}
+
+cv::Mat JPEGasMat(void *data, size_t len)
+{
+    return JPEGasMat(data, len, 1);
+}
 
-    // load as color
-    int type = CV_MAKETYPE(CV_MAT_DEPTH(decoder.type()), 3);
-    mat.create(decoder.height(), decoder.width(), type );
-    if(!decoder.readData(mat))
+cv::Mat JPEGasMat(void *data, size_t len, int scale_denom)
+{
+    cv::Mat mat;
+    if (!decodeJPEG(data, len, mat, 0, scale_denom))
         mat.release();
+    return mat;
+}
+
+bool JPEGasMat(void *data, size_t len, cv::Mat &out, int scale_denom)
+{
+    return decodeJPEG(data, len, out, 0, scale_denom);
+}
+
+bool JPEGasMat(void *data, size_t len, PooledMat &out, int scale_denom)
+{
+    return decodeJPEG(data, len, out.mat, &out, scale_denom);
+}
 
+cv::Mat JPEGasMat(void *data, size_t len, const cv::Rect &roi, int scale_denom)
+{
+    cv::Mat mat;
+    if (!decodeJPEG(data, len, mat, 0, scale_denom, false, roi))
+        mat.release();
     return mat;
 }
 
+bool JPEGasMat(void *data, size_t len, const cv::Rect &roi, PooledMat &out,
+        int scale_denom)
+{
+    return decodeJPEG(data, len, out.mat, &out, scale_denom, false, roi);
+}
+
 int MatToJPEG(cv::Mat &mat, void **data, size_t &len)
 {
     JpegEncoder encoder;
     std::vector<int> params(0);
 
+#ifdef HAVE_TURBOJPEG
+    if( jpeg_backend == JPEG_BACKEND_TURBO && turboEncode( mat, data, len ) == 0 )
+        return 0;
+#endif
+
     std::vector<uchar> buf;
     if (!encoder.setDestination(buf))
         return -1;
@@ -673,6 +1082,81 @@ int MatToJPEG(cv::Mat &mat, void **data, size_t &len)
     return 0;
 }
 
+bool addRestartMarkers(const void *data, size_t len, std::vector<uchar> &out,
+        int rows)
+{
+    jpeg_decompress_struct src;
+    jpeg_compress_struct dst;
+    JpegErrorMgr jerr;
+    JpegVectorDestination dest;
+    bool result = false;
+
+    out.clear();
+    src.err = dst.err = jpeg_std_error( &jerr.pub );
+    jerr.pub.error_exit = error_exit;
+    jpeg_create_decompress( &src );
+    jpeg_create_compress( &dst );
+
+    if( setjmp( jerr.setjmp_buffer ) == 0 )
+    {
+        jpeg_mem_src( &src, (unsigned char*)data, len );
+        jpeg_save_markers( &src, JPEG_COM, 0xFFFF );
+        for( int m = 0; m < 16; m++ )
+            jpeg_save_markers( &src, JPEG_APP0 + m, 0xFFFF );
+        jpeg_read_header( &src, TRUE );
+
+        // coefficients are copied untouched: no generation loss
+        jvirt_barray_ptr* coef = jpeg_read_coefficients( &src );
+        jpeg_copy_critical_parameters( &src, &dst );
+        dst.restart_in_rows = MAX(rows, 1);
+        dst.optimize_coding = TRUE;
+        jpeg_vector_dest( &dst, &dest, &out, len + len / 16 );
+        jpeg_write_coefficients( &dst, coef );
+
+        // keep EXIF, ICC and comments; the JFIF and Adobe headers are
+        // written by the compressor itself
+        for( jpeg_saved_marker_ptr m = src.marker_list; m; m = m->next )
+        {
+            if( dst.write_JFIF_header && m->marker == JPEG_APP0 &&
+                m->data_length >= 5 && memcmp( m->data, "JFIF", 5 ) == 0 )
+                continue;
+            if( dst.write_Adobe_marker && m->marker == JPEG_APP0 + 14 &&
+                m->data_length >= 5 && memcmp( m->data, "Adobe", 5 ) == 0 )
+                continue;
+            jpeg_write_marker( &dst, m->marker, m->data, m->data_length );
+        }
+
+        jpeg_finish_compress( &dst );
+        jpeg_finish_decompress( &src );
+        result = true;
+    }
+
+    jpeg_destroy_compress( &dst );
+    jpeg_destroy_decompress( &src );
+    if( !result )
+        out.clear();
+    return result;
+}
+
+int MatToJPEG(const cv::Mat &mat, std::vector<uchar> &buf, size_t hint)
+{
+    buf.clear();
+
+#ifdef HAVE_TURBOJPEG
+    if( jpeg_backend == JPEG_BACKEND_TURBO && turboEncode( mat, buf, hint ) == 0 )
+        return 0;
+#endif
+
+    JpegEncoder encoder;
+    std::vector<int> params(0);
+    if (!encoder.setDestination(buf))
+        return -1;
+    encoder.setSizeHint(hint);
+    if (!encoder.write(mat, params))
+        return -1;
+    return 0;
+}
+
 }
 
 /* End of file. */
@@ -0,0 +1,290 @@
+/**
+ * restart.cpp
+ */
+
+#include "restart.hpp"
+#include "grfmt_jpeg.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace jpeg
+{
+
+static inline int be16(const uchar *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static int gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+bool splitRestart(const void *data, size_t len, const JpegInfo &info,
+        int parts, std::vector<RestartStrip> &strips)
+{
+    const uchar *p = (const uchar*)data;
+    strips.clear();
+
+    if (info.progressive || info.arithmetic || info.precision != 8
+            || info.restart_interval <= 0 || parts < 2)
+        return false;
+
+    // a single scan must carry every component
+    const size_t sos = info.sos_offset;
+    if (sos + 5 > len || be16(p + sos + 2) < 3)
+        return false;
+    if (p[sos + 4] != info.components)
+        return false;
+    const size_t scan = sos + 2 + be16(p + sos + 2);
+    if (scan > len)
+        return false;
+
+    // find every RST marker and the end of the scan
+    std::vector<size_t> rst;
+    size_t end = 0;
+    for (size_t i = scan; i + 1 < len; i++) {
+        if (p[i] != 0xFF)
+            continue;
+        uchar m = p[i + 1];
+        if (m == 0x00 || m == 0xFF)
+            continue; // stuffed byte or fill
+        if (m >= 0xD0 && m <= 0xD7) {
+            rst.push_back(i);
+            i++;
+            continue;
+        }
+        if (m != 0xD9)
+            return false; // DNL, another scan, ...: not a single scan
+        end = i;
+        break;
+    }
+    if (!end)
+        return false;
+
+    const int R = info.restart_interval;
+    const int mpr = (info.width + info.mcu_width - 1) / info.mcu_width;
+    const int mrows = (info.height + info.mcu_height - 1) / info.mcu_height;
+    const long total = (long)mpr * mrows;
+    if ((long)rst.size() != (total + R - 1) / R - 1)
+        return false;
+
+    // intervals start on a row every g MCU rows
+    const long l = (long)R / gcd(R, mpr) * mpr;
+    const int g = (int)(l / mpr);
+    if (g >= mrows)
+        return false;
+
+    std::vector<int> starts(1, 0);
+    for (int k = 1; k < parts; k++) {
+        int r = (int)((long)mrows * k / parts);
+        r = (r + g - 1) / g * g;
+        if (r > starts.back() && r < mrows)
+            starts.push_back(r);
+    }
+    if (starts.size() < 2)
+        return false;
+    starts.push_back(mrows);
+
+    const size_t sof_height = info.sof_offset + 5;
+    for (size_t s = 0; s + 1 < starts.size(); s++) {
+        const int r0 = starts[s], r1 = starts[s + 1];
+        const long k0 = (long)r0 * mpr / R;  // first interval
+        const long k1 = ((long)r1 * mpr + R - 1) / R; // one past last
+        const size_t from = k0 ? rst[k0 - 1] + 2 : scan;
+        const size_t to = k1 - 1 < (long)rst.size() ? rst[k1 - 1] : end;
+
+        RestartStrip strip;
+        strip.y = r0 * info.mcu_height;
+        strip.rows = std::min(r1 * info.mcu_height, info.height) - strip.y;
+
+        std::vector<uchar> &j = strip.jpeg;
+        j.reserve(scan + (to - from) + 2);
+        j.assign(p, p + scan);
+        j[sof_height]     = (uchar)(strip.rows >> 8);
+        j[sof_height + 1] = (uchar)(strip.rows & 0xFF);
+        j.insert(j.end(), p + from, p + to);
+        for (long k = k0; k < k1 - 1; k++) {
+            size_t at = scan + (rst[k] - from) + 1;
+            j[at] = (uchar)(0xD0 + ((k - k0) & 7));
+        }
+        j.push_back(0xFF);
+        j.push_back(0xD9);
+
+        strips.push_back(std::move(strip));
+    }
+    return true;
+}
+
+bool decodeRestartParallel(void *data, size_t len, const JpegInfo &info,
+        cv::Mat &mat, PooledMat *pm, int scale_denom, bool gray,
+        int threads)
+{
+    std::vector<RestartStrip> strips;
+    if (!splitRestart(data, len, info, threads, strips))
+        return false;
+
+    if (scale_denom != 2 && scale_denom != 4 && scale_denom != 8)
+        scale_denom = 1;
+    const int d = scale_denom;
+    const int type = gray ? CV_8UC1 : CV_8UC3;
+    const int rows = (info.height + d - 1) / d;
+    const int cols = (info.width + d - 1) / d;
+    if (pm)
+        mat = pm->create(rows, cols, type);
+    else
+        mat.create(rows, cols, type);
+
+    // strip tops are multiples of the MCU height, so they scale exactly
+    std::vector<char> ok(strips.size(), 0);
+    auto work = [&](size_t s) {
+        setThreadParallelDecode(false);
+        RestartStrip &st = strips[s];
+        cv::Mat band = mat.rowRange(st.y / d, st.y / d + (st.rows + d - 1) / d);
+        ok[s] = decodeJPEG(st.jpeg.data(), st.jpeg.size(), band, 0, d, gray);
+        if (band.data != mat.ptr(st.y / d))
+            ok[s] = 0; // size disagreed and the decode went elsewhere
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t s = 1; s < strips.size(); s++)
+        pool.push_back(std::thread(work, s));
+    work(0);
+    setThreadParallelDecode(true);
+    for (std::thread &t : pool)
+        t.join();
+
+    for (char o : ok)
+        if (!o)
+            return false;
+    return true;
+}
+
+bool joinRestartStrips(std::vector< std::vector<uchar> > &strips, int rows,
+        std::vector<uchar> &out)
+{
+    const size_t nstrips = strips.size();
+    if (nstrips < 1 || rows < 1 || rows > 0xFFFF)
+        return false;
+
+    // every strip shares strip 0's headers save for the frame height;
+    // its entropy data runs from the end of SOS to the closing EOI
+    std::vector<size_t> scan(nstrips);
+    JpegInfo info0;
+    int k = 0; // MCU rows per strip
+    for (size_t s = 0; s < nstrips; s++) {
+        const std::vector<uchar> &j = strips[s];
+        JpegInfo info;
+        if (!probe(j.data(), j.size(), info))
+            return false;
+        scan[s] = info.sos_offset + 2 + be16(&j[info.sos_offset + 2]);
+        if (scan[s] + 2 > j.size() || j[j.size() - 2] != 0xFF
+                || j[j.size() - 1] != 0xD9)
+            return false;
+        if (s == 0) {
+            info0 = info;
+            const int mpr = (info.width + info.mcu_width - 1)
+                / info.mcu_width;
+            if (info.restart_interval <= 0
+                    || info.restart_interval % mpr != 0)
+                return false;
+            k = info.restart_interval / mpr;
+        }
+        // each strip but the last is exactly one restart interval, and
+        // the last no more
+        if (info.height > k * info.mcu_height
+                || (s + 1 < nstrips && info.height != k * info.mcu_height))
+            return false;
+        if (s == 0)
+            continue;
+        // same tables, so the entropy data means the same under strip
+        // 0's headers; only the frame height may differ
+        const size_t h = info0.sof_offset + 5;
+        if (scan[s] != scan[0] || info.sof_offset != info0.sof_offset
+                || memcmp(&j[0], &strips[0][0], h) != 0
+                || memcmp(&j[h + 2], &strips[0][h + 2], scan[0] - h - 2) != 0)
+            return false;
+    }
+
+    size_t total = 2;
+    for (size_t s = 0; s < nstrips; s++)
+        total += strips[s].size() - scan[s];
+
+    out.clear();
+    out.reserve(scan[0] + total);
+    out.assign(strips[0].begin(), strips[0].begin() + scan[0]);
+    out[info0.sof_offset + 5] = (uchar)(rows >> 8);
+    out[info0.sof_offset + 6] = (uchar)(rows & 0xFF);
+    for (size_t s = 0; s < nstrips; s++) {
+        if (s) {
+            out.push_back(0xFF);
+            out.push_back((uchar)(0xD0 + ((s - 1) & 7)));
+        }
+        out.insert(out.end(), strips[s].begin() + scan[s],
+                strips[s].end() - 2);
+        std::vector<uchar>().swap(strips[s]);
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+    return true;
+}
+
+bool encodeRestartParallel(const cv::Mat &mat, std::vector<uchar> &out,
+        int quality, int threads)
+{
+    const int ch = mat.channels();
+    if (mat.depth() != CV_8U || (ch != 1 && ch != 3 && ch != 4))
+        return false;
+
+    // the encoder subsamples color 2x2, so color MCUs are 16x16
+    const int mcu = ch > 1 ? 16 : 8;
+    const int mpr = (mat.cols + mcu - 1) / mcu;
+    const int mrows = (mat.rows + mcu - 1) / mcu;
+    if (threads < 2 || mrows < 2 || mat.rows > 0xFFFF || mat.cols > 0xFFFF)
+        return false;
+
+    // one restart interval per strip; DRI holds at most 65535 MCUs
+    int k = (mrows + threads - 1) / threads;
+    k = std::min(k, 0xFFFF / mpr);
+    if (k < 1)
+        return false;
+    const int nstrips = (mrows + k - 1) / k;
+    if (nstrips < 2)
+        return false;
+
+    std::vector< std::vector<uchar> > enc(nstrips);
+    std::vector<char> ok(nstrips, 0);
+    std::atomic<int> next(0);
+    auto work = [&]() {
+        for (int s; (s = next++) < nstrips; ) {
+            const int y0 = s * k * mcu;
+            const int y1 = std::min(mat.rows, y0 + k * mcu);
+            JpegStreamEncoder e;
+            ok[s] = e.open(mat.cols, y1 - y0, ch, enc[s], quality, 0, k)
+                && e.write(mat.rowRange(y0, y1)) && e.close();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < std::min(threads, nstrips); t++)
+        pool.push_back(std::thread(work));
+    work();
+    for (std::thread &t : pool)
+        t.join();
+
+    for (char o : ok)
+        if (!o)
+            return false;
+    return joinRestartStrips(enc, mat.rows, out);
+}
+
+}
@@ -10,7 +10,9 @@
 #define _USE_MATH_DEFINES
 
 /* C++ system includes */
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <algorithm>
 #include <cstdlib>
@@ -27,6 +29,7 @@
 /* Local includes */
 #include "types.hpp"
 #include "io.hpp"
+#include "cv/decoders.h"
 
 //===----------------------------------------------------------------------===//
 // Definitions
@@ -89,11 +92,14 @@ static void usage(const char *name)
 typedef std::unique_ptr< cv::detail::ImageFeatures > featptr_t;
 typedef std::unique_ptr< cv::Mat > matptr_t;
 
-static int dice_one(image_t &image, rois_t &rois, bool show_boxed = false)
+// Only the image dimensions are needed to pick regions; mat is used
+// solely to draw the boxed overlay.
+static int dice_one(cv::Size dims, rois_t &rois,
+        const cv::Mat *mat = nullptr)
 {
-    cv::Mat mat = image;
-    int img_width  = mat.size().width;
-    int img_height = mat.size().height;
+    bool show_boxed = (mat != nullptr);
+    int img_width  = dims.width;
+    int img_height = dims.height;
     std::stringstream ss;
     matptr_t boxed;
 
@@ -117,7 +123,7 @@ static int dice_one(image_t &image, rois_t &rois, bool show_boxed = false)
     int whbounce  = std::max(width, height) / 4;
 
     if (show_boxed)
-        boxed.reset( new cv::Mat( mat.clone() ) );
+        boxed.reset( new cv::Mat( mat->clone() ) );
 
     for (int v = 0; v < num_vert; v++) {
         int y = img_height / (num_vert + 1) * v;
@@ -239,17 +245,39 @@ static int do_transform(cv::Mat &mat, float shrink_by)
     return 0;
 }
 
+static int read_file(const path_t &path, std::vector<uchar> &buf)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return -1;
+    buf.assign(std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>());
+    return 0;
+}
+
 static int dice(path_t &path)
 {
     image_t image;
     rois_t rois;
-
-    /* load and dice */
-    if (load_image(image, path)) {
-        std::cerr << "!! error loading image" << std::endl;
-        return -1;
+    cv::Size dims;
+
+    /* JPEGs are only probed here; each region is decoded on its own
+     * below. Other formats are loaded whole. */
+    jpeg::JpegInfo info;
+    std::vector<uchar> file;
+    if (jpeg::probe(path, info) && !read_file(path, file)) {
+        dims = cv::Size(info.width, info.height);
+    } else {
+        file.clear();
+        if (load_image(image, path)) {
+            std::cerr << "!! error loading image" << std::endl;
+            return -1;
+        }
+        cv::Mat mat = image;
+        dims = mat.size();
     }
-    if (dice_one(image, rois, false)) {
+
+    if (dice_one(dims, rois)) {
         std::cerr << "!! error dicing image" << std::endl;
         return -1;
     }
@@ -263,9 +291,18 @@ static int dice(path_t &path)
         std::stringstream ss;
         cv::Mat mat, sub, clone;
 
-        mat = image;
-        sub = mat(rois[subidx]);
-        clone = sub.clone();
+        if (!file.empty()) {
+            clone = jpeg::JPEGasMat(file.data(), file.size(), rois[subidx]);
+            if (!clone.data) {
+                std::cerr << "!! error decoding subimage "
+                    << subidx << std::endl;
+                continue;
+            }
+        } else {
+            mat = image;
+            sub = mat(rois[subidx]);
+            clone = sub.clone();
+        }
         do_transform(clone, 0.2);
 
         ss.str( std::string() );
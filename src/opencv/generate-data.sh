@@ -24,4 +24,6 @@ flickr=inputs/flickr_social_paths-$ID.in
 ./$exec proto ./inputs/ego_gplus_paths-$ID.in ./inputs/flickr_social_paths-$ID.in
 mv -v graph.pb inputs/graph-$ID.pb
 mv -v imagelist.pb inputs/imagelist-$ID.pb
+mv -v graph.csr inputs/graph-$ID.csr
+mv -v graph.attr inputs/graph-$ID.attr
 
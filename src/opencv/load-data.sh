@@ -4,17 +4,29 @@ set -u
 
 CONF=pulse.conf
 
-[[ 1 -ne $# ]] && echo "Usage: $0 dataset" && exit 1
+[[ 1 -gt $# ]] && echo "Usage: $0 dataset [load options]" && exit 1
 
 exec=./load_egonet
 
 ID=$1
+shift
+# reloads send only what changed since the last load of this dataset
+manifest=inputs/manifest-$ID
 graph=inputs/graph-$ID.pb
 images=inputs/imagelist-$ID.pb
 [[ ! -e $graph ]] && \
     echo "Error: file not found: $graph" && exit 1
 [[ ! -e $images ]] && \
     echo "Error: file not found: $images" && exit 1
-echo $exec load $graph $images $CONF
-$exec load $graph $images $CONF
+echo $exec load --manifest=$manifest "$@" $graph $images $CONF
+$exec load --manifest=$manifest "$@" $graph $images $CONF
+# goes into the jar next to graph-ids.txt, for neighbor queries
+csr=inputs/graph-$ID.csr
+if [[ -e $csr ]]; then
+    cp -v $csr graph.csr
+fi
+attr=inputs/graph-$ID.attr
+if [[ -e $attr ]]; then
+    cp -v $attr graph.attr
+fi
 
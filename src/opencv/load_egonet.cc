@@ -1,22 +1,33 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <google/protobuf/io/coded_stream.h>
-#include <google/protobuf/io/zero_copy_stream.h>
-#include <google/protobuf/io/zero_copy_stream_impl.h>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -24,7 +35,12 @@
 #include <libmemcached/memcached.h>
 
 #include "Objects.pb.h" // generated
+#include "AttrIndex.hpp"
 #include "Config.hpp"
+#include "GraphCSR.hpp"
+#include "NeighborSampler.hpp" // fnv1a
+#include "Snapshot.hpp"
+#include "cv/decoders.h"
 
 #define MP_20   ((unsigned int)(20 * 1e6))
 enum {
@@ -33,7 +49,6 @@ enum {
 };
 
 using namespace std;
-using namespace google::protobuf::io;
 
 struct EgoID
 {
@@ -49,47 +64,71 @@ struct EgoID
 };
 
 deque<EgoID> egoids;
-deque<storm::Image> images;
 
 typedef EgoID egoid_t;
 typedef string id;
 
 memcached_st *memc = NULL;
 
-int readfile(const string &path, void **buf, size_t *len)
+// options to "load"
+struct LoadOptions
 {
-    struct stat st;
-    uintptr_t ptr;
-    int fd = open(path.c_str(), O_RDONLY);
+    // how sets are sent: one round trip each; buffered and flushed a
+    // batch at a time; or buffered without replies
+    enum Mode { SYNC, BUFFERED, NOREPLY } mode;
+    int threads;    // connections storing in parallel
+    int batch;      // objects per flush and acknowledgement
+    double rate;    // objects per second over all threads, 0 for no limit
+    // give stored images restart markers so that large ones can be
+    // decoded on several threads
+    bool restart;
+    // key -> content hash of the last load; when set, only objects that
+    // changed since are sent, and the file is rewritten afterwards
+    string manifest;
+    bool full;      // send everything anyway (still writes the manifest)
+    bool prune;     // delete keys the last load stored but this one lacks
+
+    LoadOptions(void)
+        : mode(BUFFERED), threads(8), batch(64), rate(0), restart(false),
+        full(false), prune(false) { ; }
+};
 
-    if (fd < 0)
-        return -1;
+LoadOptions load_opts;
 
-    stat(path.c_str(), &st);
-    size_t rem = *len = st.st_size;
-    *buf = malloc(*len);
-    if (!*buf)
-        goto err;
+// A whole file mapped read-only; an empty file maps to nothing.
+struct MappedFile
+{
+    const void *data;
+    size_t len;
 
-    ptr = (uintptr_t)*buf;
-    while (rem > 0) {
-        size_t rd = read(fd, (void*)ptr, rem);
-        if (rd == 0)
-            goto err;
-        rem -= rd;
-        ptr += rd;
+    MappedFile(void) : data(nullptr), len(0) { ; }
+    ~MappedFile(void)
+    {
+        if (data)
+            munmap((void*)data, len);
     }
 
-    close(fd);
-    return 0;
-
-err:
-    if (fd > 0)
+    // the file is read in once, rather than a page fault at a time
+    int open(const string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return -1;
+        struct stat st;
+        if (fstat(fd, &st)) {
+            close(fd);
+            return -1;
+        }
+        len = st.st_size;
+        void *map = len ? mmap(NULL, len, PROT_READ,
+                MAP_PRIVATE | MAP_POPULATE, fd, 0) : nullptr;
         close(fd);
-    if (*buf)
-        free(*buf);
-    return -1;
-}
+        if (map == MAP_FAILED)
+            return -1;
+        data = map;
+        return 0;
+    }
+};
 
 int memc_exists(memcached_st *memc,
         const string &key)
@@ -108,79 +147,171 @@ int memc_exists(memcached_st *memc,
     return false;
 }
 
-// full path to image per line
-int load_images(string &path)
+// Threads that probe image headers; the work is mostly waiting on disk.
+static int probe_threads(void)
 {
-    string line;
-    vector< string > imagelist;
-
-    printf(">> Loading images...\n");
+    return max(4U, thread::hardware_concurrency());
+}
 
-    ifstream ifile;
-    ifile.open(path);
+// Probe the images listed in the file at listpath (a full path per
+// line) on a pool of threads, and hand each usable one to sink in list
+// order. A reader fills a ring of slots a window wide, workers probe
+// them in any order, and the caller drains them front to back, so
+// memory does not grow with the list. Returns -1 when an image cannot
+// be read or sink fails.
+static int ingest_images(const string &listpath, int threads,
+        function<int(const storm::Image&)> sink)
+{
+    ifstream ifile(listpath);
     if (!ifile.is_open()) {
         perror("open image file");
         return -1;
     }
-    while (getline(ifile, line)) {
-        if (line[0] == '#')
-            continue;
-        imagelist.push_back(line);
-    }
-    ifile.close();
 
-    string pbname("imagelist.pb");
-    cout << "Writing image list to " << pbname << endl;
-
-    int fd = open(pbname.data(), O_WRONLY | O_CREAT,  S_IRUSR | S_IWUSR);
-    if (fd < 0) return -1;
-    unique_ptr<ZeroCopyOutputStream> raw_output(new FileOutputStream(fd));
-    CodedOutputStream coded_output(raw_output.get());
-
-    coded_output.WriteVarint32(imagelist.size());
-
-    void *buf(nullptr);
-    size_t buflen(0), len(0);
-    for (auto &imgpath : imagelist) {
-        auto idx = imgpath.rfind("/");
-        string imgname(imgpath);
-        if (idx != string::npos)
-            imgname = imgpath.substr(idx + 1);
-        cout << imgname << endl;
-
-        cv::Mat img;
-        img = cv::imread(imgpath, 1);
-        if (!img.data) {
-            fprintf(stderr, "failed to read %s\n", imgpath.c_str());
-            return -1;
+    enum { QUEUED, DONE, SKIPPED, FAILED };
+    struct Slot
+    {
+        string path;
+        storm::Image image;
+        int state;
+    };
+    const size_t window = 64 * max(1, threads);
+    vector<Slot> slots(window);
+    mutex lock;
+    // a slot freed for the reader, a path for the workers, a probe done
+    condition_variable space, work, done;
+    size_t nread = 0, nprobed = 0, nemitted = 0;
+    bool eof = false, stop = false;
+
+    thread reader([&] {
+        string line;
+        while (getline(ifile, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            unique_lock<mutex> lk(lock);
+            space.wait(lk, [&] { return stop || nread < nemitted + window; });
+            if (stop)
+                return;
+            Slot &s = slots[nread++ % window];
+            s.path.swap(line);
+            s.state = QUEUED;
+            work.notify_one();
         }
+        lock_guard<mutex> lk(lock);
+        eof = true;
+        work.notify_all();
+        done.notify_one();
+    });
+
+    // a slot is not reused before it is emitted, so its fields are the
+    // worker's alone while it probes
+    auto probe = [&] {
+        unique_lock<mutex> lk(lock);
+        for (;;) {
+            work.wait(lk, [&] { return stop || eof || nprobed < nread; });
+            if (stop || nprobed == nread)
+                return;
+            Slot &s = slots[nprobed++ % window];
+            lk.unlock();
+
+            // JPEG dimensions come from the header alone; anything else
+            // still needs a full decode
+            int cols = 0, rows = 0, state = DONE;
+            jpeg::JpegInfo info;
+            if (jpeg::probe(s.path, info)) {
+                cols = info.width;
+                rows = info.height;
+            } else {
+                cv::Mat img = cv::imread(s.path, 1);
+                if (img.data) {
+                    cols = img.cols;
+                    rows = img.rows;
+                } else {
+                    state = FAILED;
+                }
+            }
+            if (state == DONE && (size_t)cols * rows > IMG_TOO_BIG_THRESH)
+                state = SKIPPED;
+
+            s.image.Clear();
+            if (state == DONE) {
+                auto idx = s.path.rfind("/");
+                string imgname(idx == string::npos ? s.path
+                        : s.path.substr(idx + 1));
+                s.image.set_key_id(imgname);
+                s.image.set_width(cols);
+                s.image.set_height(rows);
+                s.image.set_depth(3); // always loaded as color
+                s.image.set_key_data(imgname + "::data");
+                s.image.set_path(s.path);
+            }
 
-        if (img.total() > IMG_TOO_BIG_THRESH) {
+            lk.lock();
+            s.state = state;
+            // only the one the writer waits on matters to it
+            if (&s == &slots[nemitted % window])
+                done.notify_one();
+        }
+    };
+    vector<thread> pool;
+    for (int t = 0; t < max(1, threads); t++)
+        pool.push_back(thread(probe));
+
+    int ret = 0;
+    unique_lock<mutex> lk(lock);
+    for (;;) {
+        done.wait(lk, [&] {
+            return (nemitted < nread && slots[nemitted % window].state != QUEUED)
+                || (eof && nemitted == nread);
+        });
+        if (nemitted == nread)
+            break;
+        Slot &s = slots[nemitted % window];
+        lk.unlock();
+
+        auto idx = s.path.rfind("/");
+        cout << (idx == string::npos ? s.path : s.path.substr(idx + 1)) << endl;
+        if (s.state == FAILED) {
+            fprintf(stderr, "failed to read %s\n", s.path.c_str());
+            ret = -1;
+        } else if (s.state == SKIPPED) {
             cout << "   skipping; too big" << endl;
-            continue;
+        } else {
+            ret = sink(s.image);
         }
 
-        storm::Image image;
-        string s; // serialized header
-        image.set_key_id(imgname);
-        image.set_width(img.cols);
-        image.set_height(img.rows);
-        image.set_depth(img.elemSize());
-        image.set_key_data(imgname + "::data");
-        image.set_path(imgpath);
-
-        images.push_back(image);
-
-        len = image.ByteSize();
-        if (len > buflen)
-            if (!(buf = realloc(buf, (buflen = len))))
-                return -1;
-        coded_output.WriteVarint32(len);
-        image.SerializeToArray(buf, buflen);
-        coded_output.WriteRaw(buf, len);
+        lk.lock();
+        nemitted++;
+        space.notify_one();
+        if (ret)
+            break;
     }
-    free(buf);
-    return 0;
+    stop = true;
+    space.notify_all();
+    work.notify_all();
+    lk.unlock();
+
+    reader.join();
+    for (thread &t : pool)
+        t.join();
+    return ret;
+}
+
+// full path to image per line
+int load_images(string &path)
+{
+    printf(">> Loading images...\n");
+
+    string pbname("imagelist.pb");
+    cout << "Writing image list to " << pbname << endl;
+
+    SnapshotWriter out;
+    if (out.open(pbname, "image"))
+        return -1;
+    if (ingest_images(path, probe_threads(),
+                [&](const storm::Image &image) { return out.add(image); }))
+        return -1;
+    return out.close();
 }
 
 // appends contents of file to lines
@@ -202,10 +333,242 @@ int read_lines(string &fname, deque<string> &lines)
     return 0;
 }
 
-set<string> vertices;
-set<string> edges;
 map<id, storm::Vertex> graph;
 
+// Vertex IDs in the SNAP gplus data are decimal strings of up to 21
+// digits, too long for uint64_t, so they are parsed into 128 bits (with
+// the digit count, to keep any leading zeros) and interned as dense
+// uint32_t numbers.
+struct VertexKey
+{
+    unsigned __int128 v;
+    uint8_t len;
+
+    bool operator==(const VertexKey &o) const
+        { return v == o.v && len == o.len; }
+};
+
+struct VertexKeyHash
+{
+    size_t operator()(const VertexKey &k) const
+    {
+        uint64_t h = (uint64_t)k.v ^ ((uint64_t)(k.v >> 64) * 0x9E3779B97F4A7C15ULL);
+        h = (h ^ k.len) * 0xFF51AFD7ED558CCDULL;
+        return h ^ (h >> 32);
+    }
+};
+
+// false unless [p, end) is 1 to 38 decimal digits
+static bool parse_vertex(const char *p, const char *end, VertexKey &k)
+{
+    if (end <= p || end - p > 38)
+        return false;
+    k.v = 0;
+    k.len = end - p;
+    for (; p < end; p++) {
+        unsigned d = *p - '0';
+        if (d > 9)
+            return false;
+        k.v = k.v * 10 + d;
+    }
+    return true;
+}
+
+static string vertex_name(const VertexKey &k)
+{
+    string s(k.len, '0');
+    unsigned __int128 v = k.v;
+    for (int i = k.len - 1; i >= 0; i--, v /= 10)
+        s[i] = '0' + (int)(v % 10);
+    return s;
+}
+
+// Concurrent interner. Keys hash to one of SHARDS maps, each under its
+// own lock; numbers come from one counter so they are dense, though in
+// no particular order.
+class VertexTable
+{
+    public:
+        VertexTable(void) : next(0) { ; }
+
+        uint32_t intern(const VertexKey &k)
+        {
+            Shard &sh = shards[VertexKeyHash()(k) % SHARDS];
+            lock_guard<mutex> lk(sh.lock);
+            auto it = sh.ids.find(k);
+            if (it != sh.ids.end())
+                return it->second;
+            uint32_t id = next++;
+            sh.ids.emplace(k, id);
+            return id;
+        }
+
+        size_t size(void) const { return next; }
+
+        // indexed by number; call once interning is done
+        vector<VertexKey> keys(void) const
+        {
+            vector<VertexKey> out(next);
+            for (const Shard &sh : shards)
+                for (auto &e : sh.ids)
+                    out[e.second] = e.first;
+            return out;
+        }
+
+    private:
+        enum { SHARDS = 64 };
+        struct Shard
+        {
+            mutex lock;
+            unordered_map<VertexKey, uint32_t, VertexKeyHash> ids;
+        };
+        Shard shards[SHARDS];
+        atomic<uint32_t> next;
+};
+
+// an edge a -> b, sortable by a then b
+static inline uint64_t edge_of(uint32_t a, uint32_t b)
+{
+    return ((uint64_t)a << 32) | b;
+}
+
+// Per-thread output of parsing egos: edges from .edges files (and the
+// ego's own link to both ends), and ego <- follower pairs from
+// .followers files, which add only the follower side.
+struct EgoEdges
+{
+    vector<uint64_t> edges;
+    vector<uint64_t> followers;
+    unordered_map<VertexKey, uint32_t, VertexKeyHash> cache;
+};
+
+// Call fn(line, end) for each line of the file at path. A missing file
+// is an error; an empty one is not.
+template <typename F>
+static int map_lines(const string &path, F fn)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror(("open file " + path).c_str());
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    int ret = 0;
+    const char *p = (const char*)map, *end = p + st.st_size;
+    while (p < end && ret == 0) {
+        const char *nl = (const char*)memchr(p, '\n', end - p);
+        if (!nl)
+            nl = end;
+        ret = fn(p, nl);
+        p = nl + 1;
+    }
+    munmap(map, st.st_size);
+    return ret;
+}
+
+// next whitespace-separated token of [p, end), advancing p past it
+static inline bool next_token(const char *&p, const char *end,
+        const char *&tok, const char *&tokend)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    tok = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+        p++;
+    tokend = p;
+    return tok < tokend;
+}
+
+static int parse_ego(EgoID &egoid, VertexTable &table, EgoEdges &out)
+{
+    auto intern = [&](const char *p, const char *end, uint32_t &id) {
+        VertexKey k;
+        if (!parse_vertex(p, end, k)) {
+            cerr << "bad vertex id '" << string(p, end) << "' in "
+                << egoid.path << endl;
+            return false;
+        }
+        auto it = out.cache.find(k);
+        if (it != out.cache.end()) {
+            id = it->second;
+        } else {
+            id = table.intern(k);
+            out.cache.emplace(k, id);
+        }
+        return true;
+    };
+
+    const string &e = egoid.id;
+    uint32_t ego;
+    if (!intern(e.data(), e.data() + e.size(), ego))
+        return -1;
+
+    int ret = map_lines(egoid.path + ".edges",
+            [&](const char *p, const char *end) {
+        const char *t1, *t1end, *t2, *t2end;
+        if (!next_token(p, end, t1, t1end))
+            return 0; // blank line
+        if (!next_token(p, end, t2, t2end)) {
+            cerr << "bad edge '" << string(t1, end) << "' in "
+                << egoid.path << endl;
+            return -1;
+        }
+        uint32_t v1, v2;
+        if (!intern(t1, t1end, v1) || !intern(t2, t2end, v2))
+            return -1;
+        // egoid also follows all nodes in file
+        out.edges.push_back(edge_of(v1, v2));
+        out.edges.push_back(edge_of(ego, v1));
+        out.edges.push_back(edge_of(ego, v2));
+        return 0;
+    });
+    if (ret)
+        return ret;
+
+    return map_lines(egoid.path + ".followers",
+            [&](const char *p, const char *end) {
+        const char *t, *tend;
+        uint32_t f;
+        if (!next_token(p, end, t, tend))
+            return 0;
+        if (!intern(t, tend, f))
+            return -1;
+        out.followers.push_back(edge_of(ego, f));
+        return 0;
+    });
+}
+
+// concatenate parts into one sorted array without duplicates
+static void sort_unique(vector< vector<uint64_t> > &parts,
+        vector<uint64_t> &out)
+{
+    size_t n = 0;
+    for (auto &p : parts)
+        n += p.size();
+    out.clear();
+    out.reserve(n);
+    for (auto &p : parts) {
+        out.insert(out.end(), p.begin(), p.end());
+        vector<uint64_t>().swap(p);
+    }
+    sort(out.begin(), out.end());
+    out.erase(unique(out.begin(), out.end()), out.end());
+}
+
 int split_string(const string &text, deque<string> &tokens, const string &_delim)
 {
     char *copy = strdup(text.c_str());
@@ -272,10 +635,10 @@ int handle_feat(string &feats, deque<string> featidx)
 }
 
 // once called, egoids, edges are created
-// graph has entries for all vertices; now fill in rest
+// graph has entries for all vertices; now fill in features and circles
 int handle_ego(egoid_t &egoid)
 {
-    deque<string> circles, feats, featidx, followers;
+    deque<string> circles, feats, featidx;
 
     string fname(egoid.path + ".featnames");
     if (read_lines(fname, featidx))
@@ -301,11 +664,7 @@ int handle_ego(egoid_t &egoid)
         if (handle_feat(feat, featidx))
             return -1;
 
-    fname = egoid.path + ".followers";
-    if (read_lines(fname, followers))
-        return -1;
-    for (auto &f : followers)
-        graph.at(egoid.id).add_followers(f);
+    // .followers is read with the edges, in parse_ego
 
     fname = egoid.path + ".circles";
     if (read_lines(fname, circles))
@@ -325,6 +684,142 @@ int handle_ego(egoid_t &egoid)
     return 0;
 }
 
+// Write the adjacency built in load_graph as a GraphCSR. Edges number
+// vertices by rank in ID order (names[order[rank]]); vertices of graph
+// that no edge names, known only from feature files, are merged in,
+// which renumbers the edges but keeps them sorted. all gets the IDs by
+// their number in the file.
+static int write_csr(const string &path, const vector<string> &names,
+        const vector<uint32_t> &order, vector<uint64_t> &following,
+        vector<uint64_t> &followers, vector<string> &all)
+{
+    all.clear();
+    vector<bool> present;
+    vector<uint32_t> renum(order.size());
+    all.reserve(max(order.size(), graph.size()));
+    present.reserve(all.capacity());
+    auto g = graph.begin();
+    for (size_t r = 0; r < order.size(); r++) {
+        const string &name = names[order[r]];
+        for (; g != graph.end() && g->first < name; ++g) {
+            all.push_back(g->first);
+            present.push_back(true);
+        }
+        bool in = g != graph.end() && g->first == name;
+        if (in)
+            ++g;
+        renum[r] = all.size();
+        all.push_back(name);
+        present.push_back(in);
+    }
+    for (; g != graph.end(); ++g) {
+        all.push_back(g->first);
+        present.push_back(true);
+    }
+    if (all.size() != order.size())
+        for (vector<uint64_t> *edges : { &following, &followers })
+            for (uint64_t &e : *edges)
+                e = edge_of(renum[e >> 32], renum[(uint32_t)e]);
+
+    cout << "Writing adjacency to " << path << endl;
+    return GraphCSR::write(path, all, present, following, followers);
+}
+
+// the AttrIndex keys of v's features
+static void attr_keys(const storm::Vertex &v, vector<string> &keys)
+{
+    keys.clear();
+    auto add = [&](const char *attr,
+            const google::protobuf::RepeatedPtrField<string> &vals) {
+        for (const string &val : vals)
+            keys.push_back(string(attr) + ":" + val);
+    };
+    add("circles", v.circles());
+    if (v.has_gender())
+        keys.push_back("gender:" + to_string(v.gender()));
+    add("inst", v.inst());
+    add("univ", v.univ());
+    add("name", v.name());
+    add("place", v.place());
+    add("jobtitle", v.jobtitle());
+}
+
+// Index the features handle_ego filled in, by the vertex numbers of the
+// CSR written from all
+static int write_attrs(const string &path, const vector<string> &all)
+{
+    map<string, Bitmap> index;
+    vector<string> keys;
+    size_t v = 0;
+    for (auto &g : graph) { // both in ID order
+        while (all[v] < g.first)
+            v++;
+        attr_keys(g.second, keys);
+        for (const string &k : keys)
+            index[k].add(v);
+    }
+    cout << "Writing " << index.size() << " attribute bitmaps to "
+        << path << endl;
+    return AttrIndex::write(path, all.size(), index);
+}
+
+// Export a graph.csr as a Galois .gr file (version 1, 32-bit weights,
+// all 1) for the LonestarGPU reader and the CPU kernels in src/lonestar.
+// A vertex's out-edges are its following and followers merged, less
+// duplicates and itself, so the graph is symmetric, as neighbor
+// queries walk it.
+int export_gr(const string &csrpath, const string &grpath)
+{
+    GraphCSR g;
+    if (g.open(csrpath))
+        return -1;
+
+    const size_t n = g.size();
+    vector<uint64_t> idx(n);
+    vector<uint32_t> outs;
+    vector<GraphCSR::vid> adj;
+    for (GraphCSR::vid v = 0; v < n; v++) {
+        size_t len;
+        const GraphCSR::vid *e = g.following(v, len);
+        adj.assign(e, e + len);
+        e = g.followers(v, len);
+        adj.insert(adj.end(), e, e + len);
+        sort(adj.begin(), adj.end());
+        adj.erase(unique(adj.begin(), adj.end()), adj.end());
+        for (GraphCSR::vid u : adj)
+            if (u != v)
+                outs.push_back(u);
+        idx[v] = outs.size(); // .gr indexes are where each list ends
+    }
+    // the reader counts edges in 32 bits
+    if (outs.size() >= UINT32_MAX) {
+        cerr << grpath << ": too many edges" << endl;
+        return -1;
+    }
+
+    FILE *fp = fopen(grpath.c_str(), "wb");
+    if (!fp) {
+        perror(("open " + grpath).c_str());
+        return -1;
+    }
+    uint64_t hdr[4] = { 1, sizeof(uint32_t), n, outs.size() };
+    vector<uint32_t> weights(outs.size(), 1);
+    uint32_t pad = 0;
+    fwrite(hdr, sizeof(hdr), 1, fp);
+    fwrite(idx.data(), sizeof(idx[0]), idx.size(), fp);
+    fwrite(outs.data(), sizeof(outs[0]), outs.size(), fp);
+    if (outs.size() & 1) // weights start 8-byte aligned
+        fwrite(&pad, sizeof(pad), 1, fp);
+    fwrite(weights.data(), sizeof(weights[0]), outs.size(), fp);
+    if (ferror(fp) | fclose(fp)) {
+        perror(("write " + grpath).c_str());
+        return -1;
+    }
+    cout << "Wrote " << n << " vertices, " << outs.size()
+        << " edges to " << grpath << endl;
+    return 0;
+}
+
 // search for files in egonet (SNAP data)
 // file should just be a list of ego IDs
 //      e.g. /path/to/files/egoid
@@ -340,43 +835,83 @@ int load_graph(string &path)
         egoids.push_back(ego);
     }
 
-    // collect all edges among all files
+    auto t0 = chrono::steady_clock::now();
+
+    // parse all .edges and .followers files, an ego at a time per thread
     cout << "Parsing edges... (" << egoids.size()
         << " egos)" << endl;
-    for (EgoID &egoid : egoids) {
-        string fname(egoid.path + ".edges");
-        cout << "    -> " << egoid.id; cout.flush(); fflush(stdout);
-        deque<string> _edges;
-        if (read_lines(fname, _edges))
-            return -1;
-        cout << " " << _edges.size() << " edges" << endl;
-        for (string &edge : _edges) {
-            edges.insert(edge);
-            // egoid also follows all nodes in file
-            auto idx = edge.find(" ");
-            string v1 = edge.substr(0, idx), v2 = edge.substr(idx + 1);
-            string egolink = egoid.id + " " + v1; 
-            edges.insert(egolink);
-            egolink = egoid.id + " " + v2; 
-            edges.insert(egolink);
-
-            vertices.insert(v1);
-            vertices.insert(v2);
-            vertices.insert(egoid.id);
-        }
-    }
-    cout << "Initializing edges... (" << edges.size()
-        << " edges)" << endl;
-    for (auto &edge : edges) {
-        auto idx = edge.find(" ");
-        string n1 = edge.substr(0, idx), n2 = edge.substr(idx + 1);
-        //cout << "    " << n1 << " " << n2 << endl;
+    VertexTable table;
+    const size_t nthreads = max(1U, thread::hardware_concurrency());
+    vector<EgoEdges> parsed(nthreads);
+    atomic<size_t> nextego(0);
+    atomic<int> failed(0);
+    auto work = [&](size_t t) {
+        size_t i;
+        while (!failed && (i = nextego++) < egoids.size())
+            if (parse_ego(egoids[i], table, parsed[t]))
+                failed = 1;
+        parsed[t].cache.clear();
+    };
+    vector<thread> pool;
+    for (size_t t = 1; t < nthreads; t++)
+        pool.push_back(thread(work, t));
+    work(0);
+    for (thread &t : pool)
+        t.join();
+    if (failed)
+        return -1;
 
-        storm::Vertex *v1 = &graph[n1], *v2 = &graph[n2];
-        v1->set_key_id(n1);
-        v1->add_following(n2);
-        v2->set_key_id(n2);
-        v2->add_followers(n1);
+    // renumber vertices in ID string order, so each sorted adjacency
+    // list below comes out in the order the old set<string> gave it
+    const size_t nv = table.size();
+    vector<string> names(nv);
+    {
+        vector<VertexKey> keys(table.keys());
+        for (size_t i = 0; i < nv; i++)
+            names[i] = vertex_name(keys[i]);
+    }
+    vector<uint32_t> order(nv), rank(nv);
+    for (size_t i = 0; i < nv; i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return names[a] < names[b]; });
+    for (size_t i = 0; i < nv; i++)
+        rank[order[i]] = i;
+
+    // following: a -> b sorted by a; followers: b <- a sorted by b
+    vector< vector<uint64_t> > parts(nthreads), fparts(nthreads);
+    for (size_t t = 0; t < nthreads; t++) {
+        for (uint64_t &e : parsed[t].edges)
+            e = edge_of(rank[e >> 32], rank[(uint32_t)e]);
+        parts[t].swap(parsed[t].edges);
+        fparts[t].swap(parsed[t].followers);
+        for (uint64_t &e : fparts[t])
+            e = edge_of(rank[e >> 32], rank[(uint32_t)e]);
+    }
+    vector<uint64_t> following, followers;
+    sort_unique(parts, following);
+    for (uint64_t e : following)
+        fparts[0].push_back(edge_of((uint32_t)e, e >> 32));
+    sort_unique(fparts, followers);
+
+    cout << "Initializing edges... (" << following.size()
+        << " edges, " << nv << " vertices)" << endl;
+    size_t fi = 0, ri = 0;
+    for (uint32_t v = 0; v < nv; v++) {
+        size_t fe = fi, re = ri;
+        while (fe < following.size() && (following[fe] >> 32) == v)
+            fe++;
+        while (re < followers.size() && (followers[re] >> 32) == v)
+            re++;
+        if (fe == fi && re == ri)
+            continue; // only named in a .followers file
+        const string &name = names[order[v]];
+        storm::Vertex *vtx = &graph[name];
+        vtx->set_key_id(name);
+        for (; fi < fe; fi++)
+            vtx->add_following(names[order[(uint32_t)following[fi]]]);
+        for (; ri < re; ri++)
+            vtx->add_followers(names[order[(uint32_t)followers[ri]]]);
     }
 
     cout << "Parsing remaining..." << endl;
@@ -385,27 +920,26 @@ int load_graph(string &path)
             return -1;
     }
 
-    for (string id : vertices) {
-        set<string> uniq;
-        storm::Vertex *v = &graph.at(id);
-
-        // remove duplicates from following
-        for (int f = 0; f < v->following_size(); f++)
-            uniq.insert(v->following(f));
-        v->clear_following();
-        for (auto &f : uniq)
-            v->add_following(f);
-
-        // and from followers
-        uniq.clear();
-        for (int f = 0; f < v->followers_size(); f++)
-            uniq.insert(v->followers(f));
-        v->clear_followers();
-        for (auto &f : uniq)
-            v->add_followers(f);
-    }
-
-    // choose images for each vertex
+    vector<string> all;
+    if (write_csr("graph.csr", names, order, following, followers, all))
+        return -1;
+    vector<uint64_t>().swap(following);
+    vector<uint64_t>().swap(followers);
+    if (write_attrs("graph.attr", all))
+        return -1;
+    vector<string>().swap(all);
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    cout << "Graph built in " << chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - t0).count() << " ms, peak RSS "
+        << ru.ru_maxrss / 1024 << " MB" << endl;
+
+    // choose images for each vertex, from the list load_images wrote
+    SnapshotReader imagelist;
+    if (imagelist.open("imagelist.pb", "image")
+            || !imagelist.verify(0, imagelist.size()))
+        return -1;
     for (auto &g : graph) {
         storm::Vertex *v = &g.second;
         // arbitrarily but deterministically determine count
@@ -414,55 +948,41 @@ int load_graph(string &path)
         // pick n images at this place
         size_t imgidx = (v->followers_size() + v->following_size() +
                 v->gender() * 10 + v->circles_size()) %
-                (images.size() - n_to_assign);
+                (imagelist.size() - n_to_assign);
         //cout << "    images " << v->key() << ": #" << n_to_assign
             //<< " at " << imgidx << endl;
-        while (n_to_assign > 0) {
-            v->add_images(images.at(imgidx++).key_id());
-            n_to_assign--;
+        if (imgidx + n_to_assign > imagelist.size())
+            throw out_of_range(string(__func__) + ": too few images");
+        for ( ; n_to_assign > 0; n_to_assign--) {
+            size_t len;
+            const void *data = imagelist.data(imgidx++, len);
+            storm::Image image;
+            if (!image.ParseFromArray(data, len))
+                return -1;
+            v->add_images(image.key_id());
         }
     }
+    imagelist.close();
 
     // -----------------------------------------------
 
     string pbname("graph.pb");
     cout << "Writing graph data to " << pbname << endl;
 
-    int fd = open(pbname.data(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
-    if (fd < 0) return -1;
-    unique_ptr<ZeroCopyOutputStream> raw_output(new FileOutputStream(fd));
-
-    {
-        CodedOutputStream coded_output(raw_output.get());
-        coded_output.WriteVarint32(graph.size());
-    }
-
-    void *buf(nullptr);
-    size_t buflen(0), len(0);
-    for (auto &g : graph) {
-        // Must destroy and recreate CodedInputStream with each Protobuf...
-        // https://groups.google.com/forum/#!topic/protobuf/ZKB5EePJDNU
-        CodedOutputStream coded_output(raw_output.get());
-        storm::Vertex *v = &g.second;
-        len = v->ByteSize();
-        if (len > buflen)
-            if (!(buf = realloc(buf, (buflen = len))))
-                return -1;
-        coded_output.WriteVarint32(len);
-        v->SerializeToCodedStream(&coded_output);
-    }
-    free(buf);
-    raw_output.release();
-    close(fd);
-
-    return 0;
+    SnapshotWriter out;
+    if (out.open(pbname, "vertex"))
+        return -1;
+    for (auto &g : graph)
+        if (out.add(g.second))
+            return -1;
+    return out.close();
 }
 
 // write out the IDs of all vertices so someone can query them directly...
 // putting into one protobuf would cause the PB lib to complain the PB is
 // 'too large'
 void
-write_graphids_file(std::string &path, deque<string> &nodes)
+write_graphids_file(std::string &path, vector<string> &nodes)
 {
     //string idlist("graph-ids.txt");
     cout << "Writing graph ids to " << path << endl;
@@ -500,6 +1020,422 @@ make_proto(string &egolist, string &images)
     return 0;
 }
 
+// Stores objects on a pool of threads, each with its own connection.
+// Objects are either in memory or files the workers read themselves, so
+// reading, sending and waiting on replies all overlap. Every set simply
+// overwrites, which makes a load safe to repeat.
+//
+// In BUFFERED and NOREPLY modes a worker sends up to batch sets, flushes
+// them, and then gets one sentinel key on each server; a server answers
+// only after the sets sent to it before, so those objects are then
+// counted as sent. libmemcached drops the replies to buffered sets, so a
+// set that failed on the server goes unnoticed there, and only SYNC,
+// which checks every one, counts objects as stored. Deletes go the same
+// way.
+class BulkLoader
+{
+    public:
+        BulkLoader(memcached_st *memc, const LoadOptions &opts);
+        ~BulkLoader(void);
+
+        void put(const string &key, const void *val, size_t len);
+        void putFile(const string &key, const string &path);
+        void remove(const string &key);
+        // wait for everything queued; returns the number of failures
+        size_t finish(void);
+
+    private:
+        struct Item
+        {
+            string key;
+            string val;  // empty when path is set
+            string path;
+            bool del;
+
+            Item(void) : del(false) { ; }
+        };
+
+        void push(Item &&item);
+        void worker(memcached_st *mc);
+        bool ack(memcached_st *mc, size_t &pending);
+        void pace(void);
+        void report(bool last);
+
+        const LoadOptions opts;
+        vector<memcached_st*> conns;
+        vector<string> sentinels; // a key on each server, for ack()
+        vector<thread> workers;
+        thread reporter;
+
+        mutex lock;
+        condition_variable notempty, notfull, tick;
+        deque<Item> queue;
+        size_t capacity;
+        bool closed;
+
+        mutex ratelock;
+        chrono::steady_clock::time_point nextslot;
+
+        chrono::steady_clock::time_point start;
+        atomic<size_t> stored, failed, bytes;
+};
+
+BulkLoader::BulkLoader(memcached_st *memc, const LoadOptions &o)
+    : opts(o), capacity(max(1, o.threads) * max(1, o.batch) * 2),
+    closed(false), nextslot(chrono::steady_clock::now()),
+    start(chrono::steady_clock::now()), stored(0), failed(0), bytes(0)
+{
+    for (int i = 0; i < max(1, opts.threads); i++) {
+        memcached_st *mc = memcached_clone(NULL, memc);
+        if (!mc)
+            throw runtime_error(string(__func__) + ": memcached_clone failed");
+        if (opts.mode != LoadOptions::SYNC)
+            memcached_behavior_set(mc, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, 1);
+        if (opts.mode == LoadOptions::NOREPLY)
+            memcached_behavior_set(mc, MEMCACHED_BEHAVIOR_NOREPLY, 1);
+        conns.push_back(mc);
+    }
+    const uint32_t nservers = memcached_server_count(memc);
+    vector<string> each(nservers);
+    size_t found = 0;
+    for (uint32_t n = 0; found < nservers && n < 64 * nservers; n++) {
+        string key("bulkload::ack::" + to_string(n));
+        uint32_t s = memcached_generate_hash(memc, key.c_str(), key.length());
+        if (s < nservers && each[s].empty()) {
+            each[s] = key;
+            found++;
+        }
+    }
+    for (string &key : each)
+        if (!key.empty())
+            sentinels.push_back(key);
+    if (opts.mode != LoadOptions::SYNC && found < nservers)
+        fprintf(stderr, "warning: %u of %u servers cannot be acknowledged\n",
+                nservers - (uint32_t)found, nservers);
+    for (memcached_st *mc : conns)
+        workers.push_back(thread(&BulkLoader::worker, this, mc));
+    reporter = thread([this] {
+        unique_lock<mutex> lk(lock);
+        while (!tick.wait_for(lk, chrono::seconds(2), [this] { return closed; })) {
+            lk.unlock();
+            report(false);
+            lk.lock();
+        }
+    });
+}
+
+BulkLoader::~BulkLoader(void)
+{
+    finish();
+    for (memcached_st *mc : conns)
+        memcached_free(mc);
+}
+
+void BulkLoader::put(const string &key, const void *val, size_t len)
+{
+    Item item;
+    item.key = key;
+    item.val.assign((const char*)val, len);
+    push(move(item));
+}
+
+void BulkLoader::putFile(const string &key, const string &path)
+{
+    Item item;
+    item.key = key;
+    item.path = path;
+    push(move(item));
+}
+
+void BulkLoader::remove(const string &key)
+{
+    Item item;
+    item.key = key;
+    item.del = true;
+    push(move(item));
+}
+
+void BulkLoader::push(Item &&item)
+{
+    unique_lock<mutex> lk(lock);
+    notfull.wait(lk, [this] { return queue.size() < capacity; });
+    queue.push_back(move(item));
+    notempty.notify_one();
+}
+
+size_t BulkLoader::finish(void)
+{
+    {
+        lock_guard<mutex> lk(lock);
+        if (closed && workers.empty())
+            return failed;
+        closed = true;
+        notempty.notify_all();
+        tick.notify_all();
+    }
+    for (thread &t : workers)
+        t.join();
+    workers.clear();
+    if (reporter.joinable())
+        reporter.join();
+    report(true);
+    return failed;
+}
+
+// spread objects evenly over time when a rate is set
+void BulkLoader::pace(void)
+{
+    if (opts.rate <= 0)
+        return;
+    auto gap = chrono::duration_cast<chrono::steady_clock::duration>(
+            chrono::duration<double>(1. / opts.rate));
+    chrono::steady_clock::time_point slot;
+    {
+        lock_guard<mutex> lk(ratelock);
+        slot = max(nextslot, chrono::steady_clock::now());
+        nextslot = slot + gap;
+    }
+    this_thread::sleep_until(slot);
+}
+
+bool BulkLoader::ack(memcached_st *mc, size_t &pending)
+{
+    if (!pending)
+        return true;
+    auto mret = memcached_flush_buffers(mc);
+    for (size_t i = 0; i < sentinels.size() && mret == MEMCACHED_SUCCESS; i++) {
+        size_t len;
+        uint32_t flags;
+        char *val = memcached_get(mc, sentinels[i].c_str(),
+                sentinels[i].length(), &len, &flags, &mret);
+        free(val);
+        if (mret == MEMCACHED_NOTFOUND)
+            mret = MEMCACHED_SUCCESS;
+    }
+    if (mret != MEMCACHED_SUCCESS) {
+        fprintf(stderr, "memc error: %s\n", memcached_strerror(mc, mret));
+        failed += pending;
+    } else {
+        stored += pending;
+    }
+    pending = 0;
+    return mret == MEMCACHED_SUCCESS;
+}
+
+void BulkLoader::worker(memcached_st *mc)
+{
+    size_t pending = 0; // sent but not yet acknowledged
+    for (;;) {
+        Item item;
+        {
+            unique_lock<mutex> lk(lock);
+            auto ready = [this] { return closed || !queue.empty(); };
+            while (!ready()) {
+                if (!pending) {
+                    notempty.wait(lk, ready);
+                } else if (!notempty.wait_for(lk, chrono::milliseconds(10),
+                            ready)) {
+                    // the producer has stalled; settle the batch so far
+                    lk.unlock();
+                    ack(mc, pending);
+                    lk.lock();
+                }
+            }
+            if (queue.empty())
+                break;
+            item = move(queue.front());
+            queue.pop_front();
+            notfull.notify_one();
+        }
+
+        if (item.del) {
+            pace();
+            auto mret = memcached_delete(mc, item.key.c_str(),
+                    item.key.length(), 0);
+            if (mret == MEMCACHED_BUFFERED
+                    || (mret == MEMCACHED_SUCCESS && opts.mode != LoadOptions::SYNC)) {
+                if (++pending >= (size_t)opts.batch)
+                    ack(mc, pending);
+            } else if (mret == MEMCACHED_SUCCESS || mret == MEMCACHED_NOTFOUND) {
+                stored++;
+            } else {
+                fprintf(stderr, "memc error: delete %s: %s\n",
+                        item.key.c_str(), memcached_strerror(mc, mret));
+                failed++;
+            }
+            continue;
+        }
+
+        const char *val = item.val.data();
+        size_t len = item.val.size();
+        MappedFile file;
+        vector<uchar> rst;
+        if (!item.path.empty()) {
+            if (file.open(item.path)) {
+                fprintf(stderr, "failed to read %s\n", item.path.c_str());
+                failed++;
+                continue;
+            }
+            val = (const char*)file.data;
+            len = file.len;
+            jpeg::JpegInfo info;
+            if (opts.restart && jpeg::probe(file.data, len, info)
+                    && (info.restart_interval == 0 || info.progressive)
+                    && jpeg::addRestartMarkers(file.data, len, rst)) {
+                val = (const char*)rst.data();
+                len = rst.size();
+            }
+        }
+
+        pace();
+        auto mret = memcached_set(mc, item.key.c_str(), item.key.length(),
+                val, len, 0, 0);
+        bytes += len;
+        if (mret == MEMCACHED_BUFFERED
+                || (mret == MEMCACHED_SUCCESS && opts.mode != LoadOptions::SYNC)) {
+            if (++pending >= (size_t)opts.batch)
+                ack(mc, pending);
+        } else if (mret == MEMCACHED_SUCCESS) {
+            stored++;
+        } else {
+            fprintf(stderr, "memc error: %s: %s\n", item.key.c_str(),
+                    memcached_strerror(mc, mret));
+            failed++;
+        }
+    }
+    ack(mc, pending);
+}
+
+void BulkLoader::report(bool last)
+{
+    double sec = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+    size_t n = stored, mb = bytes >> 20;
+    fprintf(stdout, "%s%zu %s, %zu failed, %zu MB in %.1f s"
+            " (%.0f obj/s, %.1f MB/s)%s",
+            last ? "" : "\r    ", n,
+            opts.mode == LoadOptions::SYNC ? "stored" : "sent",
+            (size_t)failed, mb, sec,
+            sec > 0 ? n / sec : 0., sec > 0 ? mb / sec : 0.,
+            last ? "\n" : "");
+    fflush(stdout);
+}
+
+// What a load stored under each key. After a header line and a line of
+// the load options that change what is stored from a file, one line per
+// key:
+//
+//      hash size mtime key
+//
+// hash is FNV-1a of the value's source: the snapshot record, or the
+// image file mixed with those options. Files also keep their size and
+// mtime, so one that was not touched since need not be read to be
+// hashed again; records have 0.
+struct ManifestEntry
+{
+    uint64_t hash;
+    uint64_t size;
+    int64_t mtime; // nanoseconds
+};
+
+typedef unordered_map<string, ManifestEntry> Manifest;
+
+static const char MANIFEST_HEADER[] = "# load_egonet manifest v1";
+
+// a missing file is an empty manifest
+int read_manifest(const string &path, Manifest &m, string &options)
+{
+    m.clear();
+    options.clear();
+    ifstream file(path);
+    if (!file.is_open())
+        return 0;
+    string line;
+    if (!getline(file, line) || line != MANIFEST_HEADER
+            || !getline(file, options)) {
+        cerr << path << ": not a manifest" << endl;
+        return -1;
+    }
+    while (getline(file, line)) {
+        ManifestEntry e;
+        int off = 0;
+        if (sscanf(line.c_str(), "%" SCNx64 " %" SCNu64 " %" SCNd64 " %n",
+                    &e.hash, &e.size, &e.mtime, &off) != 3 || off == 0
+                || (size_t)off >= line.size()) {
+            cerr << path << ": bad line '" << line << "'" << endl;
+            return -1;
+        }
+        m[line.substr(off)] = e;
+    }
+    return 0;
+}
+
+// written aside and renamed, so a crash leaves the old one in place
+int write_manifest(const string &path, const string &options,
+        const vector< pair<string, ManifestEntry> > &entries)
+{
+    string tmp(path + ".tmp");
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp) {
+        perror(("open " + tmp).c_str());
+        return -1;
+    }
+    fprintf(fp, "%s\n%s\n", MANIFEST_HEADER, options.c_str());
+    for (auto &e : entries)
+        if (!e.first.empty())
+            fprintf(fp, "%016" PRIx64 " %" PRIu64 " %" PRId64 " %s\n",
+                    e.second.hash, e.second.size, e.second.mtime,
+                    e.first.c_str());
+    if (fclose(fp) || rename(tmp.c_str(), path.c_str())) {
+        perror(("write " + path).c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// Hash the file at path into e, reusing old's hash when size and mtime
+// say the file was not touched since. Returns -1 if it cannot be read.
+static int hash_file(const string &path, const ManifestEntry *old,
+        uint64_t variant, ManifestEntry &e)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st))
+        return -1;
+    e.size = st.st_size;
+    e.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (old && old->size == e.size && old->mtime == e.mtime && old->size) {
+        e.hash = old->hash;
+        return 0;
+    }
+    MappedFile file;
+    if (file.open(path))
+        return -1;
+    e.hash = fnv1a(&variant, sizeof(variant), fnv1a(file.data, file.len));
+    return 0;
+}
+
+// Buffered and noreply sets the servers rejected go unreported, so
+// before a manifest vouches for such a load, check that a sample of the
+// objects it sent (went[i] for entries[i]) arrived.
+static bool sent_arrived(const vector< pair<string, ManifestEntry> > &entries,
+        const vector<char> &went, size_t sample)
+{
+    vector<size_t> idx;
+    for (size_t i = 0; i < went.size(); i++)
+        if (went[i])
+            idx.push_back(i);
+    const size_t step = max((size_t)1, idx.size() / sample);
+    for (size_t k = 0; k < idx.size(); k += step) {
+        const string &key = entries[idx[k]].first;
+        if (!memc_exists(memc, key)) {
+            cout << "'" << key << "' did not arrive;"
+                " not writing the manifest" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 // load previously created protobuf files
 // insert them into object store
 int
@@ -511,61 +1447,88 @@ load_proto(string &graph_path, string &imagelist, string &config)
     if (init_memc())
         return 1;
 
+    // parsing is only needed for the keys; records go out as stored
+    const int parsers = min(4U, max(1U, thread::hardware_concurrency()));
+
+    // with a manifest, objects whose hash matches the last load are
+    // skipped; entries[] is what this load stores, by record
+    const bool delta = !load_opts.manifest.empty();
+    const string options("# restart=" + to_string(load_opts.restart));
+    Manifest old;
+    string old_options;
+    // --full still reads it, for the keys --delete drops, but sends
+    // everything; only the hash comparison is skipped
+    if (delta) {
+        if (read_manifest(load_opts.manifest, old, old_options))
+            return -1;
+        // a restarted or flushed store no longer holds what the manifest
+        // says; spot check a few keys before trusting it
+        size_t probes = 0;
+        for (auto it = old.begin(); it != old.end() && probes < 8
+                && !load_opts.full; ++it, probes++)
+            if (!memc_exists(memc, it->first)) {
+                cout << "'" << it->first << "' is missing from the store;"
+                    " ignoring the manifest" << endl;
+                old.clear();
+                break;
+            }
+        if (!old.empty())
+            cout << old.size() << " objects in " << load_opts.manifest
+                << endl;
+    }
+    auto lookup = [&](const string &key) -> const ManifestEntry* {
+        auto it = old.find(key);
+        return it == old.end() ? nullptr : &it->second;
+    };
+    // file hashes from other options must not be reused on size and mtime
+    const bool same_options = !load_opts.full && old_options == options;
+    // whether the value for key, hashing to e, needs to be sent
+    auto changed = [&](const string &key, const ManifestEntry &e) {
+        if (load_opts.full)
+            return true;
+        const ManifestEntry *o = lookup(key);
+        return !o || o->hash != e.hash;
+    };
+    vector< pair<string, ManifestEntry> > entries;
+    vector<char> went; // by entry, whether this load sent it
+    atomic<size_t> sent(0), unchanged(0), unreadable(0);
+
     // -------------------------------------------------
     cout << "Loading graph data into object store..." << endl;
 
-    int fd = open(graph_path.data(), O_RDONLY);
-    if (fd < 0) return -1;
-    unique_ptr<ZeroCopyInputStream> raw_input(new FileInputStream(fd));
+    SnapshotReader in;
+    if (in.open(graph_path, "vertex"))
+        return -1;
+    cout << in.size() << " nodes to read" << endl;
 
-    unsigned int count;
-    {
-        CodedInputStream coded_input(raw_input.get());
-        coded_input.ReadVarint32(&count);
+    vector<string> nodes(in.size()); // used for writing graph-ids file
+    if (delta) {
+        entries.resize(in.size());
+        went.resize(in.size());
     }
-
-    void *buf(nullptr);
-    size_t buflen(0);
-    unsigned int len;
-    deque<string> nodes; // used for writing graph-ids file
-
-    cout << count << " nodes to read" << endl;
-
-    while (count-- > 0) {
-        // Must destroy and recreate CodedInputStream with each Protobuf...
-        // https://groups.google.com/forum/#!topic/protobuf/ZKB5EePJDNU
-        CodedInputStream coded_input(raw_input.get());
-
-        coded_input.ReadVarint32(&len);
-        if (buflen < len)
-            if (!(buf = realloc(buf, (buflen = len))))
-                return -1;
-        // when reading, don't give protobuf the whole stream, as it will assume
-        // the entire stream belongs to a single message
-        coded_input.ReadRaw(buf, len);
-        storm::Vertex vertex;
-        if (!vertex.ParseFromArray(buf, len)) {
-            // a bug in the file or in the generation code
-            std::cerr << "protobuf could not parse object" << std::endl;
-        } else {
-            nodes.push_back(vertex.key_id().data());
-
-            // avoid duplicates.. could happen with bugs in the snapshot
-            // protobuf file
-            if (memc_exists(memc, vertex.key_id()))
-                continue;
-
-            auto mret = memcached_set(memc, vertex.key_id().c_str(),
-                    vertex.key_id().length(), (char*)buf, len, 0, 0);
-            if (mret != MEMCACHED_SUCCESS) {
-                fprintf(stderr, "memc error: %s",
-                        memcached_strerror(memc, mret));
-                return -1;
+    unique_ptr<BulkLoader> loader(new BulkLoader(memc, load_opts));
+    int ret = in.readParallel<storm::Vertex>(parsers,
+            [&](size_t i, const storm::Vertex &vertex) {
+        size_t len;
+        const void *data = in.data(i, len);
+        nodes[i] = vertex.key_id();
+        if (delta) {
+            ManifestEntry e = { fnv1a(data, len), 0, 0 };
+            entries[i] = make_pair(vertex.key_id(), e);
+            if (!changed(vertex.key_id(), e)) {
+                unchanged++;
+                return 0;
             }
         }
-    }
-    raw_input.release();
-    close(fd);
+        // duplicates (bugs in the snapshot) just overwrite each other
+        loader->put(vertex.key_id(), data, len);
+        sent++;
+        if (delta)
+            went[i] = 1;
+        return 0;
+    });
+    if (loader->finish() || ret)
+        return -1;
 
     string p("graph-ids.txt");
     write_graphids_file(p, nodes);
@@ -573,52 +1536,113 @@ load_proto(string &graph_path, string &imagelist, string &config)
     // -------------------------------------------------
     cout << "Loading image data into object store..." << endl;
 
-    fd = open(imagelist.data(), O_RDONLY);
-    if (fd < 0) return -1;
-    raw_input.reset(new FileInputStream(fd));
+    if (in.open(imagelist, "image"))
+        return -1;
 
-    {
-        CodedInputStream coded_input(raw_input.get());
-        coded_input.ReadVarint32(&count);
+    // each image is a record and a file
+    const size_t nvertex = entries.size();
+    if (delta) {
+        entries.resize(nvertex + 2 * in.size());
+        went.resize(entries.size());
     }
+    // restart markers change what is stored from the same file
+    const uint64_t variant = load_opts.restart ? 1 : 0;
+    loader.reset(new BulkLoader(memc, load_opts));
+    ret = in.readParallel<storm::Image>(parsers,
+            [&](size_t i, const storm::Image &image) {
+        size_t len;
+        const void *data = in.data(i, len);
+        bool send_record = true, send_file = true, readable = true;
+        if (delta) {
+            ManifestEntry e = { fnv1a(data, len), 0, 0 };
+            entries[nvertex + 2 * i] = make_pair(image.key_id(), e);
+            send_record = changed(image.key_id(), e);
+
+            // read here only when the file looks touched; the worker
+            // reads it again, from the page cache, if it is sent
+            if (hash_file(image.path(), same_options
+                        ? lookup(image.key_data()) : nullptr, variant, e)) {
+                fprintf(stderr, "failed to read %s\n", image.path().c_str());
+                unreadable++;
+                send_file = readable = false;
+            } else {
+                entries[nvertex + 2 * i + 1] = make_pair(image.key_data(), e);
+                send_file = changed(image.key_data(), e);
+            }
+        }
+        if (send_record) {
+            loader->put(image.key_id(), data, len);
+            sent++;
+            if (delta)
+                went[nvertex + 2 * i] = 1;
+        } else {
+            unchanged++;
+        }
+        if (send_file) {
+            // the workers load the image from disk
+            loader->putFile(image.key_data(), image.path());
+            sent++;
+            if (delta)
+                went[nvertex + 2 * i + 1] = 1;
+        } else if (readable) {
+            unchanged++;
+        }
+        return 0;
+    });
+    if (loader->finish() || ret || unreadable)
+        return -1;
+    in.close();
+
+    if (!delta)
+        return 0;
+
+    size_t removed = 0;
+    if (load_opts.prune && !old.empty()) {
+        for (auto &e : entries)
+            old.erase(e.first);
+        loader.reset(new BulkLoader(memc, load_opts));
+        for (auto &o : old)
+            loader->remove(o.first);
+        removed = old.size();
+        if (loader->finish())
+            return -1;
+    }
+    cout << sent << " changed or new, " << unchanged << " unchanged, "
+        << removed << " removed" << endl;
 
-    // reuse buf and buflen from above
+    // only after everything made it, else the next load would skip
+    // objects that never arrived; SYNC saw every store succeed
+    if (load_opts.mode != LoadOptions::SYNC && !sent_arrived(entries, went, 64))
+        return -1;
+    return write_manifest(load_opts.manifest, options, entries);
+}
 
-    while (count-- > 0) {
-        // Must destroy and recreate CodedInputStream with each Protobuf...
-        // https://groups.google.com/forum/#!topic/protobuf/ZKB5EePJDNU
-        CodedInputStream coded_input(raw_input.get());
+// probe the images in a list and store them, without a snapshot
+int
+ingest(string &imagelist, string &config)
+{
+    if (init_config(config))
+        return 1;
 
-        coded_input.ReadVarint32(&len);
-        if (buflen < len) {
-            buflen = len;
-            if (!(buf = realloc(buf, buflen))) return -1;
-        }
-        coded_input.ReadRaw(buf, len);
-        storm::Image image;
-        image.ParseFromArray(buf, len);
+    if (init_memc())
+        return 1;
 
-        auto mret = memcached_set(memc, image.key_id().c_str(),
-                image.key_id().length(), (char*)buf, len, 0, 0);
-        if (mret != MEMCACHED_SUCCESS) {
-            fprintf(stderr, "memc error: %s", memcached_strerror(memc, mret));
-            return -1;
-        }
+    cout << "Storing images in object store..." << endl;
 
-        // now load the image from disk
-        void *imgbuf(nullptr);
-        size_t imglen(0);
-        if (0 > readfile(image.path(), &imgbuf, &imglen))
+    BulkLoader loader(memc, load_opts);
+    string rec;
+    int ret = ingest_images(imagelist, probe_threads(),
+            [&](const storm::Image &image) {
+        rec.clear();
+        if (!image.AppendToString(&rec))
             return -1;
-        mret = memcached_set(memc, image.key_data().c_str(),
-                image.key_data().length(), (char*)imgbuf, imglen, 0, 0);
-        if (mret != MEMCACHED_SUCCESS) {
-            fprintf(stderr, "memc error: %s", memcached_strerror(memc, mret));
-            return -1;
-        }
-        free(imgbuf);
-    }
-    close(fd);
+        loader.put(image.key_id(), rec.data(), rec.size());
+        // the workers load the image from disk
+        loader.putFile(image.key_data(), image.path());
+        return 0;
+    });
+    if (loader.finish() || ret)
+        return -1;
 
     return 0;
 }
@@ -627,7 +1651,58 @@ void usage(void)
 {
     cerr << "Usage: cmd opts*" << endl;
     cerr << "       proto egolist imagelist" << endl;
-    cerr << "       load graph.pb imagelist.pb conf" << endl;
+    cerr << "       gr graph.csr graph.gr" << endl;
+    cerr << "       load [opts] graph.pb imagelist.pb conf" << endl;
+    cerr << "       ingest [opts] imagelist conf" << endl;
+    cerr << "         --threads=N   parallel connections (8)" << endl;
+    cerr << "         --batch=N     sets per flush and acknowledgement (64)" << endl;
+    cerr << "         --rate=N      at most N objects per second" << endl;
+    cerr << "         --mode=M      sync, buffered (default) or noreply" << endl;
+    cerr << "         --restart     add JPEG restart markers for parallel decode" << endl;
+    cerr << "         --manifest=F  send only what changed since the load that" << endl;
+    cerr << "                       wrote F, then rewrite it" << endl;
+    cerr << "         --full        with --manifest, send everything anyway" << endl;
+    cerr << "         --delete      with --manifest, delete keys no longer loaded" << endl;
+    cerr << "       (ingest takes the same opts but --manifest, --full and --delete)" << endl;
+}
+
+// options to load or ingest from argv[a] on; returns the index of the
+// first argument after them, or -1
+static int
+parse_load_opts(int argc, char *argv[], int a)
+{
+    for ( ; a < argc && string(argv[a]).compare(0, 2, "--") == 0; a++) {
+        string opt(argv[a]), val;
+        auto idx = opt.find('=');
+        if (idx != string::npos) {
+            val = opt.substr(idx + 1);
+            opt = opt.substr(0, idx);
+        }
+        if (opt == "--restart") {
+            load_opts.restart = true;
+        } else if (opt == "--manifest" && !val.empty()) {
+            load_opts.manifest = val;
+        } else if (opt == "--full") {
+            load_opts.full = true;
+        } else if (opt == "--delete") {
+            load_opts.prune = true;
+        } else if (opt == "--threads" && atoi(val.c_str()) > 0) {
+            load_opts.threads = atoi(val.c_str());
+        } else if (opt == "--batch" && atoi(val.c_str()) > 0) {
+            load_opts.batch = atoi(val.c_str());
+        } else if (opt == "--rate" && atof(val.c_str()) >= 0) {
+            load_opts.rate = atof(val.c_str());
+        } else if (opt == "--mode" && val == "sync") {
+            load_opts.mode = LoadOptions::SYNC;
+        } else if (opt == "--mode" && val == "buffered") {
+            load_opts.mode = LoadOptions::BUFFERED;
+        } else if (opt == "--mode" && val == "noreply") {
+            load_opts.mode = LoadOptions::NOREPLY;
+        } else {
+            return -1;
+        }
+    }
+    return a;
 }
 
 int
@@ -655,21 +1730,42 @@ main(int argc, char *argv[])
         string images(argv[3]);
         ret = make_proto(egolist, images);
     } else if (cmd == "load") {
-        if (argc != 5) {
+        int a = parse_load_opts(argc, argv, 2);
+        if (a < 0 || argc != a + 3) {
             usage();
             return -1;
         }
         // path to file holding Vertex protobuf objects
-        string graph(argv[2]);
+        string graph(argv[a]);
         // path to file holding ImageList protobuf object
-        string images(argv[3]);
+        string images(argv[a + 1]);
         // path to config file
-        string config(argv[4]);
+        string config(argv[a + 2]);
         ret = load_proto(graph, images, config);
 
         cout << endl << "\tDon't forget to copy the graph ids file " << endl
             << "\t\tinto the storm resources/ directory before" << endl
             << "\t\tcreating the jar. 'make' will do this when building the jar." << endl;
+    } else if (cmd == "ingest") {
+        int a = parse_load_opts(argc, argv, 2);
+        if (a < 0 || argc != a + 2 || !load_opts.manifest.empty()
+                || load_opts.full || load_opts.prune) {
+            usage();
+            return -1;
+        }
+        // file with list of paths to images, as for proto
+        string images(argv[a]);
+        string config(argv[a + 1]);
+        ret = ingest(images, config);
+    } else if (cmd == "gr") {
+        if (argc != 4) {
+            usage();
+            return -1;
+        }
+        // the adjacency proto wrote, for the graph kernels
+        string csr(argv[2]);
+        string gr(argv[3]);
+        ret = export_gr(csr, gr);
     } else {
         usage();
         ret = -1;